@@ -0,0 +1,69 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Start of a pack. The entries follow, sorted by name, then the name table,
+// then the payloads, each at a multiple of AssetPack::alignment.
+struct AssetPackHeader
+{
+    char magic[4];          // "SSP1"
+    uint32_t numEntries;
+    uint64_t namesOffset, namesSize;
+};
+
+struct AssetPackEntry
+{
+    uint64_t offset, size;              // of the payload, from the file start
+    uint32_t nameOffset, nameLength;    // in the name table
+};
+
+// A file's bytes inside the mapping
+struct AssetEntry
+{
+    const unsigned char *data;
+    size_t size;
+};
+
+// Shaders and textures in one read-only mapped file, so a cold start opens
+// one file instead of twenty and uploads read the mapping directly. Files
+// are found by their path relative to the working directory, as the loose
+// files are named ("./shaders/x.glsl" and "shaders/x.glsl" are the same).
+class AssetPack
+{
+private:
+    const unsigned char *mapping;
+    size_t mappingSize;
+    const AssetPackEntry *entries;
+    const char *names;
+    int numEntries;
+
+    std::string entryName(int entry) const;
+
+public:
+    // Page sized, so a payload can be prefetched on its own and block data
+    // is aligned for the copies into pixel buffers
+    static const size_t alignment = 4096;
+
+    AssetPack();
+    ~AssetPack();
+    AssetPack(const AssetPack&) = delete;
+    AssetPack& operator=(const AssetPack&) = delete;
+
+    // The name a path is packed under
+    static std::string normalize(const std::string& path);
+
+    bool open(const char *filePath);
+    void close();
+    bool isOpen() const;
+    int size() const;
+
+    bool find(const std::string& path, AssetEntry& entry) const;
+    // Starts reading an entry in ahead of its first use
+    static void prefetch(const AssetEntry& entry);
+
+    // Packs the files under their normalized paths; used by packassets
+    static bool write(const char *filePath, const std::vector<std::string>& paths);
+};
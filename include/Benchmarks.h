@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+
+// Headless timing runs, started with `main.exec --bench <name>`.
+class Benchmarks
+{
+private:
+    static void writeSyntheticCatalog(const char *filePath, int numBodies);
+    static void makeDisk(class NBody& system, int numBodies);
+    static void writeSyntheticMinorPlanets(const char *filePath, int count);
+
+public:
+    static bool run(const std::string& name);
+    static void catalog();
+    static void kepler();
+    static void nbody();
+    static void direct();
+    static void blockSteps();
+    static void ephemeris();
+    static void transforms();
+    static void minorPlanets();
+};
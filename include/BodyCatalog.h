@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "Kepler.h"
+
+// Catalog of bodies loaded from a CSV file (see data/bodies.csv), stored as
+// structure-of-arrays so per-frame passes touch only the fields they need.
+// Parents always precede their children.
+class BodyCatalog
+{
+private:
+    std::unordered_map<std::string, int> bodyIndices;
+    std::unordered_map<std::string, int> textureIndices;
+
+    int addTexture(const std::string& path);
+
+public:
+    std::vector<std::string> names;
+    std::vector<int> parents;
+    std::vector<float> sizes;
+    std::vector<float> masses; // solar masses
+    OrbitalElements orbits; // relative to the parent
+    std::vector<int> textures; // index into texturePaths, -1 for sprite-only bodies
+    std::vector<bool> showOrbits;
+
+    std::vector<std::string> texturePaths;
+
+    // Positions relative to the parent, as the simulation last published them
+    std::vector<float> positionsX, positionsY, positionsZ;
+
+    BodyCatalog();
+    bool loadCSV(const char *filePath);
+    int addBody(const std::string& name, int parent, float size, float distance, float revolutionSpeed,
+        const std::string& texturePath, bool showOrbit, float eccentricity = 0.0f, float inclination = 0.0f,
+        float ascendingNode = 0.0f, float periapsisArgument = 0.0f, float mass = 0.0f);
+    void clear();
+    int getNumBodies();
+    int findBody(const std::string& name);
+
+    void resolveWorldPositions(float* x, float* y, float* z);
+};
@@ -4,7 +4,9 @@
 
 namespace Constants
 {
-    
+    // Reference scales. The bodies actually simulated and drawn are loaded
+    // from data/bodies.csv, whose values are derived from these.
+
     constexpr float sun_radius = 695700000;
     constexpr float sun_size = 100.0f; // --- 
     constexpr float sun_revolution_speed = 1.0f;
@@ -73,20 +75,11 @@ namespace Constants
     constexpr float neptune_year = 60190.0f;
     constexpr float neptune_revolution_speed = earth_revolution_speed * (earth_year / neptune_year);
 
-    const std::vector<float> Orbit_Ratios{1.0f, mercury_distance/earth_distance, \
-    venus_distance/earth_distance, mars_distance/earth_distance, \
-    jupiter_distance/earth_distance, saturn_distance/earth_distance, \
-    uranus_distance/earth_distance, neptune_distance/earth_distance};
-
-    const std::vector<float> Planet_Sizes{sun_size, earth_size, moon_size, mercury_size, \
-    venus_size, mars_size, jupiter_size, saturn_size, uranus_size, neptune_size};
-
-    const std::vector<float> Planet_Revolution_Speeds{sun_revolution_speed, earth_revolution_speed, \
-    moon_revolution_speed, mercury_revolution_speed, venus_revolution_speed, \
-    mars_revolution_speed, jupiter_revolution_speed, saturn_revolution_speed, \
-    uranus_revolution_speed, neptune_revolution_speed};
+    // G in scene units (distance, seconds, solar masses), chosen so that a
+    // body of Earth's distance orbits a one-solar-mass sun at Earth's speed
+    constexpr double gravitational_constant = (double)earth_revolution_speed * earth_revolution_speed * earth_distance * earth_distance * earth_distance;
 
-    const std::vector<float> Planet_Distances{sun_distance, earth_distance, moon_distance, \
-    mercury_distance, venus_distance, mars_distance, jupiter_distance, \
-    saturn_distance, uranus_distance, neptune_distance};
+    // Bodies whose projected diameter falls below this many pixels are drawn
+    // as point sprites instead of sphere meshes
+    constexpr float sprite_threshold_pixels = 4.0f;
 }
\ No newline at end of file
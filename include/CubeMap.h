@@ -0,0 +1,23 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+// Planet maps as cubemaps. An equirectangular map oversamples more and more
+// towards the poles and needs a seam in the sphere's texture coordinates; a
+// cube of the same resolution around the equator holds three quarters of
+// the texels and is sampled by direction, so the sphere needs neither.
+class CubeMap
+{
+public:
+    // Face side for a map width texels around: four faces span the equator
+    static int faceSize(int width);
+    // Unit direction through s, t in [0, 1] on a face, in
+    // GL_TEXTURE_CUBE_MAP_POSITIVE_X order with t running down the rows
+    static glm::vec3 direction(int face, float s, float t);
+    // Resamples 8-bit texels, flipped for OpenGL like the planet textures,
+    // into six RGB faces one after the other, from 2x2 bilinear samples a
+    // texel
+    static void fromEquirectangular(const unsigned char *texels, int width, int height, int channels, int size,
+        std::vector<unsigned char>& faces);
+};
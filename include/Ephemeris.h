@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+class BodyCatalog;
+
+// On-disk layout, in the spirit of the JPL DE files: a header, the number of
+// subintervals per body, then fixed-length time records. Each record holds,
+// body after body and subinterval after subinterval, the Chebyshev
+// coefficients of x, y and z relative to the parent.
+struct EphemerisHeader
+{
+    char magic[4];        // "EPH1"
+    int numBodies;
+    int numCoefficients;  // per component and subinterval
+    int numRecords;
+    double startTime;
+    double recordLength;  // seconds
+};
+
+// Precomputed positions read from a memory-mapped ephemeris file. A query
+// finds its record and subinterval by division, then sums a short Chebyshev
+// series with the Clenshaw recurrence, vectorized across queries.
+class Ephemeris
+{
+private:
+    void* mapping;
+    size_t mappingSize;
+    const EphemerisHeader* header;
+    const int* subintervals;
+    const double* records;
+    std::vector<long> bodyOffsets; // first coefficient of each body within a record
+    long recordSize;               // coefficients per record
+
+    long blockOffset(int body, double time, double& tau);
+    void evaluateBlocks(const long* offsets, const double* taus, float* x, float* y, float* z, int count);
+
+public:
+    static const int numCoefficients = 10;
+
+    Ephemeris();
+    ~Ephemeris();
+    Ephemeris(const Ephemeris&) = delete;
+    Ephemeris& operator=(const Ephemeris&) = delete;
+
+    bool load(const char *filePath);
+    void unload();
+    bool isLoaded();
+    bool covers(double time);
+    int getNumBodies();
+    double getStartTime();
+    double getEndTime();
+
+    // All bodies at one time (or count of them from first, into x, y and z
+    // indexed by body, so callers can split them over jobs), or one body at
+    // many times
+    void evaluate(double time, float* x, float* y, float* z, int first = 0, int count = -1);
+    void evaluateBody(int body, const double* times, float* x, float* y, float* z, int count);
+
+    // Samples the catalog's Keplerian orbits over [startTime, endTime) and
+    // writes the fitted coefficients to filePath.
+    static bool fit(const char *filePath, BodyCatalog& catalog, double startTime, double endTime,
+        double recordLength = 32.0);
+};
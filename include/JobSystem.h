@@ -0,0 +1,100 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <functional>
+#include <condition_variable>
+
+class JobSystem;
+
+// Counts the unfinished jobs of a group. Jobs submitted with a counter
+// increment it and decrement it when they finish; jobs queued with runAfter
+// start once it drops to zero.
+class JobCounter
+{
+private:
+    friend class JobSystem;
+    std::atomic<int> pending;
+    std::mutex mutex;
+    std::vector<std::function<void()>> continuations;
+
+public:
+    JobCounter() : pending(0) {}
+    bool done() {return pending.load(std::memory_order_acquire) == 0;}
+};
+
+// Per-frame scheduling numbers, see JobSystem::collectStats
+struct JobStats
+{
+    int numWorkers;
+    int jobs;             // run since the last collectStats
+    int steals;           // taken from another worker's deque
+    double busyMs;        // running jobs, summed over workers
+    double helperMs;      // running jobs on threads waiting in JobSystem::wait
+    double schedulingMs;  // submitting, popping and stealing, summed over all threads
+    double utilization;   // busyMs / (numWorkers * elapsed time)
+};
+
+// Work-stealing thread pool. Every worker owns a deque: it pushes and pops
+// its own jobs at the back and, when that is empty, steals from the front of
+// the others'. Threads outside the pool (the render and simulation threads)
+// submit into a shared deque and, instead of blocking in wait, run jobs
+// until their counter reaches zero. Parallel work while the scene runs goes
+// through it alone, so no second pool competes for the cores; OpenMP is left
+// to the offline tools and startup loading.
+class JobSystem
+{
+private:
+    struct Job
+    {
+        std::function<void()> function;
+        JobCounter* counter;
+    };
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+        std::atomic<long long> busyNs, schedulingNs;
+        std::atomic<int> executed, steals;
+
+        Queue() : busyNs(0), schedulingNs(0), executed(0), steals(0) {}
+    };
+
+    // One per worker, then the shared one for outside threads
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<bool> running;
+    std::atomic<int> queued;
+    std::atomic<int> sleeping;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    long long statsStart;
+
+    void workerLoop(int worker);
+    void push(const Job& job);
+    bool tryGetJob(int queue, Job& job);
+    void execute(int queue, Job& job);
+    void finish(JobCounter* counter);
+    int currentQueue();
+
+public:
+    // Defaults to one worker per hardware thread besides the caller
+    JobSystem(int numWorkers = -1);
+    ~JobSystem();
+
+    void run(const std::function<void()>& job, JobCounter* counter = nullptr);
+    void runAfter(JobCounter& dependency, const std::function<void()>& job, JobCounter* counter = nullptr);
+    // Splits [0, count) into ranges of about grain items; runs inline when
+    // there is only one. Waits for all of them.
+    void parallelFor(int count, int grain, const std::function<void(int first, int last)>& body);
+    void wait(JobCounter& counter);
+
+    int getNumWorkers();
+    // Counters since the previous call, which resets them
+    JobStats collectStats();
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+
+// Classical orbital elements in structure-of-arrays form. Angles are in
+// radians. The orientation (inclination, ascending node, argument of
+// periapsis) is folded into the perifocal basis vectors P and Q when an orbit
+// is added, in scene axes: the reference plane is xz and y points north.
+class OrbitalElements
+{
+public:
+    std::vector<float> semiMajorAxes;
+    std::vector<float> semiMinorAxes;
+    std::vector<float> eccentricities;
+    std::vector<float> meanMotions;   // radians per second
+    std::vector<float> meanAnomalies; // at time 0
+    std::vector<float> px, py, pz;    // unit vector towards periapsis
+    std::vector<float> qx, qy, qz;    // in-plane unit vector 90 degrees ahead of P
+
+    void add(float semiMajorAxis, float eccentricity, float inclination, float ascendingNode,
+        float periapsisArgument, float meanMotion, float meanAnomaly);
+    void clear();
+    int size();
+};
+
+// Two-body propagation. The batch paths run a fixed number of Halley steps
+// with no data-dependent branches, so they vectorize across bodies.
+class Kepler
+{
+public:
+    // Enough for float precision up to e = 0.99
+    static const int iterations = 4;
+
+    static void solve(const float* meanAnomalies, const float* eccentricities, float* eccentricAnomalies, int count);
+    static double solveReference(double meanAnomaly, double eccentricity);
+    static void propagate(OrbitalElements& orbits, double time, float* x, float* y, float* z,
+        int first = 0, int count = -1);
+    static void stateVector(OrbitalElements& orbits, int body, double time, double mu, double position[3], double velocity[3]);
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// A BC1 texture with its mip chain, as read from or written to a KTX2 file.
+// The level offsets index bytes: data, which holds the levels when encoded
+// and the whole file when loaded, or the memory it was read from. A cubemap
+// has one entry per level and face, at level * numFaces + face.
+struct KtxImage
+{
+    int width, height;
+    int numLevels;                      // level 0 is the full size
+    int numFaces;                       // 1, or 6 in GL_TEXTURE_CUBE_MAP_POSITIVE_X order
+    std::vector<unsigned char> data;
+    const unsigned char *bytes;
+    size_t numBytes;
+    std::vector<size_t> levelOffsets, levelSizes;
+    bool hasAverageColor;
+    float averageColor[3];
+};
+
+// Block compression and the KTX2 container for the texture cache. Only
+// opaque BC1 (DXT1) is written: the planet maps and skybox are RGB JPEGs,
+// so BC1's 4 bits per texel lose little against BC7 at half the size, and
+// it is the format every desktop driver supports.
+class Ktx
+{
+public:
+    static const uint32_t vkFormatBC1 = 131;  // VK_FORMAT_BC1_RGB_UNORM_BLOCK
+    static const int blockBytes = 8;
+
+    // The cache file of an image: the same path with a .ktx2 extension
+    static std::string cachePath(const std::string& imagePath);
+    // Whether the cache exists and is newer than the image, or the image is gone
+    static bool isCurrent(const std::string& imagePath);
+
+    static size_t levelSize(int width, int height);
+    // Halves RGB texels with a box filter, as the mip chains are made
+    static void downsample(const std::vector<unsigned char>& source, int width, int height,
+        std::vector<unsigned char>& target);
+
+    // Compresses 8-bit RGB(A) texels, with a box-filtered mip chain down to
+    // 1x1 when mipmaps is set
+    static void encode(const unsigned char *texels, int width, int height, int channels, bool mipmaps,
+        KtxImage& image);
+    // Six square RGB faces one after the other, as CubeMap makes them
+    static void encodeCubemap(const unsigned char *faces, int size, bool mipmaps, KtxImage& image);
+    static void encodeBlock(const unsigned char texels[16][3], unsigned char block[8]);
+    static void decodeBlock(const unsigned char block[8], unsigned char texels[16][3]);
+
+    static bool save(const char *filePath, const KtxImage& image);
+    static bool load(const char *filePath, KtxImage& image);
+    // From a whole file in memory, such as an asset pack mapping; the image
+    // points into it, so it must outlive the image. name is for messages.
+    static bool read(const unsigned char *bytes, size_t size, const char *name, KtxImage& image);
+};
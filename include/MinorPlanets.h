@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+// Header of the binary cache written after an import. The element arrays
+// follow it in the order of the MinorPlanets members, count floats each.
+struct MinorPlanetsHeader
+{
+    char magic[4];          // "MPC1"
+    int32_t count;
+    int64_t sourceSize;     // size and modification time of the imported file,
+    int64_t sourceTime;     // so a changed file invalidates the cache
+};
+
+// Osculating elements of the numbered and unnumbered minor planets, as
+// structure-of-arrays. Heliocentric ecliptic J2000; angles in radians,
+// semi-major axes in AU.
+class MinorPlanets
+{
+private:
+    bool importFile(const char *filePath);
+    bool loadCache(const char *cachePath, int64_t sourceSize, int64_t sourceTime);
+    void saveCache(const char *cachePath, int64_t sourceSize, int64_t sourceTime);
+
+public:
+    std::vector<float> semiMajorAxes;
+    std::vector<float> eccentricities;
+    std::vector<float> inclinations;
+    std::vector<float> ascendingNodes;
+    std::vector<float> periapsisArguments;
+    std::vector<float> meanAnomalies;       // at the file's epoch
+    std::vector<float> absoluteMagnitudes;  // H, blank ones read as 0
+
+    // Bytes per parallel parsing chunk, about 20000 records
+    static const long chunkBytes = 4 << 20;
+
+    // Imports an MPCORB.DAT-style fixed-width file, or reads the cache next
+    // to it (filePath + ".cache") when it was written from the same file; a
+    // fresh import writes the cache
+    bool load(const char *filePath);
+    void clear();
+    int size();
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include "BodyCatalog.h"
+#include "JobSystem.h"
+
+struct OctreeNode
+{
+    double centerX, centerY, centerZ; // geometric center of the cell
+    double halfSize;
+    double massX, massY, massZ;       // center of mass
+    double mass;
+    int firstChild;                   // 8 consecutive children, -1 for a leaf
+    int firstBody, numBodies;         // range in the body order
+};
+
+// Which method computeForces uses. Direct summation is exact and, thanks to
+// its SIMD kernel, faster than the tree up to a few tens of thousands of
+// bodies.
+enum ForceBackend
+{
+    BARNES_HUT,
+    DIRECT
+};
+
+struct NBodyStats
+{
+    int numBodies;
+    double stepMs;
+    double buildMs;
+    double forceMs;
+    double interactions;  // body-body and body-cell interactions per step
+    double energy;
+    double energyDrift;   // |E - E0| / |E0|
+    int substeps;         // force evaluation rounds per step, 1 without block timesteps
+    double forceEvaluations; // bodies that received new forces, summed over substeps
+    int deepestLevel;
+};
+
+// Mutual gravity with a kick-drift-kick leapfrog. Forces come either from a
+// Barnes-Hut octree that is built and walked in parallel on the job system,
+// or from a tiled direct sum. With block timesteps each body steps at its own
+// power-of-two subdivision of the base step.
+class NBody
+{
+private:
+    JobSystem& jobs;
+    std::vector<OctreeNode> nodes;
+    std::atomic<int> numNodes;
+    std::vector<int> bodyOrder;
+    std::vector<int> orderScratch;
+    std::vector<int> activeBodies;   // targets of the next force evaluation
+    std::vector<double> previousX, previousY, previousZ;
+    double initialEnergy;
+
+    void buildTree();
+    void buildNode(int node, int depth);
+    int octantOf(const OctreeNode& cell, int body);
+    void computeForces();
+    void computeForcesTree();
+    void computeForcesDirect();
+    void stepBlock(double dt);
+    int levelFor(double dt, double a2, double j2);
+
+public:
+    std::vector<double> positionsX, positionsY, positionsZ;
+    std::vector<double> velocitiesX, velocitiesY, velocitiesZ;
+    std::vector<double> accelerationsX, accelerationsY, accelerationsZ;
+    std::vector<double> potentials;
+    std::vector<double> masses;
+
+    double gravitationalConstant;
+    double openingAngle;  // theta; cells with size / distance below it are not opened
+    double softening;
+    int leafSize;
+    ForceBackend forceBackend;
+    bool blockTimesteps;
+    int maxLevel;            // finest step is dt / 2^maxLevel
+    double timestepAccuracy; // eta in dt = eta * sqrt(|a| / |da/dt|)
+    std::vector<int> levels; // per-body step level, dt / 2^level
+
+    NBodyStats stats;
+
+    NBody(JobSystem& jobs);
+    void clear();
+    int addBody(double x, double y, double z, double vx, double vy, double vz, double mass);
+    void initFromCatalog(BodyCatalog& catalog, double time);
+    void start();
+    void step(double dt);
+    double totalEnergy();
+    int getNumBodies();
+};
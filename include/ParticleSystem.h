@@ -0,0 +1,87 @@
+#pragma once
+
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "MinorPlanets.h"
+
+// A belt or ring of particles on Keplerian orbits around one catalog body.
+// Orbits are drawn uniformly between the radii; eccentricities and
+// inclinations (relative to the belt plane) up to the given maxima.
+struct ParticleBelt
+{
+    int parent;
+    float innerRadius, outerRadius;
+    float maxEccentricity;
+    float maxInclination; // radians
+    float tilt;           // belt plane about the x axis, radians
+    float minSize, maxSize;
+    bool logRadius;       // radii spaced logarithmically instead of linearly
+    glm::vec3 color;
+    double mu;            // gravitational parameter of the parent
+    int first, count;     // range of particles, filled in by addBelt
+};
+
+struct ParticleStats
+{
+    int numParticles;
+    int rocks, points;    // drawn in the last frame
+    double computeMs;     // GPU time of the update pass
+    double particlesPerMs;
+};
+
+// Particles live on the GPU only. Each one is 16 bytes of quantized orbit
+// elements; a compute pass advances all of them every frame, culls them
+// against the frustum and sorts the survivors by projected size into
+// instanced low-poly rocks and point sprites, counted straight into the
+// indirect draw commands.
+class ParticleSystem
+{
+private:
+    struct DrawCommand
+    {
+        GLuint count, instanceCount, first, baseInstance;
+    };
+
+    std::vector<ParticleBelt> belts;
+    std::vector<GLuint> packed; // four words per particle until upload
+
+    GLuint computeProgram, pointProgram, rockProgram;
+    GLuint particleBuffer, beltBuffer, commandBuffer, rockBuffer, pointBuffer;
+    GLuint readbackBuffer;  // copy of the commands, read once its fence signals
+    GLsync readbackFence;
+    GLuint rockVAO, rockVBO, pointVAO;
+    GLuint queries[2];
+    int numParticles, numRockVertices;
+    int rocks, points;      // counts of the last copy read back
+    long frame;
+    double computeMs;
+
+    void createRockMesh();
+
+public:
+    static const int maxBelts = 8;
+    static const int groupSize = 256;
+
+    // Projected diameter in pixels above which a particle is drawn as a rock
+    float rockThreshold;
+
+    ParticleSystem();
+
+    // Generates the belt's particles; returns its index, or -1 when full
+    int addBelt(const ParticleBelt& belt, int count);
+    // One particle per minor planet, on its own orbit; the belt gives the
+    // parent, sizes and color and gets the radii and maxima of the data.
+    // auScale converts AU to scene units.
+    int addPopulation(const ParticleBelt& belt, MinorPlanets& planets, float auScale);
+    int getNumParticles();
+    // Compiles the programs and moves the particles to the GPU
+    void upload();
+
+    // centers: world position of each belt's parent
+    void update(double time, const glm::mat4& vMat, const glm::mat4& pMat, float pixelScale,
+        const std::vector<glm::vec3>& centers);
+    void draw(double time, const glm::mat4& vMat, const glm::mat4& pMat, float pixelScale);
+    // The draw counts are those of a recent frame, read without stalling
+    ParticleStats collectStats();
+};
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "JobSystem.h"
+
+struct TerrainStats
+{
+    int chunks, deepestLevel;   // drawn in the last frame
+    int cached, generating;
+    int generated, evicted;     // since the last call
+    double selectMs;            // CPU time of the last selection
+};
+
+// Terrain of one body for close approaches, in place of its sphere: the unit
+// sphere as the six faces of a cube, each a quadtree of chunks displaced
+// along the radius by a height field (CDLOD, Strugar 2009). Every chunk is
+// the same grid, drawn instanced; a chunk only brings its heights, generated
+// on the job system and cached in the layers of a texture array.
+//
+// A chunk is split while the camera is within lodFactor chunk sizes of it,
+// and its vertices morph onto the coarser grid of its parent towards the
+// end of that range, so neighbors a level apart meet without cracks. The
+// parent is drawn until all four children are cached, and the cap below can
+// stop a split, so neighbors may be further apart; a skirt hanging below
+// each chunk's edges covers their gaps. Generation, uploads and drawn
+// chunks are capped, so a frame costs the same from orbit to the ground.
+class PlanetTerrain
+{
+private:
+    struct Chunk
+    {
+        int layer;
+        long long used;             // frame it was last selected or needed
+        float minHeight, maxHeight;
+    };
+    struct GeneratedChunk
+    {
+        uint64_t key;
+        std::vector<float> heights;
+        float minHeight, maxHeight;
+    };
+    // As vertShader_Terrain.glsl reads an instance
+    struct GpuChunk
+    {
+        int face, level, x, y;
+        float morphStart, morphEnd, layer, unused;
+    };
+    struct Node
+    {
+        int face, level, x, y;
+        float morphEnd;
+        float distance;     // from the camera to its bounds, negative when culled
+    };
+
+    JobSystem& jobs;
+    std::string heightmapPath;
+    std::vector<unsigned short> heightmap;      // equirectangular, top row first
+    int heightmapWidth, heightmapHeight;
+
+    std::unordered_map<uint64_t, Chunk> chunks;
+    std::vector<uint64_t> layerChunks;          // per layer, 0 when free
+    std::unordered_set<uint64_t> requested;     // being generated
+    long long frame;
+
+    JobCounter generation;
+    std::mutex generatedMutex;
+    std::vector<GeneratedChunk> generated;
+
+    std::vector<GpuChunk> selected;
+    std::vector<std::pair<float, uint64_t>> missing;   // needed this frame, with the distance
+    GLuint heightTexture, gridVao, gridVbo, gridIbo, chunkBuffer;
+    int numGridIndices;
+
+    int numGenerated, numEvicted, deepestLevel;
+    double selectMs;
+
+    static uint64_t chunkKey(int face, int level, int x, int y);
+    static glm::vec3 facePoint(int face, int level, int x, int y, float s, float t);
+    void generate(uint64_t key, GeneratedChunk& result);
+    float boundsDistance(const Node& node, const glm::vec3& camera, const glm::vec4 planes[6]);
+    void select(const glm::vec3& camera, const glm::vec4 planes[6]);
+    void requestChunks();
+    void uploadChunks();
+    void uploadChunk(GeneratedChunk& chunk, int layer);
+    int findLayer();
+
+public:
+    static const int gridSize = 32;                 // quads across a chunk
+    static const int gridTexels = gridSize + 3;     // heights across, with a ring around for normals
+    static const int maxLevel = 12;
+    static const int cacheLayers = 1024;
+    // Work per update, so a fast descent never takes a frame's time
+    static const int maxDrawnChunks = 768;
+    static const int maxUploadsPerFrame = 32;
+    static const int maxJobsInFlight = 64;
+
+    float heightScale;      // highest terrain over the radius, in radii
+    float lodFactor;        // split distance in chunk sizes
+
+    PlanetTerrain(JobSystem& jobs);
+    ~PlanetTerrain();
+    PlanetTerrain(const PlanetTerrain&) = delete;
+    PlanetTerrain& operator=(const PlanetTerrain&) = delete;
+
+    // A 16-bit grey equirectangular map added to the procedural relief;
+    // call before create
+    bool loadHeightmap(const char *filePath);
+    // With a current context: the grid, the height cache and the six roots,
+    // which stay cached so there is always something to draw
+    void create();
+    // Once a frame on the render thread. camera is in the body's unit-sphere
+    // frame and clip takes that frame to clip space.
+    void update(const glm::vec3& camera, const glm::mat4& clip);
+    // Draws the selected chunks with program, which must be in use
+    void draw(GLuint program);
+    // Waits for generation and releases the GL objects
+    void close();
+
+    // Height in [0, 1] of the terrain in a direction from the center
+    float height(const glm::vec3& direction);
+    TerrainStats collectStats();
+    void printStats(const std::string& name);
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include "BodyCatalog.h"
+#include "Ephemeris.h"
+#include "SimulationClock.h"
+#include "NBody.h"
+#include "TripleBuffer.h"
+#include "JobSystem.h"
+
+// One tick of the simulation, as handed to the renderer
+struct SimulationState
+{
+    double time;                // simulation time
+    double realTime;            // wall-clock time the tick stands for, see Simulation::now
+    int discontinuity;          // bumped on seeks and mode changes, which must not be interpolated
+    std::vector<float> x, y, z; // positions relative to the parent, empty with propagation off
+
+    double tickRate;            // ticks per second, and milliseconds of work per tick
+    double tickMs;
+    bool nbodyMode;
+    NBodyStats nbodyStats;
+};
+
+// Orbital update on its own thread at a fixed timestep. Each tick is
+// published through a triple buffer; the renderer interpolates between the
+// two latest ticks without ever waiting on the simulation. Input reaches the
+// simulation as commands, run on its thread at the start of the next tick.
+class Simulation
+{
+private:
+    BodyCatalog& catalog;
+    Ephemeris& ephemeris;
+    JobSystem& jobs;
+    SimulationClock clock;
+    NBody nbody;
+    bool nbodyMode;
+    bool propagation;
+    double nbodyTime;
+    int discontinuity;
+
+    TripleBuffer<SimulationState> states;
+    std::thread thread;
+    std::atomic<bool> running;
+    std::mutex commandMutex;
+    std::vector<std::function<void()>> commands;
+
+    // Render-thread side
+    SimulationState previous, current;
+    bool hasState;
+
+    void run();
+    void tick(long tickIndex, double realTime, SimulationState& state);
+
+public:
+    static constexpr double fixedStep = 1.0 / 120.0;
+    // N-body catch-up per tick: substeps no longer than nbodyMaxStep, at most
+    // nbodyMaxSubsteps of them
+    static constexpr double nbodyMaxStep = 0.01;
+    static const int nbodyMaxSubsteps = 8;
+    // Bodies per propagation job
+    static const int propagateGrain = 4096;
+
+    Simulation(BodyCatalog& catalog, Ephemeris& ephemeris, JobSystem& jobs);
+    ~Simulation();
+    void start();
+    void stop();
+
+    // Runs the command on the simulation thread before its next tick. The
+    // accessors below are only safe to use from inside commands.
+    void post(const std::function<void()>& command);
+    SimulationClock& getClock();
+    NBody& getNBody();
+    void setNBodyMode(bool enabled);
+    bool getNBodyMode();
+    // Off when the renderer evaluates the orbits itself: ticks then only
+    // advance the clock. N-body mode always produces positions.
+    void setPropagation(bool enabled);
+    void seek(double time);
+
+    // Positions at realTime minus one tick, interpolated between the two
+    // latest ticks. Returns the latest state, or null before the first tick.
+    const SimulationState* interpolate(double realTime, float* x, float* y, float* z, double& time);
+
+    // Seconds on the clock shared by both threads
+    static double now();
+};
@@ -0,0 +1,34 @@
+#pragma once
+
+// Simulation time, decoupled from the wall clock. Each update advances it by
+// the real time elapsed since the last one times the warp factor, which may
+// be negative to run backwards; seek sets it directly. Positions are always
+// evaluated from the time itself, so a large warp costs nothing per frame.
+// Kept in double: even 1e9 scene years in, adjacent times are well under a
+// millisecond apart.
+class SimulationClock
+{
+private:
+    double time;
+    double warp;
+    bool paused;
+    double lastRealTime;
+    bool started;
+
+public:
+    static constexpr double maxWarp = 1e9;
+
+    SimulationClock();
+    double update(double realTime);
+    double getTime();
+    double getWarp();
+    bool isPaused();
+    void setWarp(double factor);
+    void togglePause();
+    void reverse();
+    void seek(double newTime);
+
+    // One scene year is one revolution of the earth
+    static double yearsToTime(double years);
+    static double timeToYears(double seconds);
+};
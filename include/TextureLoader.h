@@ -0,0 +1,198 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include "JobSystem.h"
+#include "Ktx.h"
+#include "AssetPack.h"
+
+// When one image was decoded and uploaded, in ms since load started
+struct TextureTiming
+{
+    double decodeStart, decodeEnd;
+    double uploadStart, uploadEnd;
+};
+
+// Residency of the mipmapped textures (see TextureLoader::budgetBytes)
+struct TextureStats
+{
+    int full, reduced, evicted, restoring;  // now
+    long long gpuBytes, budgetBytes;
+    int reductions, evictions, restores;    // since the last call
+};
+
+// Loads the startup textures together: every image is decoded by a job on
+// the pool and uploaded through a pixel buffer as soon as its decode
+// finishes. loadAll does the uploads on the calling thread and returns when
+// they are done; start hands them to a loader thread with its own shared
+// context, so the first frames draw while the textures stream in.
+//
+// Once everything is loaded, the mipmapped textures are kept within a VRAM
+// budget. Each frame the bodies request their textures at their size on
+// screen; when the budget runs out, textures not requested lately drop to
+// their smallest levels and then are evicted, least recently used first,
+// and those in view drop the levels they are too small on screen for. Levels
+// are dropped by copying the rest into a smaller texture on the GPU; a
+// texture that needs them again is decoded anew from its KTX2 cache, the
+// pack or the image, on the job system, and uploaded on the render thread.
+class TextureLoader
+{
+private:
+    struct Image
+    {
+        std::string path;
+        int texture;      // index of the texture it belongs to
+        int face;         // cubemap face, or -1 for a 2D texture or planet map
+        bool toCubemap;   // a planet map, resampled into all six faces
+        unsigned char *data;
+        std::vector<unsigned char> faces;   // instead of data once resampled
+        KtxImage compressed;  // instead of data when read from the cache
+        bool isCompressed;
+        int width, height, channels;
+        int dropLevels;   // of its mip chain, left out of the upload
+        glm::vec3 averageColor;
+        TextureTiming timing;
+    };
+
+    struct Texture
+    {
+        GLuint id;
+        bool cubemap;
+        glm::vec3 averageColor;
+        int pendingImages;
+        bool resident;
+        bool mipmaps;
+        bool loaded;            // its average color is known
+        int image;              // its first image
+
+        // Residency, for textures with mipmaps once uploaded
+        int width, height, numLevels;   // of the whole chain
+        bool compressed;
+        int dropped;            // levels above the resident ones, numLevels when evicted
+        int wanted;             // levels it can do without at its size on screen
+        float requested;        // largest diameter on screen this frame, in pixels
+        float demand;           // the same, of the last frame
+        long long used;         // frame it was last requested
+        bool restoring;
+        long long bytes, reservedBytes;
+    };
+
+    // An uploaded texture waiting for the GPU to finish with it
+    struct Fence
+    {
+        int texture;
+        GLsync sync;
+    };
+
+    JobSystem& jobs;
+    std::vector<Image> images;
+    std::vector<Texture> textures;
+    GLuint placeholder, placeholderCubemap;
+    long long startNs;
+    double totalMs;
+    int numResident;
+    std::atomic<long long> gpuBytes;   // also counted by the loader thread during the load
+    int numCompressed;
+    bool loadFinished;          // the loader thread is done with the textures
+
+    long long frame;
+    long long reservedBytes;    // by restores in flight
+    int numRestoring;
+    int numReductions, numEvictions, numRestores;
+
+    JobCounter decoding;
+    // Indices of decoded images not uploaded yet
+    std::mutex readyMutex;
+    std::condition_variable readyChanged;
+    std::vector<int> ready;
+    bool stopping;
+
+    GLFWwindow *uploadWindow;
+    std::thread uploadThread;
+    std::mutex fenceMutex;
+    std::vector<Fence> fenced;   // from the loader thread
+    std::vector<Fence> pending;  // being polled by update
+
+    void createTextures();
+    void decodeAll();
+    void decode(int image);
+    bool upload(Image& image);
+    void uploadAll(bool useFences);
+    void uploadLoop();
+    void finish();
+
+    GLuint createTexture(const Texture& texture);
+    bool isManaged(const Texture& texture);
+    long long residentBytes(const Texture& texture, int dropped);
+    int tailLevel(const Texture& texture);
+    int levelFor(const Texture& texture, float pixels);
+    int restoreLevel(const Texture& texture);
+    bool updateResidency();
+    bool makeRoom(long long bytes);
+    void reduce(Texture& texture, int dropped);
+    void restore(int texture);
+    bool uploadRestored();
+
+public:
+    // Shown until a texture is resident
+    static const glm::vec3 placeholderColor;
+    // Read an image's BC1 KTX2 cache (see ktxconvert) instead of decoding it
+    // when the cache is current and the driver supports BC1
+    bool preferCompressed;
+    // Images and their caches are read from the pack when it holds the
+    // image, and from disk otherwise
+    const AssetPack *assets;
+    // VRAM for all the textures; 0 for no limit
+    long long budgetBytes;
+
+    // Smallest side a texture out of view drops to before it is evicted
+    static const int tailSize = 16;
+    // Work per update, so restores never take a frame's time
+    static const int maxRestoresInFlight = 4;
+    static const int maxRestoresPerFrame = 2;
+
+    TextureLoader(JobSystem& jobs);
+
+    // Both return the texture's index. 2D textures are flipped for OpenGL
+    // and get mipmaps; cubemap faces are in GL_TEXTURE_CUBE_MAP_POSITIVE_X
+    // order.
+    int addTexture(const std::string& path);
+    int addCubemap(const std::vector<std::string>& faces);
+    // An equirectangular planet map as a cubemap with mipmaps, sampled by
+    // direction (see CubeMap.h). Its KTX2 cache holds the cube; a 2D cache
+    // from an older ktxconvert is passed over.
+    int addPlanetMap(const std::string& path);
+
+    // Decodes and uploads everything added so far; returns when all of it
+    // is on the GPU
+    void loadAll();
+    // Starts loading in the background; falls back to loadAll when no
+    // context can be shared with the window
+    void start(GLFWwindow *window);
+    // Once a frame on the render thread: makes textures whose uploads have
+    // finished resident, then keeps the budget. Returns whether any texture
+    // or average color changed.
+    bool update();
+    // A body with the texture is in view, pixels across; call between updates
+    void request(int texture, float pixels);
+    // Before the window goes away
+    void stop();
+
+    // The placeholder until the texture is resident
+    GLuint getTexture(int texture);
+    // Mean texel color of a 2D texture or planet map, the placeholder color
+    // until it is first resident, white if it failed to load
+    glm::vec3 getAverageColor(int texture);
+    bool isResident(int texture);
+    bool allResident();
+
+    void printTimeline();
+    TextureStats collectStats();
+};
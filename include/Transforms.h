@@ -0,0 +1,25 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// Batched matrix construction. Every body's model matrix is a translation, a
+// spin about y and a uniform scale, so rather than chaining glm::translate,
+// rotate and scale per body, the product with the view matrix is written out
+// in closed form over structure-of-arrays inputs. The loops have no branches
+// or library calls and vectorize across bodies.
+class Transforms
+{
+public:
+    // For bodies [first, first + count): view * translate(x, y, z) *
+    // rotate(angles, y axis) * scale(scales), written column-major to
+    // matrices + 16 * i. Angles must be within about 1e4 radians. The view
+    // matrix must be affine. The translation column is also written to
+    // centerX/Y/Z, because matrices may point to write-only mapped memory.
+    static void modelView(const glm::mat4& view, const float* x, const float* y, const float* z, const float* angles,
+        const float* scales, float* matrices, float* centerX, float* centerY, float* centerZ, int first, int count);
+
+    // The same matrices, built the way the renderer used to, for checking
+    // and timing the batch path
+    static void modelViewReference(const glm::mat4& view, const float* x, const float* y, const float* z,
+        const float* angles, const float* scales, float* matrices, int first, int count);
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+
+// Single-producer, single-consumer hand-off of the latest value. The writer
+// fills the back slot and publishes it by swapping it with the middle one;
+// the reader swaps the middle slot into the front when it holds something
+// new. Neither side ever waits for the other, and slots are reused, so
+// values holding vectors stop allocating once they have grown.
+template <typename T>
+class TripleBuffer
+{
+private:
+    static const int indexMask = 3;
+    static const int freshBit = 4;
+
+    T slots[3];
+    std::atomic<int> middle; // slot index, plus freshBit when not yet read
+    int back, front;
+
+public:
+    TripleBuffer() : middle(1), back(0), front(2) {}
+
+    // Writer side
+    T& getBack() {return slots[back];}
+    void publish()
+    {
+        back = middle.exchange(back | freshBit, std::memory_order_acq_rel) & indexMask;
+    }
+
+    // Reader side. Returns whether a newer value was swapped in.
+    bool update()
+    {
+        if(!(middle.load(std::memory_order_relaxed) & freshBit))
+        {
+            return false;
+        }
+        front = middle.exchange(front, std::memory_order_acq_rel) & indexMask;
+        return true;
+    }
+    const T& getFront() {return slots[front];}
+};
@@ -10,25 +10,81 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include "Ktx.h"
+#include "AssetPack.h"
+
+// Not in the core profile glad was generated for
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
 
 class Utils
 {
 private:
+	// Compiled and linked, its status not checked yet
+	struct PendingProgram
+	{
+		GLuint program;
+		std::vector<GLenum> types;
+		std::vector<GLuint> shaders;
+		std::string cachePath;
+	};
+	static const AssetPack *assetPack;
+	static std::string programCacheDirectory;
+	static int programsLoaded, programsBuilt;
+	static double programMs;
+	static bool batchingPrograms, parallelCompile;
+	static std::vector<PendingProgram> pendingPrograms;
 	static std::string readShaderFile(const char *filePath);
 	static void printShaderLog(GLuint shader);
 	static void printProgramLog(int prog);
-	static GLuint prepareShader(int shaderTYPE, const char *shaderPath);
-	static int finalizeShaderProgram(GLuint sprogram);
+	static GLuint prepareShader(int shaderTYPE, const std::string& source);
+	static bool checkShader(GLenum shaderTYPE, GLuint shader);
+	static void finishPrograms();
+	static GLuint buildProgram(const std::vector<GLenum>& types, const std::vector<const char*>& paths);
+	static std::string programCachePath(const std::vector<GLenum>& types, const std::vector<std::string>& sources);
+	static bool loadProgramBinary(GLuint program, const std::string& path);
+	static void saveProgramBinary(GLuint program, const std::string& path);
 
 public:
 	Utils();
 	static bool checkOpenGLError();
+	// Shaders are read from the pack when it holds them, else from disk
+	static void setAssetPack(const AssetPack *pack);
+	// Linked programs are kept in directory as driver binaries, keyed by a
+	// hash of their stages' sources and the driver's vendor, renderer and
+	// version, and loaded from there instead of being built. A binary the
+	// driver rejects is rebuilt and replaced. nullptr turns the cache off.
+	static void setProgramCache(const char *directory);
+	// Programs created between these are built together: their compiles and
+	// links are only submitted, so the driver can work on all of them at
+	// once (on its own threads with GL_KHR_parallel_shader_compile), and
+	// endPrograms checks them. A handle can be used before that; the call
+	// then waits for its program.
+	static void beginPrograms();
+	static void endPrograms();
+	// Programs created so far: how many came from binaries, and the time taken
+	static void printProgramStats();
 	static GLuint createShaderProgram(const char *vp, const char *fp);
 	static GLuint createShaderProgram(const char *vp, const char *gp, const char *fp);
 	static GLuint createShaderProgram(const char *vp, const char *tCS, const char* tES, const char *fp);
 	static GLuint createShaderProgram(const char *vp, const char *tCS, const char* tES, char *gp, const char *fp);
+	static GLuint createComputeProgram(const char *cp);
 	static GLuint loadTexture(const char *texImagePath);
+	static GLuint loadTexture(const char *texImagePath, glm::vec3& averageColor);
 	static GLuint loadCubemap(std::vector<std::string> faces);
+	// Mean texel color of 8-bit image data, used when a body is drawn as a point sprite
+	static glm::vec3 averageColor(const unsigned char *data, int width, int height, int channels);
+	// BC1 (DXT1) textures, as the KTX2 cache stores them; needs a current context
+	static bool compressionSupported();
+	// Specifies every level of a BC1 image, or of one face of a cubemap, on
+	// target, from firstLevel on as level 0. source is the image's data, or 0
+	// when a pixel unpack buffer holding it is bound.
+	static void uploadCompressed(GLenum target, const KtxImage& image, const unsigned char *source, int face = 0,
+		int firstLevel = 0);
 
 	static float* goldAmbient();
 	static float* goldDiffuse();
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstdint>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "JobSystem.h"
+
+// Start of a tile pyramid file (see vtbuild). Level 0 has power-of-two
+// sides; every level halves them down to one tile, and the tiles follow
+// from level 0 up, each row of a level from the bottom, at dataOffset.
+struct VirtualTextureHeader
+{
+    char magic[4];          // "SSV1"
+    int32_t width, height;
+    int32_t numLevels;
+    float averageColor[3];
+    uint64_t dataOffset;
+};
+
+// Sparse texture for planet maps too large to upload: only the tiles the
+// last frames sampled are resident, in a cache texture of a fixed number of
+// slots, so VRAM use does not depend on the map's size.
+//
+// The body fragment shader looks up each texel through a page table, a mip
+// chain with one texel per tile holding the cache slot of the tile or of
+// its nearest resident ancestor, and marks the tile it wanted in a feedback
+// bitset. update reads that back a few frames later, reads missing tiles
+// from the mapped file on the job system, uploads the finished ones into
+// slots freed least recently used first, and rewrites the page table.
+class VirtualTexture
+{
+private:
+    struct LoadedTile
+    {
+        int tile;
+        std::vector<unsigned char> data;
+    };
+
+    JobSystem& jobs;
+    std::string path;
+    const unsigned char *mapping;
+    size_t mappingSize;
+    VirtualTextureHeader header;
+    std::vector<int> levelFirstTile, levelTilesX, levelTilesY;
+    int numTiles;
+
+    int cacheTiles;         // slots across the cache texture
+    bool compressed;        // BC1 cache, else tiles are decoded to RGB
+    GLuint cacheTexture, pageTable;
+    GLuint feedbackBuffer, readbackBuffer;
+    GLsync readbackFence;
+
+    std::vector<int> tileSlots;             // per tile, -1 when not resident
+    std::vector<int> slotTiles;             // per slot, -1 when free
+    std::vector<long long> slotUsed;        // feedback round that last needed it
+    std::vector<char> tileLoading;
+    long long feedbackRound;
+    int frame;
+    bool pageTableDirty;
+
+    JobCounter reading;
+    std::mutex loadedMutex;
+    std::vector<LoadedTile> loaded;
+    int numReading;
+    int numUploaded, numEvicted;
+
+    int tileIndex(int level, int x, int y);
+    const unsigned char *tileData(int tile);
+    void readTile(int tile, std::vector<unsigned char>& data);
+    void processFeedback(const uint32_t *requested);
+    void requestTiles(std::vector<int>& missing);
+    void uploadTiles();
+    void uploadTile(int tile, const std::vector<unsigned char>& data, int slot);
+    int findSlot();
+    void writePageTable();
+
+public:
+    static const int tileSize = 128;        // texels of a tile's own area
+    static const int border = 4;            // texels repeated from its neighbors
+    static const int tileTexels = tileSize + 2 * border;
+    static const int tileBytes = tileTexels / 4 * (tileTexels / 4) * 8;   // as BC1
+    static const int numLevelsMax = 16;
+    // Work per update, so streaming never takes a frame's time
+    static const int maxUploadsPerFrame = 16;
+    static const int maxReadsInFlight = 64;
+
+    VirtualTexture(JobSystem& jobs);
+    ~VirtualTexture();
+    VirtualTexture(const VirtualTexture&) = delete;
+    VirtualTexture& operator=(const VirtualTexture&) = delete;
+
+    // Whether a catalog texture path names a tile pyramid
+    static bool isVirtual(const std::string& path);
+
+    // Maps the file and, with a current context, creates the cache of
+    // cacheTiles * cacheTiles slots and loads the top level, which stays
+    // resident so every lookup finds a tile
+    bool open(const char *filePath, int cacheTiles = 32);
+    // Once a frame on the render thread, before the bodies are drawn
+    void update();
+    // Binds the page table, cache and feedback buffer and sets the lookup
+    // uniforms of program, which must be in use
+    void bind(GLuint program);
+    // Waits for tile reads and releases the GL objects and the mapping
+    void close();
+
+    glm::vec3 getAverageColor();
+    long long getCacheBytes();
+    void printStats();
+};
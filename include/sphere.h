@@ -16,6 +16,7 @@ private:
     std::vector<glm::vec3> normals;
 
     void init(int);
+    int vertexIndex(int prec, int i, int j);
     float toRadians(float degrees);
 
 public:
@@ -0,0 +1,159 @@
+#version 430
+
+layout (local_size_x=64) in;
+
+// Static per-body data, uploaded once; see UploadOrbits
+struct Orbit
+{
+	vec4 elements;	// semi-major axis, semi-minor axis, eccentricity, mean motion
+	vec4 p;			// unit vector towards periapsis, mean anomaly at time 0
+	vec4 q;			// in-plane unit vector 90 degrees ahead of p, sphere size
+	ivec4 info;		// parent (-1 for roots), texture (-1 for sprite-only), show orbit,
+					// first slot of its texture's range of visible_bodies (-1 for none)
+	vec4 color;		// sprite color
+};
+
+layout (std430, binding=0) writeonly buffer BodyMatrices
+{
+	mat4 mv_matrices[];
+};
+layout (std430, binding=1) readonly buffer Orbits
+{
+	Orbit orbits[];
+};
+layout (std430, binding=2) writeonly buffer OrbitMatrices
+{
+	mat4 orbit_matrices[];
+};
+// Visible spheres, grouped by texture as the body order of vertShader_Body.glsl
+layout (std430, binding=3) writeonly buffer VisibleBodies
+{
+	int visible_bodies[];
+};
+// Sprite vertices in the layout of vertShader_Sprite.glsl: view-space
+// position, color, diameter in pixels
+layout (std430, binding=4) writeonly buffer SpriteValues
+{
+	float sprite_values[];
+};
+// One DrawElementsIndirectCommand per texture; the pass appends by counting
+// into them
+struct DrawCommand
+{
+	uint count;
+	uint instance_count;
+	uint first_index;
+	int base_vertex;
+	uint base_instance;
+};
+layout (std430, binding=12) buffer DrawCommands
+{
+	DrawCommand commands[];
+};
+// Diameter in pixels of each sphere in view, 0 for the rest, read back for
+// the texture requests
+layout (std430, binding=13) writeonly buffer RequestDiameters
+{
+	float request_diameters[];
+};
+
+uniform double time;
+uniform mat4 v_matrix;
+uniform int num_bodies;
+uniform float pixel_scale;
+uniform float sprite_threshold;
+uniform float ring_radius;
+uniform vec4 frustum_planes[6];	// view space, as FrustumPlanes builds them
+
+// The elements are the catalog's floats, as in Kepler::propagate; only the
+// phase n*t + M0 is formed and wrapped in double, so the anomaly does not
+// lose its precision to the size of t
+float wrapAngle(double x)
+{
+	const double two_pi = 6.283185307179586LF;
+	return float(x - two_pi * floor(x / two_pi + 0.5LF));
+}
+
+// Keplerian position relative to the parent, as Kepler::propagate computes it
+vec3 orbitPosition(int body)
+{
+	vec4 elements = orbits[body].elements;
+	vec4 p = orbits[body].p;
+	vec4 q = orbits[body].q;
+	float e = elements.z;
+	float M = wrapAngle(double(p.w) + double(elements.w) * time);
+
+	float E = M + (M < 0.0 ? -0.85 : 0.85) * e;
+	for (int k = 0; k < 4; k++)
+	{
+		float f = E - e * sin(E) - M;
+		float df = 1.0 - e * cos(E);
+		E -= f / (df - 0.5 * f * e * sin(E) / df);
+	}
+
+	float u = elements.x * (cos(E) - e);
+	float v = elements.y * sin(E);
+	return u * p.xyz + v * q.xyz;
+}
+
+void main(void)
+{
+	int body = int(gl_GlobalInvocationID.x);
+	if (body >= num_bodies)
+		return;
+
+	// Parents precede their children, and hierarchies are only a few levels
+	// deep, so each body walks its own chain instead of waiting on its parent
+	ivec4 info = orbits[body].info;
+	vec3 parentWorld = vec3(0.0);
+	for (int ancestor = info.x; ancestor >= 0; ancestor = orbits[ancestor].info.x)
+		parentWorld += orbitPosition(ancestor);
+	vec3 world = parentWorld + orbitPosition(body);
+
+	// Translation, spin about y and scale, as Transforms::modelView builds them
+	float angle = wrapAngle(time);
+	float size = orbits[body].q.w;
+	float s = sin(angle) * size, c = cos(angle) * size;
+	mat4 mv = v_matrix * mat4(c, 0.0, -s, 0.0,
+		0.0, size, 0.0, 0.0,
+		s, 0.0, c, 0.0,
+		world, 1.0);
+
+	// The ring mesh stretched onto the ellipse, as in DrawOrbits
+	if (info.z != 0)
+	{
+		vec4 elements = orbits[body].elements;
+		vec3 p = orbits[body].p.xyz, q = orbits[body].q.xyz;
+		mat4 ellipse = mat4(vec4(elements.y / ring_radius * q, 0.0),
+			vec4(elements.x / ring_radius * cross(p, q), 0.0),
+			vec4(elements.x / ring_radius * p, 0.0),
+			vec4(parentWorld - elements.x * elements.z * p, 1.0));
+		orbit_matrices[body] = v_matrix * ellipse;
+	}
+
+	// Every body is listed as a sprite vertex; a sphere gets one behind the
+	// camera, which is clipped. Spheres in view, tested against the frustum
+	// as CullBodies does, are appended to their texture's draw.
+	vec3 center = mv[3].xyz;
+	float diameter = size * pixel_scale / length(center);
+	bool sprite = info.y < 0 || diameter < sprite_threshold;
+	mv_matrices[body] = sprite ? mat4(0.0) : mv;
+	bool visible = true;
+	for (int p = 0; p < 6 && visible; p++)
+		visible = dot(frustum_planes[p].xyz, center) + frustum_planes[p].w >= -size;
+	request_diameters[body] = !sprite && visible ? diameter : 0.0;
+	if (!sprite && visible && info.w >= 0)
+	{
+		uint slot = atomicAdd(commands[info.y].instance_count, 1u);
+		visible_bodies[info.w + int(slot)] = body;
+	}
+	vec3 position = sprite ? center : vec3(0.0, 0.0, 1.0);
+	vec3 color = orbits[body].color.rgb;
+	sprite_values[7 * body + 0] = position.x;
+	sprite_values[7 * body + 1] = position.y;
+	sprite_values[7 * body + 2] = position.z;
+	sprite_values[7 * body + 3] = color.r;
+	sprite_values[7 * body + 4] = color.g;
+	sprite_values[7 * body + 5] = color.b;
+	sprite_values[7 * body + 6] = diameter;
+}
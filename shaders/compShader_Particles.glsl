@@ -0,0 +1,136 @@
+#version 430
+
+layout (local_size_x=256) in;
+
+struct Belt
+{
+	vec4 radii;		// inner radius, outer radius, max eccentricity, max inclination
+	vec4 sizes;		// min size, max size, gravitational parameter of the parent,
+					// 1 for logarithmically spaced radii
+	vec4 color;
+	mat4 plane;		// rotation of the belt plane
+};
+
+// Quantized orbit of each particle, see ParticleSystem::addBelt and
+// ParticleSystem::addPopulation
+layout (std430, binding=5) readonly buffer Particles
+{
+	uvec4 particles[];
+};
+layout (std430, binding=6) readonly buffer Belts
+{
+	Belt belts[];
+};
+// Two DrawArraysIndirectCommands, points then rocks; the pass appends by
+// counting into them
+layout (std430, binding=7) buffer Commands
+{
+	uint point_count, point_instances, point_first, point_base;
+	uint rock_count, rock_instances, rock_first, rock_base;
+};
+// View-space center as float bits, and the particle's last packed word
+layout (std430, binding=8) writeonly buffer Rocks
+{
+	uvec4 rocks[];
+};
+layout (std430, binding=9) writeonly buffer Points
+{
+	uvec4 points[];
+};
+
+uniform double time;
+uniform mat4 v_matrix;
+uniform mat4 proj_matrix;
+uniform vec3 belt_centers[8];	// parent positions, view space
+uniform int num_particles;
+uniform float pixel_scale;
+uniform float rock_threshold;
+
+const float two_pi = 6.28318530717959;
+
+// Appends are counted per workgroup first, so the global counters see one
+// atomic per group instead of one per particle
+shared uint groupRocks, groupPoints, rockStart, pointStart;
+
+void main(void)
+{
+	if (gl_LocalInvocationIndex == 0)
+	{
+		groupRocks = 0u;
+		groupPoints = 0u;
+	}
+	barrier();
+
+	int id = int(gl_GlobalInvocationID.x);
+	bool isRock = false, isPoint = false;
+	uint slot = 0u;
+	uvec4 visible = uvec4(0u);
+
+	if (id < num_particles)
+	{
+		uvec4 particle = particles[id];
+		vec2 radiusEccentricity = unpackUnorm2x16(particle.x);
+		vec2 nodePeriapsis = unpackUnorm2x16(particle.y) * two_pi;
+		vec2 anomalyInclination = unpackUnorm2x16(particle.z);
+		uint beltIndex = (particle.w >> 16) & 255u;
+		Belt belt = belts[beltIndex];
+
+		float a = belt.sizes.w > 0.5
+			? belt.radii.x * pow(belt.radii.y / belt.radii.x, radiusEccentricity.x)
+			: mix(belt.radii.x, belt.radii.y, radiusEccentricity.x);
+		float e = radiusEccentricity.y * belt.radii.z;
+		float inclination = (2.0 * anomalyInclination.y - 1.0) * belt.radii.w;
+
+		// Mean anomaly advanced and wrapped in double, as in Kepler::propagate
+		float meanMotion = sqrt(belt.sizes.z / (a * a * a));
+		double turns = double(anomalyInclination.x) + double(meanMotion) * time / 6.283185307179586LF;
+		float M = float(turns - floor(turns + 0.5LF)) * two_pi;
+
+		// Imported comets and scattered objects reach e = 0.99, so the solver
+		// of compShader_Orbits.glsl: Danby's start and Halley steps
+		float E = M + (M < 0.0 ? -0.85 : 0.85) * e;
+		for (int k = 0; k < 4; k++)
+		{
+			float f = E - e * sin(E) - M;
+			float df = 1.0 - e * cos(E);
+			E -= f / (df - 0.5 * f * e * sin(E) / df);
+		}
+		float u = a * (cos(E) - e);
+		float v = a * sqrt(1.0 - e * e) * sin(E);
+
+		// Perifocal basis as in OrbitalElements::add, in scene axes
+		float cn = cos(nodePeriapsis.x), sn = sin(nodePeriapsis.x);
+		float cp = cos(nodePeriapsis.y), sp = sin(nodePeriapsis.y);
+		float ci = cos(inclination), si = sin(inclination);
+		vec3 P = vec3(sn * cp + cn * sp * ci, sp * si, cn * cp - sn * sp * ci);
+		vec3 Q = vec3(-sn * sp + cn * cp * ci, cp * si, -cn * sp - sn * cp * ci);
+		vec3 offset = mat3(belt.plane) * (u * P + v * Q);
+		vec3 center = belt_centers[beltIndex] + mat3(v_matrix) * offset;
+
+		// Inside the frustum, with a little margin for a rock's own size;
+		// then rocks or points by projected size
+		vec4 clip = proj_matrix * vec4(center, 1.0);
+		if (clip.w > 0.0 && all(lessThanEqual(abs(clip.xyz), vec3(1.02 * clip.w))))
+		{
+			float size = mix(belt.sizes.x, belt.sizes.y, float(particle.w & 255u) / 255.0);
+			float diameter = size * pixel_scale / length(center);
+			isRock = diameter >= rock_threshold;
+			isPoint = !isRock;
+			slot = isRock ? atomicAdd(groupRocks, 1u) : atomicAdd(groupPoints, 1u);
+			visible = uvec4(floatBitsToUint(center), particle.w);
+		}
+	}
+	barrier();
+
+	if (gl_LocalInvocationIndex == 0)
+	{
+		rockStart = atomicAdd(rock_instances, groupRocks);
+		pointStart = atomicAdd(point_count, groupPoints);
+	}
+	barrier();
+
+	if (isRock)
+		rocks[rockStart + slot] = visible;
+	if (isPoint)
+		points[pointStart + slot] = visible;
+}
@@ -1,14 +1,88 @@
 #version 430
 
-in vec2 tc;
+// Only fragments that pass the depth test ask for virtual texture tiles
+layout (early_fragment_tests) in;
+
+in vec3 direction;
 
 out vec4 color;
 
 uniform mat4 mv_matrix;
 uniform mat4 proj_matrix;
-layout (binding=0) uniform sampler2D samp;
+layout (binding=0) uniform samplerCube samp;   // the planet map, by direction
+
+// Virtual textures (see VirtualTexture.h): the page table gives the cache
+// slot of each tile, or of its nearest resident ancestor, as column, row
+// and the level of the tile found
+uniform int virtual_texture;
+layout (binding=1) uniform usampler2D vt_page_table;
+layout (binding=2) uniform sampler2D vt_cache;
+uniform ivec2 vt_tiles;      // across level 0
+uniform int vt_levels;
+uniform int vt_cache_tiles;  // slots across the cache
+uniform int vt_frame;
+// One bit per tile, set for the tiles the view wants
+layout (std430, binding=10) buffer VtFeedback
+{
+    uint vt_requested[];
+};
+
+const float vt_tile_size = 128.0;
+const float vt_border = 4.0;
+const float pi = 3.14159265;
+
+// uv is equirectangular; u may run outside [0, 1], where it wraps around
+vec4 sampleVirtual(vec2 uv)
+{
+    // Level from the footprint in level 0 texels
+    vec2 texel = uv * vec2(vt_tiles) * vt_tile_size;
+    vec2 dx = dFdx(texel), dy = dFdy(texel);
+    float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy)));
+    uv.x = fract(uv.x);
+    int level = clamp(int(floor(lod)), 0, vt_levels - 1);
+    ivec2 tiles = max(vt_tiles >> level, ivec2(1));
+    ivec2 tile = min(ivec2(uv * vec2(tiles)), tiles - 1);
+
+    // A sixteenth of the pixels report each frame, a different one each time
+    ivec2 pixel = ivec2(gl_FragCoord.xy) & 3;
+    if(pixel.x + 4 * pixel.y == (vt_frame & 15))
+    {
+        int index = tile.y * tiles.x + tile.x;
+        for(int l = 0; l < level; l++)
+        {
+            ivec2 levelTiles = max(vt_tiles >> l, ivec2(1));
+            index += levelTiles.x * levelTiles.y;
+        }
+        uint bit = 1u << (index & 31);
+        if((vt_requested[index >> 5] & bit) == 0u)
+        {
+            atomicOr(vt_requested[index >> 5], bit);
+        }
+    }
+
+    uvec4 entry = texelFetch(vt_page_table, tile, level);
+    ivec2 residentTiles = max(vt_tiles >> int(entry.b), ivec2(1));
+    vec2 scaled = uv * vec2(residentTiles);
+    vec2 within = scaled - vec2(min(ivec2(scaled), residentTiles - 1));
+    float slotTexels = vt_tile_size + 2.0 * vt_border;
+    vec2 cacheTexel = vec2(entry.rg) * slotTexels + vt_border + within * vt_tile_size;
+    return textureLod(vt_cache, cacheTexel / (float(vt_cache_tiles) * slotTexels), 0.0);
+}
 
 void main(void)
 {
-    color = texture(samp, tc);
+    if(virtual_texture != 0)
+    {
+        // Tiles stay equirectangular: u from -x towards +z, v from the
+        // south pole. Of two u ranges take the one continuous around the
+        // pixel, so the seam does not drop to the coarsest level.
+        vec3 d = normalize(direction);
+        float u = atan(d.z, -d.x) / (2.0 * pi);
+        float u0 = fract(u), u1 = fract(u + 0.5) - 0.5;
+        color = sampleVirtual(vec2(fwidth(u0) <= fwidth(u1) ? u0 : u1, acos(-d.y) / pi));
+    }
+    else
+    {
+        color = texture(samp, direction);
+    }
 };
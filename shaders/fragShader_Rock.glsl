@@ -0,0 +1,10 @@
+#version 430
+
+in vec3 rockColor;
+
+out vec4 color;
+
+void main(void)
+{
+	color = vec4(rockColor, 1.0);
+}
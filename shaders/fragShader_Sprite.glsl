@@ -0,0 +1,14 @@
+#version 430
+
+in vec4 spriteColor;
+
+out vec4 color;
+
+void main(void)
+{
+	// Round the square point into a disc
+	float r = length(gl_PointCoord - vec2(0.5));
+	if (r > 0.5)
+		discard;
+	color = spriteColor;
+}
@@ -0,0 +1,22 @@
+#version 430
+
+in vec3 direction;
+in vec3 viewNormal;
+in vec3 viewUp;
+in vec3 viewPosition;
+
+out vec4 color;
+
+uniform vec3 light_position;     // the sun, in view space
+layout (binding=0) uniform samplerCube samp;   // the planet map, by direction
+
+const float relief = 1.5;         // strength of the slope shading
+
+void main(void)
+{
+	// The spheres are unlit, so only the slopes are: facing the sun more
+	// than the sphere below brightens, less darkens
+	vec3 toLight = normalize(light_position - viewPosition);
+	float shade = 1.0 + relief * (dot(normalize(viewNormal), toLight) - dot(normalize(viewUp), toLight));
+	color = vec4(texture(samp, direction).rgb * clamp(shade, 0.3, 1.5), 1.0);
+}
@@ -9,8 +9,17 @@ uniform mat4 mv_matrix;
 uniform mat4 proj_matrix;
 layout (binding=0) uniform sampler2D samp;
 
+// Orbit rings built by compShader_Orbits.glsl; a negative body_index uses
+// mv_matrix instead
+layout (std430, binding=2) readonly buffer OrbitMatrices
+{
+	mat4 orbit_matrices[];
+};
+uniform int body_index;
+
 void main(void)
 {	
-	gl_Position = proj_matrix * mv_matrix * vec4(position, 1.0);
+	mat4 mv = body_index < 0 ? mv_matrix : orbit_matrices[body_index];
+	gl_Position = proj_matrix * mv * vec4(position, 1.0);
 	tc = texCoord;
 }
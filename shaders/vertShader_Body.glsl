@@ -0,0 +1,31 @@
+#version 430
+
+layout (location=0) in vec3 position;
+
+// The unit sphere's position, by which the planet maps are sampled
+out vec3 direction;
+
+// Model-view matrices of every body, written each frame by the batched
+// transform pass or by compShader_Orbits.glsl
+layout (std430, binding=0) readonly buffer BodyMatrices
+{
+	mat4 mv_matrices[];
+};
+// Bodies grouped by texture, for instanced draws; with GPU animation only
+// the visible ones, as compShader_Orbits.glsl appends them
+layout (std430, binding=3) readonly buffer BodyOrder
+{
+	int body_order[];
+};
+// Instanced draws start at instance_offset in body_order; a negative offset
+// draws body_index alone
+uniform int instance_offset;
+uniform int body_index;
+uniform mat4 proj_matrix;
+
+void main(void)
+{	
+	int body = instance_offset < 0 ? body_index : body_order[instance_offset + gl_InstanceID];
+	gl_Position = proj_matrix * mv_matrices[body] * vec4(position, 1.0);
+	direction = position;
+}
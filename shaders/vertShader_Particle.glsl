@@ -0,0 +1,42 @@
+#version 430
+
+out vec4 spriteColor;
+
+struct Belt
+{
+	vec4 radii;
+	vec4 sizes;		// min size, max size, gravitational parameter of the parent
+	vec4 color;
+	mat4 plane;
+};
+
+layout (std430, binding=6) readonly buffer Belts
+{
+	Belt belts[];
+};
+// Written by compShader_Particles.glsl, one per vertex
+layout (std430, binding=9) readonly buffer Points
+{
+	uvec4 points[];
+};
+
+uniform mat4 proj_matrix;
+uniform float pixel_scale;
+
+void main(void)
+{
+	uvec4 point = points[gl_VertexID];
+	vec3 center = uintBitsToFloat(point.xyz);
+	Belt belt = belts[(point.w >> 16) & 255u];
+	float size = mix(belt.sizes.x, belt.sizes.y, float(point.w & 255u) / 255.0);
+	float shade = float((point.w >> 8) & 255u) / 255.0;
+	float diameter = size * pixel_scale / length(center);
+
+	gl_Position = proj_matrix * vec4(center, 1.0);
+	gl_PointSize = max(diameter, 1.0);
+
+	// As for body sprites, a particle smaller than a pixel fades with the
+	// fraction of it that it covers
+	float coverage = (diameter * diameter) / (gl_PointSize * gl_PointSize);
+	spriteColor = vec4(belt.color.rgb * shade, coverage);
+}
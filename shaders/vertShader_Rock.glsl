@@ -0,0 +1,54 @@
+#version 430
+
+layout (location=0) in vec3 position;
+layout (location=1) in vec3 normal;
+
+out vec3 rockColor;
+
+struct Belt
+{
+	vec4 radii;
+	vec4 sizes;		// min size, max size, gravitational parameter of the parent
+	vec4 color;
+	mat4 plane;
+};
+
+layout (std430, binding=6) readonly buffer Belts
+{
+	Belt belts[];
+};
+// Written by compShader_Particles.glsl, one per instance
+layout (std430, binding=8) readonly buffer Rocks
+{
+	uvec4 rocks[];
+};
+
+uniform mat4 v_matrix;
+uniform mat4 proj_matrix;
+uniform float spin;				// wrapped time
+uniform vec3 light_position;	// the sun, view space
+
+void main(void)
+{
+	uvec4 rock = rocks[gl_InstanceID];
+	vec3 center = uintBitsToFloat(rock.xyz);
+	Belt belt = belts[(rock.w >> 16) & 255u];
+	float size = mix(belt.sizes.x, belt.sizes.y, float(rock.w & 255u) / 255.0);
+	float shade = float((rock.w >> 8) & 255u) / 255.0;
+	uint variant = rock.w >> 24;
+
+	// Each variant is stretched differently and tumbles about its own axis
+	vec3 stretch = vec3(0.6) + 0.4 * vec3(variant & 3u, (variant >> 2) & 3u, (variant >> 4) & 3u) / 3.0;
+	vec3 axis = normalize(vec3(float(variant & 7u) - 3.5, 1.0, float(variant >> 5) - 3.5));
+	float angle = spin * float(1u + (variant & 3u));
+	mat3 K = mat3(0.0, axis.z, -axis.y, -axis.z, 0.0, axis.x, axis.y, -axis.x, 0.0);
+	mat3 tumble = mat3(1.0) + sin(angle) * K + (1.0 - cos(angle)) * K * K;
+	mat3 toView = mat3(v_matrix) * tumble;
+
+	vec3 viewPosition = center + toView * (position * stretch * size);
+	vec3 viewNormal = normalize(toView * (normal / stretch));
+	gl_Position = proj_matrix * vec4(viewPosition, 1.0);
+
+	float light = max(dot(viewNormal, normalize(light_position - viewPosition)), 0.0);
+	rockColor = belt.color.rgb * shade * (0.15 + 0.85 * light);
+}
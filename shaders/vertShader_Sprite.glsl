@@ -0,0 +1,20 @@
+#version 430
+
+layout (location=0) in vec3 position; // view space
+layout (location=1) in vec3 color;
+layout (location=2) in float diameter; // projected diameter in pixels
+
+out vec4 spriteColor;
+
+uniform mat4 proj_matrix;
+
+void main(void)
+{
+	gl_Position = proj_matrix * vec4(position, 1.0);
+	gl_PointSize = max(diameter, 1.0);
+
+	// A body smaller than a pixel still covers one; scale its alpha by the
+	// covered fraction so the light it contributes stays the same.
+	float coverage = (diameter * diameter) / (gl_PointSize * gl_PointSize);
+	spriteColor = vec4(color, coverage);
+}
@@ -0,0 +1,78 @@
+#version 430
+
+// Vertex of the chunk grid shared by every terrain chunk, 0 to grid_size,
+// and 1 for the skirt under its edges
+layout (location=0) in vec3 grid;
+
+out vec3 direction;       // from the body's center, for the texture lookup
+out vec3 viewNormal;
+out vec3 viewUp;          // of the sphere under the vertex
+out vec3 viewPosition;
+
+// One instance per selected chunk, written by PlanetTerrain each frame
+struct Chunk
+{
+	ivec4 node;           // cube face, level, x, y
+	vec4 morph;           // distances where the morph starts and ends, height layer
+};
+layout (std430, binding=11) readonly buffer Chunks
+{
+	Chunk chunks[];
+};
+uniform mat4 mv_matrix;
+uniform mat4 proj_matrix;
+uniform vec3 camera_local;    // camera in the body's unit-sphere frame
+uniform float height_scale;
+uniform int grid_size;
+// Heights of every cached chunk, with a ring of one around for the normals
+layout (binding=3) uniform sampler2DArray heights;
+
+// Center, then the directions of a chunk's x and y, as in PlanetTerrain.cpp
+const vec3 faces[18] = vec3[](
+	vec3(1, 0, 0), vec3(0, 0, -1), vec3(0, 1, 0),
+	vec3(-1, 0, 0), vec3(0, 0, 1), vec3(0, 1, 0),
+	vec3(0, 1, 0), vec3(1, 0, 0), vec3(0, 0, -1),
+	vec3(0, -1, 0), vec3(1, 0, 0), vec3(0, 0, 1),
+	vec3(0, 0, 1), vec3(1, 0, 0), vec3(0, 1, 0),
+	vec3(0, 0, -1), vec3(-1, 0, 0), vec3(0, 1, 0)
+);
+
+vec3 facePoint(ivec4 node, vec2 g)
+{
+	vec2 cube = -1.0 + (vec2(node.zw) + g / float(grid_size)) * (2.0 / float(1 << node.y));
+	return normalize(faces[3 * node.x] + cube.x * faces[3 * node.x + 1] + cube.y * faces[3 * node.x + 2]);
+}
+
+// Filtered between grid points, for morphing vertices
+vec3 surfacePoint(ivec4 node, vec2 g, float layer)
+{
+	vec2 texel = (g + 1.5) / float(grid_size + 3);
+	return facePoint(node, g) * (1.0 + height_scale * texture(heights, vec3(texel, layer)).r);
+}
+
+void main(void)
+{
+	Chunk chunk = chunks[gl_InstanceID];
+	float layer = chunk.morph.z;
+
+	// CDLOD morph: towards the end of the chunk's range its odd vertices
+	// slide onto their even neighbors, leaving the parent's grid
+	vec3 unmorphed = surfacePoint(chunk.node, grid.xy, layer);
+	float k = clamp((distance(camera_local, unmorphed) - chunk.morph.x) / (chunk.morph.y - chunk.morph.x), 0.0, 1.0);
+	vec2 g = grid.xy - fract(grid.xy * 0.5) * 2.0 * k;
+	vec3 position = surfacePoint(chunk.node, g, layer);
+
+	// Skirts drop by the relief's whole range, or the chunk's size when
+	// smaller, which is deeper than any gap to a neighbor can be
+	position *= 1.0 - grid.z * min(height_scale, 2.0 / float(1 << chunk.node.y));
+
+	vec3 tangentX = surfacePoint(chunk.node, grid.xy + vec2(1, 0), layer) - surfacePoint(chunk.node, grid.xy - vec2(1, 0), layer);
+	vec3 tangentY = surfacePoint(chunk.node, grid.xy + vec2(0, 1), layer) - surfacePoint(chunk.node, grid.xy - vec2(0, 1), layer);
+
+	vec4 view = mv_matrix * vec4(position, 1.0);
+	gl_Position = proj_matrix * view;
+	direction = position;
+	viewNormal = mat3(mv_matrix) * normalize(cross(tangentX, tangentY));
+	viewUp = mat3(mv_matrix) * normalize(position);
+	viewPosition = view.xyz;
+}
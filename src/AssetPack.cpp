@@ -0,0 +1,215 @@
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/AssetPack.h"
+
+using namespace std;
+
+static const char packMagic[4] = { 'S', 'S', 'P', '1' };
+
+AssetPack::AssetPack() : mapping(nullptr), mappingSize(0), entries(nullptr), names(nullptr), numEntries(0) {}
+
+AssetPack::~AssetPack()
+{
+    close();
+}
+
+string AssetPack::normalize(const string& path)
+{
+    string name;
+    size_t i = 0;
+    while(path.compare(i, 2, "./") == 0)
+    {
+        i += 2;
+    }
+    for(; i < path.size(); i++)
+    {
+        if(path[i] == '/' && (name.empty() || name.back() == '/'))
+        {
+            continue;
+        }
+        if(path.compare(i, 3, "/./") == 0)
+        {
+            i++;
+            continue;
+        }
+        name += path[i];
+    }
+    return name;
+}
+
+bool AssetPack::open(const char *filePath)
+{
+    close();
+
+    int file = ::open(filePath, O_RDONLY);
+    if(file < 0)
+    {
+        return false;
+    }
+    struct stat info;
+    if(fstat(file, &info) != 0 || (size_t)info.st_size < sizeof(AssetPackHeader))
+    {
+        cout << filePath << ": not an asset pack" << endl;
+        ::close(file);
+        return false;
+    }
+    void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    ::close(file);
+    if(data == MAP_FAILED)
+    {
+        cout << "Failed to map asset pack: " << filePath << endl;
+        return false;
+    }
+    mapping = (const unsigned char*)data;
+    mappingSize = info.st_size;
+
+    // Checked once here, so lookups can trust the table
+    AssetPackHeader header;
+    memcpy(&header, mapping, sizeof(header));
+    size_t tableEnd = sizeof(header) + (size_t)header.numEntries * sizeof(AssetPackEntry);
+    bool valid = memcmp(header.magic, packMagic, sizeof(packMagic)) == 0 && tableEnd <= mappingSize
+        && header.namesOffset >= tableEnd && header.namesOffset + header.namesSize <= mappingSize;
+    entries = (const AssetPackEntry*)(mapping + sizeof(header));
+    names = (const char*)mapping + header.namesOffset;
+    for(uint32_t i = 0; valid && i < header.numEntries; i++)
+    {
+        const AssetPackEntry& entry = entries[i];
+        valid = entry.offset % alignment == 0 && entry.offset <= mappingSize && entry.size <= mappingSize - entry.offset
+            && (uint64_t)entry.nameOffset + entry.nameLength <= header.namesSize;
+    }
+    if(!valid)
+    {
+        cout << filePath << ": corrupt asset pack" << endl;
+        close();
+        return false;
+    }
+    numEntries = header.numEntries;
+    return true;
+}
+
+void AssetPack::close()
+{
+    if(mapping)
+    {
+        munmap((void*)mapping, mappingSize);
+    }
+    mapping = nullptr;
+    mappingSize = 0;
+    entries = nullptr;
+    names = nullptr;
+    numEntries = 0;
+}
+
+bool AssetPack::isOpen() const {return mapping != nullptr;}
+int AssetPack::size() const {return numEntries;}
+
+string AssetPack::entryName(int entry) const
+{
+    return string(names + entries[entry].nameOffset, entries[entry].nameLength);
+}
+
+bool AssetPack::find(const string& path, AssetEntry& entry) const
+{
+    string name = normalize(path);
+    int low = 0, high = numEntries;
+    while(low < high)
+    {
+        int middle = (low + high) / 2;
+        if(entryName(middle) < name)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    if(low == numEntries || entryName(low) != name)
+    {
+        return false;
+    }
+    entry.data = mapping + entries[low].offset;
+    entry.size = entries[low].size;
+    return true;
+}
+
+// Entries start on pages; the end is rounded down to the system's page size
+// should it be larger than the alignment
+void AssetPack::prefetch(const AssetEntry& entry)
+{
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)entry.data / pageSize * pageSize;
+    madvise((void*)start, (uintptr_t)entry.data + entry.size - start, MADV_WILLNEED);
+}
+
+bool AssetPack::write(const char *filePath, const vector<string>& paths)
+{
+    vector<pair<string, string>> files;     // name, path
+    for(const string& path : paths)
+    {
+        files.push_back(make_pair(normalize(path), path));
+    }
+    sort(files.begin(), files.end());
+    files.erase(unique(files.begin(), files.end(), [](const pair<string, string>& a, const pair<string, string>& b) {
+        return a.first == b.first;
+    }), files.end());
+
+    AssetPackHeader header = AssetPackHeader();
+    memcpy(header.magic, packMagic, sizeof(packMagic));
+    header.numEntries = (uint32_t)files.size();
+    header.namesOffset = sizeof(header) + files.size() * sizeof(AssetPackEntry);
+
+    vector<AssetPackEntry> table(files.size());
+    string nameTable;
+    for(size_t i = 0; i < files.size(); i++)
+    {
+        struct stat info;
+        if(stat(files[i].second.c_str(), &info) != 0)
+        {
+            cout << "Failed to open " << files[i].second << endl;
+            return false;
+        }
+        table[i].size = info.st_size;
+        table[i].nameOffset = (uint32_t)nameTable.size();
+        table[i].nameLength = (uint32_t)files[i].first.size();
+        nameTable += files[i].first;
+    }
+    header.namesSize = nameTable.size();
+    uint64_t offset = header.namesOffset + header.namesSize;
+    for(AssetPackEntry& entry : table)
+    {
+        offset = (offset + alignment - 1) / alignment * alignment;
+        entry.offset = offset;
+        offset += entry.size;
+    }
+
+    ofstream out(filePath, ios::binary);
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)table.data(), table.size() * sizeof(AssetPackEntry));
+    out.write(nameTable.data(), nameTable.size());
+    vector<char> contents;
+    for(size_t i = 0; i < files.size(); i++)
+    {
+        contents.resize(table[i].size);
+        ifstream in(files[i].second, ios::binary);
+        if(!in.read(contents.data(), contents.size()))
+        {
+            cout << "Failed to read " << files[i].second << endl;
+            return false;
+        }
+        out.seekp(table[i].offset);
+        out.write(contents.data(), contents.size());
+    }
+    if(!out)
+    {
+        cout << "Failed to write asset pack: " << filePath << endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,532 @@
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <cmath>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <algorithm>
+#include "../include/Benchmarks.h"
+#include "../include/BodyCatalog.h"
+#include "../include/Kepler.h"
+#include "../include/NBody.h"
+#include "../include/Ephemeris.h"
+#include "../include/Transforms.h"
+#include "../include/MinorPlanets.h"
+#include "../include/JobSystem.h"
+#include <glm/gtc/matrix_transform.hpp>
+
+using namespace std;
+
+static double elapsedMs(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+bool Benchmarks::run(const string& name)
+{
+    if(name == "catalog")
+    {
+        catalog();
+        return true;
+    }
+    if(name == "kepler")
+    {
+        kepler();
+        return true;
+    }
+    if(name == "nbody")
+    {
+        nbody();
+        return true;
+    }
+    if(name == "direct")
+    {
+        direct();
+        return true;
+    }
+    if(name == "blocksteps")
+    {
+        blockSteps();
+        return true;
+    }
+    if(name == "ephemeris")
+    {
+        ephemeris();
+        return true;
+    }
+    if(name == "transforms")
+    {
+        transforms();
+        return true;
+    }
+    if(name == "minorplanets")
+    {
+        minorPlanets();
+        return true;
+    }
+
+    cout << "Unknown benchmark: " << name << endl;
+    cout << "Available: catalog, kepler, nbody, direct, blocksteps, ephemeris, transforms, minorplanets" << endl;
+    return false;
+}
+
+// A sun, planets around it and moons around the planets, in the CSV format
+// BodyCatalog::loadCSV reads.
+void Benchmarks::writeSyntheticCatalog(const char *filePath, int numBodies)
+{
+    ofstream out(filePath);
+    out << "name,parent,size,distance,speed,texture,orbit\n";
+    out << "sun,,100,0,1,,0\n";
+
+    int numPlanets = numBodies < 10 ? numBodies - 1 : numBodies / 10;
+    for(int i = 0; i < numPlanets; i++)
+    {
+        out << "p" << i << ",sun,5," << 200 + 10 * i << "," << 1.0f / (1 + i) << ",,0\n";
+    }
+    for(int i = 0; i < numBodies - 1 - numPlanets; i++)
+    {
+        out << "m" << i << ",p" << i % numPlanets << ",1," << 10 + i % 20 << ",2,,0\n";
+    }
+}
+
+void Benchmarks::catalog()
+{
+    const char *filePath = "./bench_catalog.csv";
+    const int sizes[] = { 10, 1000, 100000 };
+    const int numFrames = 100;
+
+    for(int numBodies : sizes)
+    {
+        writeSyntheticCatalog(filePath, numBodies);
+
+        BodyCatalog bodies;
+
+        auto start = chrono::steady_clock::now();
+        bodies.loadCSV(filePath);
+        double loadMs = elapsedMs(start);
+
+        int count = bodies.getNumBodies();
+        vector<float> x(count), y(count), z(count);
+        start = chrono::steady_clock::now();
+        for(int frame = 0; frame < numFrames; frame++)
+        {
+            Kepler::propagate(bodies.orbits, frame / 60.0, &bodies.positionsX[0], &bodies.positionsY[0], &bodies.positionsZ[0]);
+            bodies.resolveWorldPositions(&x[0], &y[0], &z[0]);
+        }
+        double updateMs = elapsedMs(start) / numFrames;
+
+        cout << "catalog " << bodies.getNumBodies() << " bodies: load " << loadMs
+            << " ms, update " << updateMs << " ms/frame" << endl;
+    }
+
+    remove(filePath);
+}
+
+// Batch Kepler solver against the scalar double-precision reference, and the
+// full element-to-position propagation, for a million bodies on one core.
+void Benchmarks::kepler()
+{
+    const int numBodies = 1000000;
+    const int numRuns = 10;
+
+    vector<float> meanAnomalies(numBodies), eccentricities(numBodies), eccentricAnomalies(numBodies);
+    OrbitalElements orbits;
+    srand(1);
+    for(int i = 0; i < numBodies; i++)
+    {
+        meanAnomalies[i] = (rand() / (float)RAND_MAX) * 6.2831853f - 3.1415927f;
+        eccentricities[i] = (rand() / (float)RAND_MAX) * 0.99f;
+        orbits.add(100.0f + i % 1000, eccentricities[i], rand() / (float)RAND_MAX, rand() / (float)RAND_MAX * 6.28f,
+            rand() / (float)RAND_MAX * 6.28f, 0.1f + (i % 100) * 0.01f, meanAnomalies[i]);
+    }
+    vector<float> x(numBodies), y(numBodies), z(numBodies);
+
+    auto start = chrono::steady_clock::now();
+    for(int run = 0; run < numRuns; run++)
+    {
+        Kepler::solve(&meanAnomalies[0], &eccentricities[0], &eccentricAnomalies[0], numBodies);
+    }
+    double batchMs = elapsedMs(start) / numRuns;
+
+    double maxError = 0.0;
+    start = chrono::steady_clock::now();
+    for(int i = 0; i < numBodies; i++)
+    {
+        double reference = Kepler::solveReference(meanAnomalies[i], eccentricities[i]);
+        maxError = fmax(maxError, fabs(reference - eccentricAnomalies[i]));
+    }
+    double scalarMs = elapsedMs(start);
+
+    start = chrono::steady_clock::now();
+    for(int run = 0; run < numRuns; run++)
+    {
+        Kepler::propagate(orbits, run * 1000.0, &x[0], &y[0], &z[0]);
+    }
+    double propagateMs = elapsedMs(start) / numRuns;
+
+    cout << "kepler " << numBodies << " bodies, e in [0, 0.99)" << endl;
+    cout << "  batch solve:      " << batchMs << " ms (" << numBodies / batchMs / 1000.0 << " M/s)" << endl;
+    cout << "  scalar reference: " << scalarMs << " ms (" << numBodies / scalarMs / 1000.0 << " M/s)" << endl;
+    cout << "  max |E - E_ref|:  " << maxError << " rad" << endl;
+    cout << "  propagate:        " << propagateMs << " ms/frame" << endl;
+}
+
+// A one-solar-mass star with a thin disk of light bodies on circular orbits
+void Benchmarks::makeDisk(NBody& system, int numBodies)
+{
+    system.clear();
+    system.addBody(0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0);
+
+    srand(1);
+    for(int i = 1; i < numBodies; i++)
+    {
+        double r = 200.0 + 2000.0 * (rand() / (double)RAND_MAX);
+        double angle = 6.283185307 * (rand() / (double)RAND_MAX);
+        double height = 20.0 * (rand() / (double)RAND_MAX - 0.5);
+        double speed = sqrt(system.gravitationalConstant / r);
+        system.addBody(r * sin(angle), height, r * cos(angle), speed * cos(angle), 0.0, -speed * sin(angle), 1e-9);
+    }
+    system.start();
+}
+
+// Barnes-Hut leapfrog steps; every step reports its timings, interaction
+// count and relative energy drift.
+void Benchmarks::nbody()
+{
+    const int sizes[] = { 10000, 100000, 1000000 };
+    const int numSteps[] = { 10, 5, 3 };
+
+    JobSystem jobs;
+    cout << "nbody, " << jobs.getNumWorkers() + 1 << " threads" << endl;
+    for(int s = 0; s < 3; s++)
+    {
+        NBody system(jobs);
+        makeDisk(system, sizes[s]);
+        for(int step = 0; step < numSteps[s]; step++)
+        {
+            system.step(0.01);
+            const NBodyStats& stats = system.stats;
+            cout << "  " << stats.numBodies << " bodies, step " << step << ": " << stats.stepMs << " ms (tree "
+                << stats.buildMs << ", forces " << stats.forceMs << "), " << stats.interactions / stats.numBodies
+                << " interactions/body, " << stats.interactions / stats.forceMs / 1e3 << " M interactions/s, drift "
+                << stats.energyDrift << endl;
+        }
+    }
+}
+
+// Direct-summation interactions per second across thread counts, and the
+// Barnes-Hut force error measured against it.
+void Benchmarks::direct()
+{
+    const int sizes[] = { 1000, 10000, 50000 };
+    int maxThreads = max(1, (int)thread::hardware_concurrency());
+
+    // 1, 2, 4, ... and the full machine
+    vector<int> threadCounts;
+    for(int threads = 1; threads < maxThreads; threads *= 2) threadCounts.push_back(threads);
+    threadCounts.push_back(maxThreads);
+
+    for(int numBodies : sizes)
+    {
+        // A pool of each size, the calling thread being one of the threads;
+        // the last one, the full machine, stays for the comparison
+        unique_ptr<JobSystem> jobs;
+        unique_ptr<NBody> disk;
+        for(int threads : threadCounts)
+        {
+            disk.reset();
+            jobs.reset(new JobSystem(threads - 1));
+            disk.reset(new NBody(*jobs));
+            disk->forceBackend = DIRECT;
+            makeDisk(*disk, numBodies);
+            disk->step(0.01);
+            const NBodyStats& stats = disk->stats;
+            cout << "direct " << numBodies << " bodies, " << threads << " threads: " << stats.forceMs << " ms, "
+                << stats.interactions / stats.forceMs / 1e6 << " G interactions/s" << endl;
+        }
+        NBody& system = *disk;
+
+        // Same state through the tree, compared body by body
+        vector<double> exactX(system.accelerationsX), exactY(system.accelerationsY), exactZ(system.accelerationsZ);
+        system.forceBackend = BARNES_HUT;
+        system.start();
+        double maxError = 0.0, sumError = 0.0;
+        for(int i = 0; i < numBodies; i++)
+        {
+            double dx = system.accelerationsX[i] - exactX[i];
+            double dy = system.accelerationsY[i] - exactY[i];
+            double dz = system.accelerationsZ[i] - exactZ[i];
+            double error = sqrt(dx * dx + dy * dy + dz * dz) / sqrt(exactX[i] * exactX[i] + exactY[i] * exactY[i] + exactZ[i] * exactZ[i]);
+            maxError = fmax(maxError, error);
+            sumError += error;
+        }
+        cout << "  Barnes-Hut (theta " << system.openingAngle << ") relative force error: mean " << sumError / numBodies
+            << ", max " << maxError << endl;
+    }
+}
+
+// Orbits from 50 to 10000 units, a 3000x range of periods, integrated over
+// the same time with block timesteps and with the single global step the
+// innermost orbit needs. Reports the work and the energy error of each.
+void Benchmarks::blockSteps()
+{
+    const int numBodies = 1000;
+    const double baseDt = 0.5;
+    const double duration = 5.0;
+
+    JobSystem jobs;
+    NBody block(jobs);
+    block.forceBackend = DIRECT;
+    block.blockTimesteps = true;
+    block.addBody(0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0);
+    srand(1);
+    for(int i = 1; i < numBodies; i++)
+    {
+        double r = 50.0 * pow(200.0, rand() / (double)RAND_MAX);
+        double angle = 6.283185307 * (rand() / (double)RAND_MAX);
+        double speed = sqrt(block.gravitationalConstant / r);
+        block.addBody(r * sin(angle), 0.0, r * cos(angle), speed * cos(angle), 0.0, -speed * sin(angle), 1e-9);
+    }
+    NBody global(jobs);
+    global.forceBackend = DIRECT;
+    for(int i = 0; i < numBodies; i++)
+    {
+        global.addBody(block.positionsX[i], block.positionsY[i], block.positionsZ[i],
+            block.velocitiesX[i], block.velocitiesY[i], block.velocitiesZ[i], block.masses[i]);
+    }
+    block.start();
+    global.start();
+
+    double blockMs = 0.0, blockEvaluations = 0.0;
+    int deepestLevel = 0;
+    for(double t = 0.0; t < duration; t += baseDt)
+    {
+        block.step(baseDt);
+        blockMs += block.stats.stepMs;
+        blockEvaluations += block.stats.forceEvaluations;
+        deepestLevel = max(deepestLevel, block.stats.deepestLevel);
+    }
+
+    vector<int> levelCounts(block.maxLevel + 1, 0);
+    for(int level : block.levels) levelCounts[level]++;
+
+    int numSteps = (int)(duration / baseDt) << deepestLevel;
+    double globalMs = 0.0;
+    for(int step = 0; step < numSteps; step++)
+    {
+        global.step(baseDt / (1 << deepestLevel));
+        globalMs += global.stats.stepMs;
+    }
+    double globalEvaluations = (double)numSteps * numBodies;
+
+    cout << "blocksteps " << numBodies << " bodies, base step " << baseDt << ", eta " << block.timestepAccuracy << endl;
+    cout << "  levels:";
+    for(int level = 0; level <= deepestLevel; level++) cout << " " << levelCounts[level];
+    cout << endl;
+    cout << "  block:  " << blockEvaluations << " force evaluations, " << blockMs << " ms, drift " << block.stats.energyDrift << endl;
+    cout << "  global: " << globalEvaluations << " force evaluations (step " << baseDt / (1 << deepestLevel) << "), "
+        << globalMs << " ms, drift " << global.stats.energyDrift << endl;
+    cout << "  work ratio: " << globalEvaluations / blockEvaluations << "x" << endl;
+}
+
+// Ephemeris queries per second for all bodies at one time and for one body
+// at many times, against Kepler propagation, and the fit error against the
+// double-precision two-body solution.
+void Benchmarks::ephemeris()
+{
+    const char *filePath = "./bench_ephemeris.bin";
+    const double span = 3600.0;
+    const int numQueries = 1000000;
+
+    BodyCatalog bodies;
+    if(!bodies.loadCSV("./data/bodies.csv"))
+    {
+        return;
+    }
+    int numBodies = bodies.getNumBodies();
+
+    auto start = chrono::steady_clock::now();
+    Ephemeris::fit(filePath, bodies, 0.0, span);
+    double fitMs = elapsedMs(start);
+
+    Ephemeris table;
+    start = chrono::steady_clock::now();
+    if(!table.load(filePath))
+    {
+        return;
+    }
+    double loadMs = elapsedMs(start);
+
+    // Random times, as a scrubbing timeline would ask for them
+    vector<double> times(numQueries);
+    srand(1);
+    for(int q = 0; q < numQueries; q++) times[q] = span * (rand() / (RAND_MAX + 1.0));
+
+    vector<float> x(max(numQueries, numBodies)), y(x.size()), z(x.size());
+    int numFrames = numQueries / numBodies;
+    start = chrono::steady_clock::now();
+    for(int frame = 0; frame < numFrames; frame++)
+    {
+        table.evaluate(times[frame], &x[0], &y[0], &z[0]);
+    }
+    double allMs = elapsedMs(start);
+
+    start = chrono::steady_clock::now();
+    for(int frame = 0; frame < numFrames; frame++)
+    {
+        Kepler::propagate(bodies.orbits, times[frame], &x[0], &y[0], &z[0]);
+    }
+    double keplerMs = elapsedMs(start);
+
+    int moon = bodies.findBody("moon");
+    start = chrono::steady_clock::now();
+    table.evaluateBody(moon, &times[0], &x[0], &y[0], &z[0], numQueries);
+    double bodyMs = elapsedMs(start);
+
+    double maxError = 0.0;
+    for(int q = 0; q < numQueries; q += 97)
+    {
+        double position[3], velocity[3];
+        Kepler::stateVector(bodies.orbits, moon, times[q], 1.0, position, velocity);
+        double dx = x[q] - position[0], dy = y[q] - position[1], dz = z[q] - position[2];
+        maxError = fmax(maxError, sqrt(dx * dx + dy * dy + dz * dz));
+    }
+
+    double queries = (double)numFrames * numBodies;
+    cout << "ephemeris " << numBodies << " bodies over " << span << " s, " << table.getNumBodies() << " bodies in file" << endl;
+    cout << "  fit " << fitMs << " ms, map " << loadMs << " ms" << endl;
+    cout << "  all bodies at one time: " << queries / allMs / 1e3 << " M queries/s (Kepler: " << queries / keplerMs / 1e3
+        << " M/s)" << endl;
+    cout << "  one body at many times: " << numQueries / bodyMs / 1e3 << " M queries/s" << endl;
+    cout << "  max moon error: " << maxError << " units" << endl;
+
+    table.unload();
+    remove(filePath);
+}
+
+// Model-view matrices for synthetic catalogs: the batch kernel against the
+// chained glm products it replaces, on one core, world positions included.
+void Benchmarks::transforms()
+{
+    const char *filePath = "./bench_catalog.csv";
+    const int sizes[] = { 1000, 100000, 1000000 };
+    const int numFrames = 20;
+
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 300.0f, 1500.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    for(int numBodies : sizes)
+    {
+        writeSyntheticCatalog(filePath, numBodies);
+        BodyCatalog bodies;
+        bodies.loadCSV(filePath);
+        Kepler::propagate(bodies.orbits, 100.0, &bodies.positionsX[0], &bodies.positionsY[0], &bodies.positionsZ[0]);
+
+        vector<float> x(numBodies), y(numBodies), z(numBodies), angles(numBodies);
+        vector<float> centerX(numBodies), centerY(numBodies), centerZ(numBodies);
+        vector<float> matrices(16 * (size_t)numBodies), reference(16 * (size_t)numBodies);
+        for(int i = 0; i < numBodies; i++)
+        {
+            angles[i] = -3.14159f + 6.28318f * (i % 1000) / 1000.0f;
+        }
+
+        auto start = chrono::steady_clock::now();
+        for(int frame = 0; frame < numFrames; frame++)
+        {
+            bodies.resolveWorldPositions(&x[0], &y[0], &z[0]);
+        }
+        double resolveMs = elapsedMs(start) / numFrames;
+
+        start = chrono::steady_clock::now();
+        for(int frame = 0; frame < numFrames; frame++)
+        {
+            Transforms::modelView(view, &x[0], &y[0], &z[0], &angles[0], &bodies.sizes[0], &matrices[0],
+                &centerX[0], &centerY[0], &centerZ[0], 0, numBodies);
+        }
+        double batchMs = elapsedMs(start) / numFrames;
+
+        start = chrono::steady_clock::now();
+        for(int frame = 0; frame < numFrames; frame++)
+        {
+            Transforms::modelViewReference(view, &x[0], &y[0], &z[0], &angles[0], &bodies.sizes[0], &reference[0], 0, numBodies);
+        }
+        double referenceMs = elapsedMs(start) / numFrames;
+
+        double maxError = 0.0;
+        for(size_t k = 0; k < matrices.size(); k++)
+        {
+            maxError = fmax(maxError, fabs(matrices[k] - reference[k]) / fmax(1.0, fabs(reference[k])));
+        }
+
+        cout << "transforms " << numBodies << " bodies: world positions " << resolveMs << " ms, batch " << batchMs
+            << " ms (" << numBodies / batchMs / 1e3 << " M/s), glm " << referenceMs << " ms, max relative error "
+            << maxError << endl;
+    }
+
+    remove(filePath);
+}
+
+// MPCORB.DAT lines: the columns the importer reads, with the rest of a real
+// record as padding so the file has the real size
+void Benchmarks::writeSyntheticMinorPlanets(const char *filePath, int count)
+{
+    ofstream out(filePath, ios::binary);
+    out << "MINOR PLANET CENTER ORBIT DATABASE (MPCORB)\n\n"
+        << "Des'n     H     G   Epoch     M        Peri.      Node       Incl.       e            n           a\n"
+        << string(202, '-') << "\n";
+
+    char line[256];
+    for(int i = 0; i < count; i++)
+    {
+        // Deterministic, so the benchmark can check what it reads back
+        float a = 1.5f + 3.0f * (i % 9973) / 9973.0f;
+        float e = 0.3f * (i % 997) / 997.0f;
+        float angle = 360.0f * (i % 7919) / 7919.0f;
+        snprintf(line, sizeof(line), "%07d %5.2f %5.2f K2555 %9.5f  %9.5f  %9.5f  %9.5f  %9.7f %11.8f %11.7f"
+            "  0 E2024-V47  7330 125 1801-2024 0.80 M-v 30k MPCLINUX   4000      (%d) Synthetic          20241101\n",
+            i % 10000000, 10.0f + (i % 101) / 10.0f, 0.15f, angle, 360.0f - angle, 0.5f * angle, 0.1f * angle / 3.6f,
+            e, 0.9856f / (a * sqrt(a)), a, i);
+        out << line;
+    }
+}
+
+void Benchmarks::minorPlanets()
+{
+    const char *filePath = "./bench_mpcorb.dat";
+    const string cachePath = string(filePath) + ".cache";
+    const int sizes[] = { 10000, 100000, 1000000 };
+
+    for(int count : sizes)
+    {
+        writeSyntheticMinorPlanets(filePath, count);
+        remove(cachePath.c_str());
+
+        MinorPlanets planets;
+        auto start = chrono::steady_clock::now();
+        planets.load(filePath);
+        double importMs = elapsedMs(start);
+
+        MinorPlanets cached;
+        start = chrono::steady_clock::now();
+        cached.load(filePath);
+        double cachedMs = elapsedMs(start);
+
+        int mismatches = planets.size() == count && cached.size() == count ? 0 : 1;
+        for(int i = 0; i < planets.size() && mismatches == 0; i++)
+        {
+            float a = 1.5f + 3.0f * (i % 9973) / 9973.0f;
+            float e = 0.3f * (i % 997) / 997.0f;
+            mismatches += fabs(planets.semiMajorAxes[i] - a) > 1e-5f || fabs(planets.eccentricities[i] - e) > 1e-6f
+                || planets.semiMajorAxes[i] != cached.semiMajorAxes[i];
+        }
+
+        cout << "minor planets " << count << ": import and cache " << importMs << " ms ("
+            << count / importMs / 1e3 << " M records/s), cached " << cachedMs << " ms, "
+            << (mismatches == 0 ? "records match" : "RECORDS DIFFER") << endl;
+    }
+
+    remove(filePath);
+    remove(cachePath.c_str());
+}
@@ -0,0 +1,169 @@
+#include <string>
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+#include <cstdlib>
+#include "../include/BodyCatalog.h"
+
+using namespace std;
+
+BodyCatalog::BodyCatalog() {}
+
+int BodyCatalog::addTexture(const string& path)
+{
+    if(path.empty())
+    {
+        return -1;
+    }
+
+    auto it = textureIndices.find(path);
+    if(it != textureIndices.end())
+    {
+        return it->second;
+    }
+
+    int index = (int)texturePaths.size();
+    texturePaths.push_back(path);
+    textureIndices[path] = index;
+    return index;
+}
+
+// Angles are in radians; distance is the semi-major axis and revolutionSpeed
+// the mean motion.
+int BodyCatalog::addBody(const string& name, int parent, float size, float distance, float revolutionSpeed,
+    const string& texturePath, bool showOrbit, float eccentricity, float inclination,
+    float ascendingNode, float periapsisArgument, float mass)
+{
+    int index = (int)names.size();
+
+    // Random starting point along the orbit; roots stay put
+    float meanAnomaly = parent < 0 ? 0.0f : static_cast <float> (rand()) / static_cast <float> (RAND_MAX/6.2831853f);
+
+    names.push_back(name);
+    parents.push_back(parent);
+    sizes.push_back(size);
+    masses.push_back(mass);
+    orbits.add(distance, eccentricity, inclination, ascendingNode, periapsisArgument, revolutionSpeed, meanAnomaly);
+    textures.push_back(addTexture(texturePath));
+    showOrbits.push_back(showOrbit);
+    positionsX.push_back(0.0f);
+    positionsY.push_back(0.0f);
+    positionsZ.push_back(0.0f);
+
+    bodyIndices[name] = index;
+    return index;
+}
+
+// Columns: name,parent,size,distance,speed,texture,orbit, then optionally
+// eccentricity,inclination,node,periapsis with angles in degrees, and mass in
+// solar masses. Lines starting with '#' and the header line are skipped.
+bool BodyCatalog::loadCSV(const char *filePath)
+{
+    ifstream fileStream(filePath, ios::in);
+    if(!fileStream.is_open())
+    {
+        cout << "Failed to open body catalog: " << filePath << endl;
+        return false;
+    }
+
+    string line;
+    string fields[12];
+    int lineNumber = 0;
+
+    while(getline(fileStream, line))
+    {
+        lineNumber++;
+        if(!line.empty() && line.back() == '\r') line.pop_back();
+        if(line.empty() || line[0] == '#' || line.compare(0, 5, "name,") == 0)
+        {
+            continue;
+        }
+
+        stringstream lineStream(line);
+        int numFields = 0;
+        while(numFields < 12 && getline(lineStream, fields[numFields], ','))
+        {
+            numFields++;
+        }
+        for(int i = numFields; i < 12; i++) fields[i].clear();
+
+        if(numFields < 5)
+        {
+            cout << filePath << ":" << lineNumber << ": expected at least 5 fields" << endl;
+            continue;
+        }
+
+        if(findBody(fields[0]) >= 0)
+        {
+            cout << filePath << ":" << lineNumber << ": duplicate body " << fields[0] << endl;
+            continue;
+        }
+
+        int parent = -1;
+        if(!fields[1].empty())
+        {
+            parent = findBody(fields[1]);
+            if(parent < 0)
+            {
+                cout << filePath << ":" << lineNumber << ": unknown parent " << fields[1] << endl;
+                continue;
+            }
+        }
+
+        const float degrees = 3.14159265f / 180.0f;
+        addBody(fields[0], parent, strtof(fields[2].c_str(), NULL), strtof(fields[3].c_str(), NULL),
+            strtof(fields[4].c_str(), NULL), fields[5], fields[6] == "1", strtof(fields[7].c_str(), NULL),
+            strtof(fields[8].c_str(), NULL) * degrees, strtof(fields[9].c_str(), NULL) * degrees,
+            strtof(fields[10].c_str(), NULL) * degrees, strtof(fields[11].c_str(), NULL));
+    }
+
+    return true;
+}
+
+void BodyCatalog::clear()
+{
+    bodyIndices.clear();
+    textureIndices.clear();
+    names.clear();
+    parents.clear();
+    sizes.clear();
+    masses.clear();
+    orbits.clear();
+    textures.clear();
+    showOrbits.clear();
+    texturePaths.clear();
+    positionsX.clear();
+    positionsY.clear();
+    positionsZ.clear();
+}
+
+int BodyCatalog::getNumBodies() {return (int)names.size();}
+
+int BodyCatalog::findBody(const string& name)
+{
+    auto it = bodyIndices.find(name);
+    return it == bodyIndices.end() ? -1 : it->second;
+}
+
+// Positions relative to the scene origin. Offsets from the parent are pure
+// translations, so the hierarchy resolves in one forward pass on three floats
+// per body, parents coming first, instead of a pass over matrices.
+void BodyCatalog::resolveWorldPositions(float* x, float* y, float* z)
+{
+    int numBodies = getNumBodies();
+    for(int i = 0; i < numBodies; i++)
+    {
+        x[i] = positionsX[i];
+        y[i] = positionsY[i];
+        z[i] = positionsZ[i];
+        int parent = parents[i];
+        if(parent >= 0)
+        {
+            x[i] += x[parent];
+            y[i] += y[parent];
+            z[i] += z[parent];
+        }
+    }
+}
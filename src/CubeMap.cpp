@@ -0,0 +1,84 @@
+#include <cmath>
+#include <algorithm>
+#include "../include/CubeMap.h"
+
+using namespace std;
+
+static const float pi = 3.14159265358979f;
+
+int CubeMap::faceSize(int width)
+{
+    int size = 1 << (int)lround(log2(max(width / 4, 1)));
+    return max(size, 4);
+}
+
+// The major axis, then the face's s and t axes, as GL picks the face
+glm::vec3 CubeMap::direction(int face, float s, float t)
+{
+    float sc = 2.0f * s - 1.0f, tc = 2.0f * t - 1.0f;
+    glm::vec3 d;
+    switch(face)
+    {
+        case 0: d = glm::vec3(1.0f, -tc, -sc); break;
+        case 1: d = glm::vec3(-1.0f, -tc, sc); break;
+        case 2: d = glm::vec3(sc, 1.0f, tc); break;
+        case 3: d = glm::vec3(sc, -1.0f, -tc); break;
+        case 4: d = glm::vec3(sc, -tc, 1.0f); break;
+        default: d = glm::vec3(-sc, -tc, -1.0f); break;
+    }
+    return glm::normalize(d);
+}
+
+// The sphere mesh's mapping: u from -x towards +z, v from the south pole,
+// which is the first row of a flipped map. Wraps around in u.
+static void sample(const unsigned char *texels, int width, int height, int channels, const glm::vec3& d, float color[3])
+{
+    float u = atan2f(d.z, -d.x) / (2.0f * pi);
+    float v = acosf(fmin(fmax(-d.y, -1.0f), 1.0f)) / pi;
+    float x = (u - floorf(u)) * width - 0.5f;
+    float y = fmin(fmax(v * height - 0.5f, 0.0f), height - 1.0f);
+    int x0 = (int)floorf(x), y0 = (int)y;
+    float fx = x - x0, fy = y - y0;
+    int x1 = (x0 + 1) % width, y1 = min(y0 + 1, height - 1);
+    x0 = (x0 + width) % width;
+    for(int c = 0; c < 3; c++)
+    {
+        int channel = channels < 3 ? 0 : c;
+        float top = texels[((size_t)y0 * width + x0) * channels + channel] * (1.0f - fx)
+            + texels[((size_t)y0 * width + x1) * channels + channel] * fx;
+        float bottom = texels[((size_t)y1 * width + x0) * channels + channel] * (1.0f - fx)
+            + texels[((size_t)y1 * width + x1) * channels + channel] * fx;
+        color[c] = top * (1.0f - fy) + bottom * fy;
+    }
+}
+
+void CubeMap::fromEquirectangular(const unsigned char *texels, int width, int height, int channels, int size,
+    vector<unsigned char>& faces)
+{
+    faces.resize((size_t)6 * size * size * 3);
+    for(int face = 0; face < 6; face++)
+    {
+        for(int y = 0; y < size; y++)
+        {
+            for(int x = 0; x < size; x++)
+            {
+                float sum[3] = { 0.0f, 0.0f, 0.0f };
+                for(int i = 0; i < 4; i++)
+                {
+                    float s = (x + 0.25f + 0.5f * (i % 2)) / size, t = (y + 0.25f + 0.5f * (i / 2)) / size;
+                    float color[3];
+                    sample(texels, width, height, channels, direction(face, s, t), color);
+                    for(int c = 0; c < 3; c++)
+                    {
+                        sum[c] += color[c];
+                    }
+                }
+                unsigned char *texel = &faces[(((size_t)face * size + y) * size + x) * 3];
+                for(int c = 0; c < 3; c++)
+                {
+                    texel[c] = (unsigned char)(sum[c] / 4.0f + 0.5f);
+                }
+            }
+        }
+    }
+}
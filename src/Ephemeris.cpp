@@ -0,0 +1,312 @@
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/Ephemeris.h"
+#include "../include/BodyCatalog.h"
+#include "../include/Constants.h"
+#include "../include/FastMath.h"
+
+using namespace std;
+
+// Queries are evaluated in chunks this large so the offsets and Chebyshev
+// arguments stay on the stack
+static const int chunkSize = 256;
+
+// Coefficients start at the first multiple of 8 bytes after the subinterval table
+static size_t coefficientsStart(int numBodies)
+{
+    size_t start = sizeof(EphemerisHeader) + numBodies * sizeof(int);
+    return (start + 7) & ~(size_t)7;
+}
+
+Ephemeris::Ephemeris() : mapping(nullptr), mappingSize(0), header(nullptr), subintervals(nullptr), records(nullptr), recordSize(0)
+{
+}
+
+Ephemeris::~Ephemeris()
+{
+    unload();
+}
+
+bool Ephemeris::load(const char *filePath)
+{
+    unload();
+
+    int file = open(filePath, O_RDONLY);
+    if(file < 0)
+    {
+        cout << "Failed to open ephemeris: " << filePath << endl;
+        return false;
+    }
+    struct stat info;
+    if(fstat(file, &info) != 0 || info.st_size < (off_t)sizeof(EphemerisHeader))
+    {
+        cout << filePath << ": not an ephemeris file" << endl;
+        close(file);
+        return false;
+    }
+    void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if(data == MAP_FAILED)
+    {
+        cout << "Failed to map ephemeris: " << filePath << endl;
+        return false;
+    }
+    mapping = data;
+    mappingSize = info.st_size;
+    header = (const EphemerisHeader*)data;
+
+    if(memcmp(header->magic, "EPH1", 4) != 0 || header->numCoefficients != numCoefficients || header->numBodies <= 0
+        || header->numRecords <= 0 || mappingSize < coefficientsStart(header->numBodies))
+    {
+        cout << filePath << ": not an ephemeris file with " << numCoefficients << " coefficients" << endl;
+        unload();
+        return false;
+    }
+
+    subintervals = (const int*)(header + 1);
+    records = (const double*)((const char*)data + coefficientsStart(header->numBodies));
+
+    // The counts are the file's too: each needs a block, and the records
+    // they add up to must fill the mapping exactly, before any offset is used
+    bodyOffsets.resize(header->numBodies);
+    size_t coefficients = 0;
+    for(int i = 0; i < header->numBodies; i++)
+    {
+        if(subintervals[i] < 1)
+        {
+            cout << filePath << ": body " << i << " has " << subintervals[i] << " subintervals" << endl;
+            unload();
+            return false;
+        }
+        bodyOffsets[i] = (long)coefficients;
+        coefficients += (size_t)subintervals[i] * 3 * numCoefficients;
+    }
+
+    size_t available = mappingSize - coefficientsStart(header->numBodies);
+    size_t recordBytes = coefficients * sizeof(double);
+    if(coefficients > available / sizeof(double) || available / recordBytes != (size_t)header->numRecords
+        || available % recordBytes != 0)
+    {
+        cout << filePath << ": truncated ephemeris (" << available << " bytes for " << header->numRecords << " records of "
+            << recordBytes << ")" << endl;
+        unload();
+        return false;
+    }
+    recordSize = (long)coefficients;
+
+    // Queries walk the records roughly in time order
+    madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+    return true;
+}
+
+void Ephemeris::unload()
+{
+    if(mapping)
+    {
+        munmap(mapping, mappingSize);
+    }
+    mapping = nullptr;
+    mappingSize = 0;
+    header = nullptr;
+    subintervals = nullptr;
+    records = nullptr;
+    bodyOffsets.clear();
+    recordSize = 0;
+}
+
+bool Ephemeris::isLoaded() {return header != nullptr;}
+int Ephemeris::getNumBodies() {return header ? header->numBodies : 0;}
+double Ephemeris::getStartTime() {return header ? header->startTime : 0.0;}
+double Ephemeris::getEndTime() {return header ? header->startTime + header->numRecords * header->recordLength : 0.0;}
+
+bool Ephemeris::covers(double time)
+{
+    return header && time >= getStartTime() && time < getEndTime();
+}
+
+// Index of the first coefficient of the block holding the body at the given
+// time, and the time mapped to [-1, 1] within that block.
+long Ephemeris::blockOffset(int body, double time, double& tau)
+{
+    double t = (time - header->startTime) / header->recordLength;
+    int record = min(max((int)t, 0), header->numRecords - 1);
+    double local = (t - record) * subintervals[body];
+    int subinterval = min(max((int)local, 0), subintervals[body] - 1);
+    tau = 2.0 * (local - subinterval) - 1.0;
+    return (long)record * recordSize + bodyOffsets[body] + subinterval * 3 * numCoefficients;
+}
+
+// Sum of c[first + n] T_n(tau) by the Clenshaw recurrence. Indexing from a
+// shared base, rather than a per-query pointer, lets the loads become gathers.
+static inline double clenshaw(const double* c, long first, double tau)
+{
+    double b1 = 0.0, b2 = 0.0;
+    #pragma GCC unroll 16
+    for(int n = Ephemeris::numCoefficients - 1; n > 0; n--)
+    {
+        double b0 = c[first + n] + 2.0 * tau * b1 - b2;
+        b2 = b1;
+        b1 = b0;
+    }
+    return c[first] + tau * b1 - b2;
+}
+
+// x, y and z of every query. The coefficient count is fixed, so the
+// recurrence unrolls and the query loop vectorizes with gathers.
+void Ephemeris::evaluateBlocks(const long* offsets, const double* taus, float* x, float* y, float* z, int count)
+{
+    const double* coefficients = records;
+
+    #pragma omp simd
+    for(int q = 0; q < count; q++)
+    {
+        long block = offsets[q];
+        x[q] = (float)clenshaw(coefficients, block, taus[q]);
+        y[q] = (float)clenshaw(coefficients, block + numCoefficients, taus[q]);
+        z[q] = (float)clenshaw(coefficients, block + 2 * numCoefficients, taus[q]);
+    }
+}
+
+void Ephemeris::evaluate(double time, float* x, float* y, float* z, int first, int count)
+{
+    if(count < 0)
+    {
+        count = getNumBodies() - first;
+    }
+
+    int end = first + count;
+    for(int chunk = first; chunk < end; chunk += chunkSize)
+    {
+        long offsets[chunkSize];
+        double taus[chunkSize];
+        int chunkCount = min(chunkSize, end - chunk);
+        for(int q = 0; q < chunkCount; q++)
+        {
+            offsets[q] = blockOffset(chunk + q, time, taus[q]);
+        }
+        evaluateBlocks(offsets, taus, x + chunk, y + chunk, z + chunk, chunkCount);
+    }
+}
+
+void Ephemeris::evaluateBody(int body, const double* times, float* x, float* y, float* z, int count)
+{
+    #pragma omp parallel for if(count > 16 * chunkSize)
+    for(int first = 0; first < count; first += chunkSize)
+    {
+        long offsets[chunkSize];
+        double taus[chunkSize];
+        int chunk = min(chunkSize, count - first);
+        for(int q = 0; q < chunk; q++)
+        {
+            offsets[q] = blockOffset(body, times[first + q], taus[q]);
+        }
+        evaluateBlocks(offsets, taus, x + first, y + first, z + first, chunk);
+    }
+}
+
+// Each body gets enough subintervals per record that one spans at most a
+// quarter of its orbit, and every subinterval is interpolated at the
+// Chebyshev nodes of the analytic two-body solution.
+bool Ephemeris::fit(const char *filePath, BodyCatalog& catalog, double startTime, double endTime, double recordLength)
+{
+    int numBodies = catalog.getNumBodies();
+    EphemerisHeader fileHeader;
+    memcpy(fileHeader.magic, "EPH1", 4);
+    fileHeader.numBodies = numBodies;
+    fileHeader.numCoefficients = numCoefficients;
+    fileHeader.numRecords = max(1, (int)ceil((endTime - startTime) / recordLength));
+    fileHeader.startTime = startTime;
+    fileHeader.recordLength = recordLength;
+
+    vector<int> counts(numBodies, 1);
+    for(int i = 0; i < numBodies; i++)
+    {
+        if(catalog.parents[i] >= 0 && catalog.orbits.meanMotions[i] > 0.0f)
+        {
+            double period = FastMath::two_pi / catalog.orbits.meanMotions[i];
+            // Periapsis passages of eccentric orbits need proportionally more
+            double eccentricity = catalog.orbits.eccentricities[i];
+            period *= (1.0 - eccentricity) / (1.0 + eccentricity);
+            counts[i] = max(1, (int)ceil(4.0 * recordLength / period));
+        }
+    }
+
+    ofstream out(filePath, ios::binary);
+    if(!out)
+    {
+        cout << "Failed to write ephemeris: " << filePath << endl;
+        return false;
+    }
+    out.write((const char*)&fileHeader, sizeof(fileHeader));
+    out.write((const char*)&counts[0], numBodies * sizeof(int));
+    size_t padding = coefficientsStart(numBodies) - sizeof(fileHeader) - numBodies * sizeof(int);
+    const char zeros[8] = { 0 };
+    out.write(zeros, padding);
+
+    // Chebyshev nodes and T_n at each of them
+    double nodes[numCoefficients];
+    double basis[numCoefficients][numCoefficients];
+    for(int j = 0; j < numCoefficients; j++)
+    {
+        nodes[j] = cos(M_PI * (j + 0.5) / numCoefficients);
+        for(int n = 0; n < numCoefficients; n++)
+        {
+            basis[n][j] = cos(M_PI * n * (j + 0.5) / numCoefficients);
+        }
+    }
+
+    size_t recordSize = 0;
+    for(int i = 0; i < numBodies; i++) recordSize += counts[i] * 3 * numCoefficients;
+    vector<double> coefficients(fileHeader.numRecords * recordSize);
+
+    #pragma omp parallel for schedule(dynamic)
+    for(int r = 0; r < fileHeader.numRecords; r++)
+    {
+        double* c = &coefficients[r * recordSize];
+        double recordStart = startTime + r * recordLength;
+        for(int i = 0; i < numBodies; i++)
+        {
+            int parent = catalog.parents[i];
+            double mu = parent >= 0 ? Constants::gravitational_constant * (catalog.masses[parent] + catalog.masses[i]) : 0.0;
+            double length = recordLength / counts[i];
+            for(int s = 0; s < counts[i]; s++)
+            {
+                double samples[3][numCoefficients];
+                for(int j = 0; j < numCoefficients; j++)
+                {
+                    double position[3] = { 0.0, 0.0, 0.0 }, velocity[3];
+                    if(parent >= 0)
+                    {
+                        double time = recordStart + (s + 0.5 * (nodes[j] + 1.0)) * length;
+                        Kepler::stateVector(catalog.orbits, i, time, mu, position, velocity);
+                    }
+                    for(int k = 0; k < 3; k++) samples[k][j] = position[k];
+                }
+
+                // c_n = 2/N sum_j f(x_j) T_n(x_j), with c_0 halved
+                for(int k = 0; k < 3; k++)
+                {
+                    for(int n = 0; n < numCoefficients; n++)
+                    {
+                        double sum = 0.0;
+                        for(int j = 0; j < numCoefficients; j++)
+                        {
+                            sum += samples[k][j] * basis[n][j];
+                        }
+                        *c++ = (n == 0 ? 1.0 : 2.0) * sum / numCoefficients;
+                    }
+                }
+            }
+        }
+    }
+
+    out.write((const char*)&coefficients[0], coefficients.size() * sizeof(double));
+    return (bool)out;
+}
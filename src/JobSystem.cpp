@@ -0,0 +1,260 @@
+#include <chrono>
+#include <algorithm>
+#include "../include/JobSystem.h"
+
+using namespace std;
+
+// The pool, and the worker index within it, that the calling thread belongs
+// to; other threads use the shared queue
+static thread_local JobSystem* currentSystem = nullptr;
+static thread_local int currentWorker = -1;
+
+static long long nowNs()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+JobSystem::JobSystem(int numWorkers) : running(true), queued(0), sleeping(0), statsStart(nowNs())
+{
+    if(numWorkers < 0)
+    {
+        numWorkers = max(1, (int)thread::hardware_concurrency() - 1);
+    }
+    for(int i = 0; i <= numWorkers; i++)
+    {
+        queues.push_back(unique_ptr<Queue>(new Queue()));
+    }
+    for(int i = 0; i < numWorkers; i++)
+    {
+        threads.push_back(thread(&JobSystem::workerLoop, this, i));
+    }
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        lock_guard<mutex> lock(sleepMutex);
+        running = false;
+    }
+    wake.notify_all();
+    for(size_t i = 0; i < threads.size(); i++)
+    {
+        threads[i].join();
+    }
+}
+
+int JobSystem::getNumWorkers() {return (int)threads.size();}
+
+int JobSystem::currentQueue()
+{
+    return currentSystem == this ? currentWorker : (int)queues.size() - 1;
+}
+
+void JobSystem::workerLoop(int worker)
+{
+    currentSystem = this;
+    currentWorker = worker;
+
+    while(running)
+    {
+        Job job;
+        if(tryGetJob(worker, job))
+        {
+            execute(worker, job);
+            continue;
+        }
+
+        unique_lock<mutex> lock(sleepMutex);
+        sleeping++;
+        wake.wait(lock, [this]() {return queued > 0 || !running;});
+        sleeping--;
+    }
+}
+
+void JobSystem::push(const Job& job)
+{
+    long long start = nowNs();
+    Queue& queue = *queues[currentQueue()];
+    {
+        lock_guard<mutex> lock(queue.mutex);
+        queue.jobs.push_back(job);
+    }
+    queued++;
+
+    // Taking the lock orders this with a worker between checking for work
+    // and going to sleep, so the wakeup cannot be lost
+    if(sleeping > 0)
+    {
+        {
+            lock_guard<mutex> lock(sleepMutex);
+        }
+        wake.notify_one();
+    }
+    queue.schedulingNs += nowNs() - start;
+}
+
+void JobSystem::run(const function<void()>& job, JobCounter* counter)
+{
+    if(counter)
+    {
+        counter->pending++;
+    }
+    push(Job{ job, counter });
+}
+
+void JobSystem::runAfter(JobCounter& dependency, const function<void()>& job, JobCounter* counter)
+{
+    if(counter)
+    {
+        counter->pending++;
+    }
+    Job continuation = { job, counter };
+    {
+        lock_guard<mutex> lock(dependency.mutex);
+        if(dependency.pending > 0)
+        {
+            dependency.continuations.push_back([this, continuation]() {push(continuation);});
+            return;
+        }
+    }
+    push(continuation);
+}
+
+// Newest job of the own queue first, which is the one most likely still in
+// cache, then the oldest job of any other queue
+bool JobSystem::tryGetJob(int index, Job& job)
+{
+    long long start = nowNs();
+    Queue& own = *queues[index];
+    {
+        lock_guard<mutex> lock(own.mutex);
+        if(!own.jobs.empty())
+        {
+            job = move(own.jobs.back());
+            own.jobs.pop_back();
+            queued--;
+            own.schedulingNs += nowNs() - start;
+            return true;
+        }
+    }
+
+    int numQueues = (int)queues.size();
+    for(int k = 1; k < numQueues; k++)
+    {
+        Queue& victim = *queues[(index + k) % numQueues];
+        lock_guard<mutex> lock(victim.mutex);
+        if(!victim.jobs.empty())
+        {
+            job = move(victim.jobs.front());
+            victim.jobs.pop_front();
+            queued--;
+            own.steals++;
+            own.schedulingNs += nowNs() - start;
+            return true;
+        }
+    }
+    own.schedulingNs += nowNs() - start;
+    return false;
+}
+
+void JobSystem::execute(int index, Job& job)
+{
+    long long start = nowNs();
+    job.function();
+    queues[index]->busyNs += nowNs() - start;
+    queues[index]->executed++;
+    finish(job.counter);
+}
+
+void JobSystem::finish(JobCounter* counter)
+{
+    if(!counter)
+    {
+        return;
+    }
+
+    vector<function<void()>> ready;
+    {
+        lock_guard<mutex> lock(counter->mutex);
+        if(--counter->pending == 0)
+        {
+            ready.swap(counter->continuations);
+        }
+    }
+    for(size_t i = 0; i < ready.size(); i++)
+    {
+        ready[i]();
+    }
+}
+
+// Runs queued jobs, anyone's, until the counter drops to zero
+void JobSystem::wait(JobCounter& counter)
+{
+    int index = currentQueue();
+    while(!counter.done())
+    {
+        Job job;
+        if(tryGetJob(index, job))
+        {
+            execute(index, job);
+        }
+        else
+        {
+            this_thread::yield();
+        }
+    }
+
+    // The last finish may still hold the counter's lock; the caller is free
+    // to destroy the counter once it has let go
+    lock_guard<mutex> lock(counter.mutex);
+}
+
+void JobSystem::parallelFor(int count, int grain, const function<void(int first, int last)>& body)
+{
+    int numRanges = count > 0 ? (count + grain - 1) / grain : 0;
+    if(numRanges <= 1)
+    {
+        if(count > 0)
+        {
+            body(0, count);
+        }
+        return;
+    }
+
+    JobCounter counter;
+    for(int r = 1; r < numRanges; r++)
+    {
+        run([&body, r, grain, count]() {body(r * grain, min(count, (r + 1) * grain));}, &counter);
+    }
+    // The caller takes the first range itself
+    body(0, grain);
+    wait(counter);
+}
+
+JobStats JobSystem::collectStats()
+{
+    long long now = nowNs();
+    double elapsedMs = (now - statsStart) * 1e-6;
+    statsStart = now;
+
+    JobStats stats = JobStats();
+    stats.numWorkers = getNumWorkers();
+    for(size_t i = 0; i < queues.size(); i++)
+    {
+        Queue& queue = *queues[i];
+        double busyMs = queue.busyNs.exchange(0) * 1e-6;
+        if((int)i < stats.numWorkers)
+        {
+            stats.busyMs += busyMs;
+        }
+        else
+        {
+            stats.helperMs += busyMs;
+        }
+        stats.schedulingMs += queue.schedulingNs.exchange(0) * 1e-6;
+        stats.jobs += queue.executed.exchange(0);
+        stats.steals += queue.steals.exchange(0);
+    }
+    stats.utilization = elapsedMs > 0.0 ? stats.busyMs / (stats.numWorkers * elapsedMs) : 0.0;
+    return stats;
+}
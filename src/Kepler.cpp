@@ -0,0 +1,155 @@
+#include <cmath>
+#include <vector>
+#include "../include/Kepler.h"
+#include "../include/FastMath.h"
+
+using namespace std;
+
+void OrbitalElements::add(float semiMajorAxis, float eccentricity, float inclination, float ascendingNode,
+    float periapsisArgument, float meanMotion, float meanAnomaly)
+{
+    float cosNode = cos(ascendingNode), sinNode = sin(ascendingNode);
+    float cosPeri = cos(periapsisArgument), sinPeri = sin(periapsisArgument);
+    float cosIncl = cos(inclination), sinIncl = sin(inclination);
+
+    // Perifocal basis in ecliptic axes (X, Y, Z) mapped to scene axes
+    // (x, y, z) = (Y, Z, X), so a circular orbit with zero angles matches the
+    // old sin/cos motion in the xz plane.
+    float pX = cosNode * cosPeri - sinNode * sinPeri * cosIncl;
+    float pY = sinNode * cosPeri + cosNode * sinPeri * cosIncl;
+    float pZ = sinPeri * sinIncl;
+    float qX = -cosNode * sinPeri - sinNode * cosPeri * cosIncl;
+    float qY = -sinNode * sinPeri + cosNode * cosPeri * cosIncl;
+    float qZ = cosPeri * sinIncl;
+
+    semiMajorAxes.push_back(semiMajorAxis);
+    semiMinorAxes.push_back(semiMajorAxis * sqrt(1.0f - eccentricity * eccentricity));
+    eccentricities.push_back(eccentricity);
+    meanMotions.push_back(meanMotion);
+    meanAnomalies.push_back(meanAnomaly);
+    px.push_back(pY); py.push_back(pZ); pz.push_back(pX);
+    qx.push_back(qY); qy.push_back(qZ); qz.push_back(qX);
+}
+
+void OrbitalElements::clear()
+{
+    semiMajorAxes.clear();
+    semiMinorAxes.clear();
+    eccentricities.clear();
+    meanMotions.clear();
+    meanAnomalies.clear();
+    px.clear(); py.clear(); pz.clear();
+    qx.clear(); qy.clear(); qz.clear();
+}
+
+int OrbitalElements::size() {return (int)semiMajorAxes.size();}
+
+// Eccentric anomaly for M in [-pi, pi). Danby's starting guess keeps a fixed
+// number of Halley steps convergent for every e < 1.
+static inline float solveKepler(float M, float e)
+{
+    float E = M + (M < 0.0f ? -0.85f : 0.85f) * e;
+    #pragma GCC unroll 4
+    for(int k = 0; k < Kepler::iterations; k++)
+    {
+        float sinE, cosE;
+        FastMath::sincos(E, sinE, cosE);
+        float f = E - e * sinE - M;
+        float df = 1.0f - e * cosE;
+        E -= f / (df - 0.5f * f * e * sinE / df);
+    }
+    return E;
+}
+
+void Kepler::solve(const float* meanAnomalies, const float* eccentricities, float* eccentricAnomalies, int count)
+{
+    #pragma omp simd
+    for(int i = 0; i < count; i++)
+    {
+        eccentricAnomalies[i] = solveKepler(meanAnomalies[i], eccentricities[i]);
+    }
+}
+
+// Newton iteration in double, run to convergence; the accuracy baseline for
+// the batch solver.
+double Kepler::solveReference(double meanAnomaly, double eccentricity)
+{
+    double E = eccentricity < 0.8 ? meanAnomaly : (meanAnomaly < 0.0 ? -M_PI : M_PI);
+    for(int k = 0; k < 100; k++)
+    {
+        double delta = (E - eccentricity * sin(E) - meanAnomaly) / (1.0 - eccentricity * cos(E));
+        E -= delta;
+        if(fabs(delta) < 1e-15)
+        {
+            break;
+        }
+    }
+    return E;
+}
+
+// Positions relative to the parent for bodies [first, first + count) at the
+// given time. Mean anomalies are advanced and wrapped in double so precision
+// does not degrade with large times.
+void Kepler::propagate(OrbitalElements& orbits, double time, float* x, float* y, float* z, int first, int count)
+{
+    if(count < 0)
+    {
+        count = orbits.size() - first;
+    }
+
+    const float* a = &orbits.semiMajorAxes[0];
+    const float* b = &orbits.semiMinorAxes[0];
+    const float* e = &orbits.eccentricities[0];
+    const float* n = &orbits.meanMotions[0];
+    const float* M0 = &orbits.meanAnomalies[0];
+    const float* px = &orbits.px[0];
+    const float* py = &orbits.py[0];
+    const float* pz = &orbits.pz[0];
+    const float* qx = &orbits.qx[0];
+    const float* qy = &orbits.qy[0];
+    const float* qz = &orbits.qz[0];
+    int last = first + count;
+
+    #pragma omp simd
+    for(int i = first; i < last; i++)
+    {
+        float M = (float)FastMath::wrapAngle(M0[i] + (double)n[i] * time);
+        float E = solveKepler(M, e[i]);
+
+        float sinE, cosE;
+        FastMath::sincos(E, sinE, cosE);
+        float u = a[i] * (cosE - e[i]);
+        float v = b[i] * sinE;
+
+        x[i] = u * px[i] + v * qx[i];
+        y[i] = u * py[i] + v * qy[i];
+        z[i] = u * pz[i] + v * qz[i];
+    }
+}
+
+// Position and velocity of one body relative to its parent, in double. The
+// velocity follows from the gravitational parameter mu rather than the
+// tabulated mean motion, so the state is consistent with real gravity.
+void Kepler::stateVector(OrbitalElements& orbits, int body, double time, double mu, double position[3], double velocity[3])
+{
+    double a = orbits.semiMajorAxes[body];
+    double e = orbits.eccentricities[body];
+    double M = FastMath::wrapAngle(orbits.meanAnomalies[body] + (double)orbits.meanMotions[body] * time);
+    double E = solveReference(M, e);
+
+    double cosE = cos(E), sinE = sin(E);
+    double u = a * (cosE - e);
+    double v = a * sqrt(1.0 - e * e) * sinE;
+    double r = a * (1.0 - e * cosE);
+    double speed = r > 0.0 ? sqrt(mu * a) / r : 0.0;
+    double du = -speed * sinE;
+    double dv = speed * sqrt(1.0 - e * e) * cosE;
+
+    const float* P[3] = { &orbits.px[body], &orbits.py[body], &orbits.pz[body] };
+    const float* Q[3] = { &orbits.qx[body], &orbits.qy[body], &orbits.qz[body] };
+    for(int k = 0; k < 3; k++)
+    {
+        position[k] = u * *P[k] + v * *Q[k];
+        velocity[k] = du * *P[k] + dv * *Q[k];
+    }
+}
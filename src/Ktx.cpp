@@ -0,0 +1,558 @@
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <sys/stat.h>
+#include "../include/Ktx.h"
+
+using namespace std;
+
+static const unsigned char identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+static const char *averageColorKey = "SolarSystem.averageColor";
+
+// Fixed part of a KTX2 file after the identifier
+struct KtxHeader
+{
+    uint32_t vkFormat, typeSize;
+    uint32_t pixelWidth, pixelHeight, pixelDepth;
+    uint32_t layerCount, faceCount, levelCount;
+    uint32_t supercompressionScheme;
+    uint32_t dfdByteOffset, dfdByteLength;
+    uint32_t kvdByteOffset, kvdByteLength;
+    uint64_t sgdByteOffset, sgdByteLength;
+};
+
+struct KtxLevel
+{
+    uint64_t byteOffset, byteLength, uncompressedByteLength;
+};
+
+string Ktx::cachePath(const string& imagePath)
+{
+    size_t slash = imagePath.find_last_of('/');
+    size_t dot = imagePath.find_last_of('.');
+    if(dot == string::npos || (slash != string::npos && dot < slash))
+    {
+        return imagePath + ".ktx2";
+    }
+    return imagePath.substr(0, dot) + ".ktx2";
+}
+
+bool Ktx::isCurrent(const string& imagePath)
+{
+    struct stat cacheInfo, imageInfo;
+    if(stat(cachePath(imagePath).c_str(), &cacheInfo) != 0)
+    {
+        return false;
+    }
+    return stat(imagePath.c_str(), &imageInfo) != 0 || cacheInfo.st_mtime >= imageInfo.st_mtime;
+}
+
+size_t Ktx::levelSize(int width, int height)
+{
+    return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes;
+}
+
+// 565 colors and back, with the low bits replicated as decoders do
+static uint16_t packColor(const float color[3])
+{
+    int r = (int)(fmin(fmax(color[0], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+    int g = (int)(fmin(fmax(color[1], 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+    int b = (int)(fmin(fmax(color[2], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+    return (uint16_t)(r << 11 | g << 5 | b);
+}
+
+static void unpackColor(uint16_t packed, int color[3])
+{
+    int r = packed >> 11, g = (packed >> 5) & 63, b = packed & 31;
+    color[0] = r << 3 | r >> 2;
+    color[1] = g << 2 | g >> 4;
+    color[2] = b << 3 | b >> 2;
+}
+
+// Palette of a block in four-color mode (color0 > color1); with equal
+// endpoints every index is 0, so the third and fourth entries do not matter
+static void palette(uint16_t color0, uint16_t color1, int colors[4][3])
+{
+    unpackColor(color0, colors[0]);
+    unpackColor(color1, colors[1]);
+    for(int c = 0; c < 3; c++)
+    {
+        colors[2][c] = (2 * colors[0][c] + colors[1][c]) / 3;
+        colors[3][c] = (colors[0][c] + 2 * colors[1][c]) / 3;
+    }
+}
+
+// Nearest palette entry of every texel; returns the summed squared error
+static int chooseIndices(const unsigned char texels[16][3], const int colors[4][3], int indices[16])
+{
+    int total = 0;
+    for(int i = 0; i < 16; i++)
+    {
+        int best = 0, bestError = 1 << 30;
+        for(int p = 0; p < 4; p++)
+        {
+            int dr = texels[i][0] - colors[p][0], dg = texels[i][1] - colors[p][1], db = texels[i][2] - colors[p][2];
+            int error = dr * dr + dg * dg + db * db;
+            if(error < bestError)
+            {
+                best = p;
+                bestError = error;
+            }
+        }
+        indices[i] = best;
+        total += bestError;
+    }
+    return total;
+}
+
+// Four-color mode needs color0 > color1; indices are chosen after ordering
+static void orderEndpoints(uint16_t& color0, uint16_t& color1)
+{
+    if(color0 < color1)
+    {
+        swap(color0, color1);
+    }
+}
+
+static int encodeCandidate(const unsigned char texels[16][3], uint16_t color0, uint16_t color1, int indices[16])
+{
+    int colors[4][3];
+    palette(color0, color1, colors);
+    return chooseIndices(texels, colors, indices);
+}
+
+// Endpoints from the extent of the texels along their principal axis, then
+// one least-squares refit of the endpoints to the chosen indices
+void Ktx::encodeBlock(const unsigned char texels[16][3], unsigned char block[8])
+{
+    float mean[3] = { 0.0f, 0.0f, 0.0f };
+    for(int i = 0; i < 16; i++)
+    {
+        for(int c = 0; c < 3; c++)
+        {
+            mean[c] += texels[i][c] / 16.0f;
+        }
+    }
+    float covariance[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+    for(int i = 0; i < 16; i++)
+    {
+        float r = texels[i][0] - mean[0], g = texels[i][1] - mean[1], b = texels[i][2] - mean[2];
+        covariance[0] += r * r; covariance[1] += r * g; covariance[2] += r * b;
+        covariance[3] += g * g; covariance[4] += g * b; covariance[5] += b * b;
+    }
+    float axis[3] = { 1.0f, 1.0f, 1.0f };
+    for(int k = 0; k < 8; k++)
+    {
+        float x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+        float y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+        float z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+        float length = sqrt(x * x + y * y + z * z);
+        if(length < 1e-6f)
+        {
+            break;
+        }
+        axis[0] = x / length; axis[1] = y / length; axis[2] = z / length;
+    }
+
+    float low = 0.0f, high = 0.0f;
+    for(int i = 0; i < 16; i++)
+    {
+        float t = (texels[i][0] - mean[0]) * axis[0] + (texels[i][1] - mean[1]) * axis[1] + (texels[i][2] - mean[2]) * axis[2];
+        low = fmin(low, t);
+        high = fmax(high, t);
+    }
+    float end0[3], end1[3];
+    for(int c = 0; c < 3; c++)
+    {
+        end0[c] = mean[c] + high * axis[c];
+        end1[c] = mean[c] + low * axis[c];
+    }
+    uint16_t color0 = packColor(end0), color1 = packColor(end1);
+    orderEndpoints(color0, color1);
+    int indices[16];
+    int error = encodeCandidate(texels, color0, color1, indices);
+
+    // Index p puts weight w[p] on color0: x = w a + (1 - w) b, solved for a
+    // and b over all texels
+    if(color0 != color1)
+    {
+        const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+        float aa = 0.0f, ab = 0.0f, bb = 0.0f, ax[3] = { 0.0f, 0.0f, 0.0f }, bx[3] = { 0.0f, 0.0f, 0.0f };
+        for(int i = 0; i < 16; i++)
+        {
+            float w = weights[indices[i]];
+            aa += w * w; ab += w * (1.0f - w); bb += (1.0f - w) * (1.0f - w);
+            for(int c = 0; c < 3; c++)
+            {
+                ax[c] += w * texels[i][c];
+                bx[c] += (1.0f - w) * texels[i][c];
+            }
+        }
+        float determinant = aa * bb - ab * ab;
+        if(fabs(determinant) > 1e-6f)
+        {
+            for(int c = 0; c < 3; c++)
+            {
+                end0[c] = (bb * ax[c] - ab * bx[c]) / determinant;
+                end1[c] = (aa * bx[c] - ab * ax[c]) / determinant;
+            }
+            uint16_t refit0 = packColor(end0), refit1 = packColor(end1);
+            orderEndpoints(refit0, refit1);
+            int refitIndices[16];
+            int refitError = encodeCandidate(texels, refit0, refit1, refitIndices);
+            if(refitError < error && refit0 != refit1)
+            {
+                color0 = refit0;
+                color1 = refit1;
+                memcpy(indices, refitIndices, sizeof(indices));
+            }
+        }
+    }
+
+    uint32_t bits = 0;
+    for(int i = 0; i < 16; i++)
+    {
+        bits |= (uint32_t)(color0 == color1 ? 0 : indices[i]) << (2 * i);
+    }
+    block[0] = color0 & 255; block[1] = color0 >> 8;
+    block[2] = color1 & 255; block[3] = color1 >> 8;
+    for(int k = 0; k < 4; k++)
+    {
+        block[4 + k] = (bits >> (8 * k)) & 255;
+    }
+}
+
+void Ktx::decodeBlock(const unsigned char block[8], unsigned char texels[16][3])
+{
+    uint16_t color0 = block[0] | block[1] << 8, color1 = block[2] | block[3] << 8;
+    int colors[4][3];
+    palette(color0, color1, colors);
+    if(color0 <= color1)
+    {
+        // Three-color mode: a midpoint and black
+        for(int c = 0; c < 3; c++)
+        {
+            colors[2][c] = (colors[0][c] + colors[1][c]) / 2;
+            colors[3][c] = 0;
+        }
+    }
+    uint32_t bits = block[4] | block[5] << 8 | block[6] << 16 | (uint32_t)block[7] << 24;
+    for(int i = 0; i < 16; i++)
+    {
+        int index = (bits >> (2 * i)) & 3;
+        for(int c = 0; c < 3; c++)
+        {
+            texels[i][c] = (unsigned char)colors[index][c];
+        }
+    }
+}
+
+// 2x2 box filter; an odd last row or column is dropped, and a side of one
+// texel is averaged with itself. Serial, since the texture loader runs it
+// inside its decode jobs.
+void Ktx::downsample(const vector<unsigned char>& source, int width, int height, vector<unsigned char>& target)
+{
+    int targetWidth = max(1, width / 2), targetHeight = max(1, height / 2);
+    target.resize((size_t)targetWidth * targetHeight * 3);
+    for(int y = 0; y < targetHeight; y++)
+    {
+        int y0 = min(2 * y, height - 1), y1 = min(2 * y + 1, height - 1);
+        for(int x = 0; x < targetWidth; x++)
+        {
+            int x0 = min(2 * x, width - 1), x1 = min(2 * x + 1, width - 1);
+            for(int c = 0; c < 3; c++)
+            {
+                int sum = source[((size_t)y0 * width + x0) * 3 + c] + source[((size_t)y0 * width + x1) * 3 + c]
+                    + source[((size_t)y1 * width + x0) * 3 + c] + source[((size_t)y1 * width + x1) * 3 + c];
+                target[((size_t)y * targetWidth + x) * 3 + c] = (unsigned char)((sum + 2) / 4);
+            }
+        }
+    }
+}
+
+void Ktx::encode(const unsigned char *texels, int width, int height, int channels, bool mipmaps, KtxImage& image)
+{
+    image.width = width;
+    image.height = height;
+    image.numLevels = 0;
+    image.numFaces = 1;
+    image.data.clear();
+    image.levelOffsets.clear();
+    image.levelSizes.clear();
+    image.hasAverageColor = false;
+
+    vector<unsigned char> level((size_t)width * height * 3);
+    double sum[3] = { 0.0, 0.0, 0.0 };
+    for(size_t i = 0; i < (size_t)width * height; i++)
+    {
+        for(int c = 0; c < 3; c++)
+        {
+            level[i * 3 + c] = texels[i * channels + (channels < 3 ? 0 : c)];
+            sum[c] += level[i * 3 + c];
+        }
+    }
+
+    int levelWidth = width, levelHeight = height;
+    while(true)
+    {
+        int blocksX = (levelWidth + 3) / 4, blocksY = (levelHeight + 3) / 4;
+        size_t offset = image.data.size();
+        image.data.resize(offset + levelSize(levelWidth, levelHeight));
+        image.levelOffsets.push_back(offset);
+        image.levelSizes.push_back(levelSize(levelWidth, levelHeight));
+        image.numLevels++;
+
+        // Blocks past the edge repeat the last row and column
+        unsigned char *blocks = &image.data[offset];
+        #pragma omp parallel for schedule(dynamic)
+        for(int by = 0; by < blocksY; by++)
+        {
+            unsigned char block[16][3];
+            for(int bx = 0; bx < blocksX; bx++)
+            {
+                for(int i = 0; i < 16; i++)
+                {
+                    int x = min(4 * bx + i % 4, levelWidth - 1), y = min(4 * by + i / 4, levelHeight - 1);
+                    memcpy(block[i], &level[((size_t)y * levelWidth + x) * 3], 3);
+                }
+                encodeBlock(block, blocks + ((size_t)by * blocksX + bx) * blockBytes);
+            }
+        }
+
+        if(!mipmaps || (levelWidth == 1 && levelHeight == 1))
+        {
+            break;
+        }
+        vector<unsigned char> next;
+        downsample(level, levelWidth, levelHeight, next);
+        level.swap(next);
+        levelWidth = max(1, levelWidth / 2);
+        levelHeight = max(1, levelHeight / 2);
+    }
+
+    image.bytes = image.data.data();
+    image.numBytes = image.data.size();
+
+    // Mean texel color, which sprites use; the 1x1 level is only close to it
+    // when odd sides were dropped on the way down
+    image.hasAverageColor = true;
+    for(int c = 0; c < 3; c++)
+    {
+        image.averageColor[c] = (float)(sum[c] / (255.0 * width * height));
+    }
+}
+
+// The faces' levels interleaved as a KTX2 file stores them; the average
+// color is the faces' mean
+void Ktx::encodeCubemap(const unsigned char *faces, int size, bool mipmaps, KtxImage& image)
+{
+    vector<KtxImage> encoded(6);
+    for(int face = 0; face < 6; face++)
+    {
+        encode(faces + (size_t)face * size * size * 3, size, size, 3, mipmaps, encoded[face]);
+    }
+    image = KtxImage();
+    image.width = size;
+    image.height = size;
+    image.numLevels = encoded[0].numLevels;
+    image.numFaces = 6;
+    for(int level = 0; level < image.numLevels; level++)
+    {
+        for(int face = 0; face < 6; face++)
+        {
+            const KtxImage& source = encoded[face];
+            image.levelOffsets.push_back(image.data.size());
+            image.levelSizes.push_back(source.levelSizes[level]);
+            image.data.insert(image.data.end(), source.data.begin() + source.levelOffsets[level],
+                source.data.begin() + source.levelOffsets[level] + source.levelSizes[level]);
+        }
+    }
+    image.bytes = image.data.data();
+    image.numBytes = image.data.size();
+    image.hasAverageColor = true;
+    for(int c = 0; c < 3; c++)
+    {
+        image.averageColor[c] = 0.0f;
+        for(int face = 0; face < 6; face++)
+        {
+            image.averageColor[c] += encoded[face].averageColor[c] / 6.0f;
+        }
+    }
+}
+
+static void append(vector<unsigned char>& out, const void *data, size_t size)
+{
+    const unsigned char *bytes = (const unsigned char*)data;
+    out.insert(out.end(), bytes, bytes + size);
+}
+
+static void pad(vector<unsigned char>& out, size_t alignment)
+{
+    out.resize((out.size() + alignment - 1) / alignment * alignment, 0);
+}
+
+// Header, level index, data format descriptor, key/value data, then the
+// levels from the smallest to level 0, each aligned to a block and holding
+// all of a cubemap's faces
+bool Ktx::save(const char *filePath, const KtxImage& image)
+{
+    KtxHeader header = KtxHeader();
+    header.vkFormat = vkFormatBC1;
+    header.typeSize = 1;
+    header.pixelWidth = image.width;
+    header.pixelHeight = image.height;
+    header.faceCount = image.numFaces;
+    header.levelCount = image.numLevels;
+
+    // Basic descriptor block with one sample: BC1 color model, BT.709
+    // primaries, linear transfer as the textures are sampled, 4x4 blocks of
+    // 8 bytes
+    const uint32_t dfd[11] = {
+        44,
+        0, 2 | 40 << 16, 128 | 1 << 8 | 1 << 16, 3 | 3 << 8, 8, 0,
+        63 << 16, 0, 0, 0xFFFFFFFF
+    };
+
+    vector<unsigned char> keyValues;
+    vector<pair<string, string>> entries;
+    entries.push_back(make_pair(string("KTXwriter"), string("SolarSystem ktxconvert")));
+    if(image.hasAverageColor)
+    {
+        char value[64];
+        snprintf(value, sizeof(value), "%.6f %.6f %.6f", image.averageColor[0], image.averageColor[1], image.averageColor[2]);
+        entries.push_back(make_pair(string(averageColorKey), string(value)));
+    }
+    for(const pair<string, string>& entry : entries)
+    {
+        uint32_t length = (uint32_t)(entry.first.size() + 1 + entry.second.size() + 1);
+        append(keyValues, &length, sizeof(length));
+        append(keyValues, entry.first.c_str(), entry.first.size() + 1);
+        append(keyValues, entry.second.c_str(), entry.second.size() + 1);
+        pad(keyValues, 4);
+    }
+
+    size_t levelIndexOffset = sizeof(identifier) + sizeof(KtxHeader);
+    header.dfdByteOffset = (uint32_t)(levelIndexOffset + image.numLevels * sizeof(KtxLevel));
+    header.dfdByteLength = sizeof(dfd);
+    header.kvdByteOffset = header.dfdByteOffset + header.dfdByteLength;
+    header.kvdByteLength = (uint32_t)keyValues.size();
+
+    vector<unsigned char> out;
+    append(out, identifier, sizeof(identifier));
+    append(out, &header, sizeof(header));
+    out.resize(header.dfdByteOffset, 0);
+    append(out, dfd, sizeof(dfd));
+    append(out, keyValues.data(), keyValues.size());
+
+    vector<KtxLevel> levels(image.numLevels);
+    for(int level = image.numLevels - 1; level >= 0; level--)
+    {
+        pad(out, blockBytes);
+        levels[level].byteOffset = out.size();
+        for(int face = 0; face < image.numFaces; face++)
+        {
+            int entry = level * image.numFaces + face;
+            append(out, image.bytes + image.levelOffsets[entry], image.levelSizes[entry]);
+        }
+        levels[level].byteLength = out.size() - levels[level].byteOffset;
+        levels[level].uncompressedByteLength = levels[level].byteLength;
+    }
+    memcpy(&out[levelIndexOffset], levels.data(), levels.size() * sizeof(KtxLevel));
+
+    ofstream file(filePath, ios::binary);
+    file.write((const char*)out.data(), out.size());
+    if(!file)
+    {
+        cout << "Failed to write " << filePath << endl;
+        return false;
+    }
+    return true;
+}
+
+bool Ktx::load(const char *filePath, KtxImage& image)
+{
+    ifstream file(filePath, ios::binary | ios::ate);
+    if(!file)
+    {
+        return false;
+    }
+    size_t size = (size_t)file.tellg();
+    file.seekg(0);
+    image.data.resize(size);
+    if(!file.read((char*)image.data.data(), size))
+    {
+        cout << filePath << ": truncated KTX2 file" << endl;
+        return false;
+    }
+    return read(image.data.data(), size, filePath, image);
+}
+
+bool Ktx::read(const unsigned char *bytes, size_t size, const char *name, KtxImage& image)
+{
+    if(size < sizeof(identifier) + sizeof(KtxHeader))
+    {
+        cout << name << ": truncated KTX2 file" << endl;
+        return false;
+    }
+    image.bytes = bytes;
+    image.numBytes = size;
+
+    KtxHeader header;
+    memcpy(&header, bytes + sizeof(identifier), sizeof(header));
+    size_t levelIndexOffset = sizeof(identifier) + sizeof(KtxHeader);
+    if(memcmp(bytes, identifier, sizeof(identifier)) != 0 || header.vkFormat != vkFormatBC1
+        || header.pixelDepth > 1 || header.layerCount > 1 || (header.faceCount != 1 && header.faceCount != 6)
+        || (header.faceCount == 6 && header.pixelWidth != header.pixelHeight) || header.levelCount == 0
+        || header.supercompressionScheme != 0 || levelIndexOffset + header.levelCount * sizeof(KtxLevel) > size)
+    {
+        cout << name << ": not a BC1 KTX2 texture this loader reads" << endl;
+        return false;
+    }
+
+    image.width = header.pixelWidth;
+    image.height = header.pixelHeight;
+    image.numLevels = header.levelCount;
+    image.numFaces = header.faceCount;
+    image.levelOffsets.resize(image.numLevels * image.numFaces);
+    image.levelSizes.resize(image.numLevels * image.numFaces);
+    for(int level = 0; level < image.numLevels; level++)
+    {
+        KtxLevel entry;
+        memcpy(&entry, bytes + levelIndexOffset + level * sizeof(KtxLevel), sizeof(entry));
+        size_t faceSize = levelSize(max(1, image.width >> level), max(1, image.height >> level));
+        if(entry.byteLength != faceSize * image.numFaces || entry.byteOffset + entry.byteLength > size)
+        {
+            cout << name << ": bad level " << level << endl;
+            return false;
+        }
+        for(int face = 0; face < image.numFaces; face++)
+        {
+            image.levelOffsets[level * image.numFaces + face] = entry.byteOffset + face * faceSize;
+            image.levelSizes[level * image.numFaces + face] = faceSize;
+        }
+    }
+
+    image.hasAverageColor = false;
+    for(size_t offset = header.kvdByteOffset; offset + 4 <= (size_t)header.kvdByteOffset + header.kvdByteLength && offset + 4 <= size; )
+    {
+        uint32_t length;
+        memcpy(&length, bytes + offset, sizeof(length));
+        if(offset + 4 + length > size)
+        {
+            break;
+        }
+        const char *key = (const char*)bytes + offset + 4;
+        size_t keyLength = strnlen(key, length);
+        if(keyLength < length && strcmp(key, averageColorKey) == 0)
+        {
+            string value(key + keyLength + 1, length - keyLength - 1);
+            image.hasAverageColor = sscanf(value.c_str(), "%f %f %f", &image.averageColor[0], &image.averageColor[1],
+                &image.averageColor[2]) == 3;
+        }
+        offset += (4 + length + 3) / 4 * 4;
+    }
+    return true;
+}
@@ -0,0 +1,134 @@
+#include <cmath>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <sys/stat.h>
+#define STB_IMAGE_IMPLEMENTATION
+#include "../include/stb_image.h"
+#include "../include/Ktx.h"
+#include "../include/CubeMap.h"
+
+using namespace std;
+
+// Offline texture converter: writes a BC1 KTX2 file next to each image,
+// which TextureLoader and Utils::loadTexture then prefer over the image.
+//
+//   ktxconvert.exec [--skybox] image...
+//
+// Planet maps are flipped for OpenGL, resampled into a cubemap (see
+// CubeMap.h) and get a mip chain, as TextureLoader treats them; --skybox
+// marks cubemap faces, which are stored as they are.
+
+static double elapsedMs(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// Of level 0 against the source texels, its faces one after the other
+static double psnr(const unsigned char *texels, int channels, const KtxImage& image)
+{
+    int blocksX = (image.width + 3) / 4, blocksY = (image.height + 3) / 4;
+    double squaredError = 0.0;
+    for(int face = 0; face < image.numFaces; face++)
+    {
+        const unsigned char *blocks = &image.data[image.levelOffsets[face]];
+        const unsigned char *faceTexels = texels + (size_t)face * image.width * image.height * channels;
+        for(int by = 0; by < blocksY; by++)
+        {
+            for(int bx = 0; bx < blocksX; bx++)
+            {
+                unsigned char decoded[16][3];
+                Ktx::decodeBlock(blocks + ((size_t)by * blocksX + bx) * Ktx::blockBytes, decoded);
+                for(int i = 0; i < 16; i++)
+                {
+                    int x = 4 * bx + i % 4, y = 4 * by + i / 4;
+                    if(x >= image.width || y >= image.height)
+                    {
+                        continue;
+                    }
+                    for(int c = 0; c < 3; c++)
+                    {
+                        double d = decoded[i][c] - faceTexels[((size_t)y * image.width + x) * channels + (channels < 3 ? 0 : c)];
+                        squaredError += d * d;
+                    }
+                }
+            }
+        }
+    }
+    double meanError = squaredError / (3.0 * image.width * image.height * image.numFaces);
+    return meanError > 0.0 ? 10.0 * log10(255.0 * 255.0 / meanError) : INFINITY;
+}
+
+int main(int argc, char** argv)
+{
+    bool skybox = false;
+    int converted = 0, failed = 0;
+    for(int i = 1; i < argc; i++)
+    {
+        string path = argv[i];
+        if(path == "--skybox")
+        {
+            skybox = true;
+            continue;
+        }
+
+        auto start = chrono::steady_clock::now();
+        stbi_set_flip_vertically_on_load(!skybox);
+        int width, height, channels;
+        unsigned char *texels = stbi_load(path.c_str(), &width, &height, &channels, 0);
+        if(!texels)
+        {
+            cout << "Failed to load " << path << endl;
+            failed++;
+            continue;
+        }
+        double decodeMs = elapsedMs(start);
+
+        start = chrono::steady_clock::now();
+        KtxImage image;
+        vector<unsigned char> faces;
+        if(skybox)
+        {
+            Ktx::encode(texels, width, height, channels, false, image);
+        }
+        else
+        {
+            CubeMap::fromEquirectangular(texels, width, height, channels, CubeMap::faceSize(width), faces);
+            Ktx::encodeCubemap(faces.data(), CubeMap::faceSize(width), true, image);
+        }
+        double encodeMs = elapsedMs(start);
+
+        string cachePath = Ktx::cachePath(path);
+        if(!Ktx::save(cachePath.c_str(), image))
+        {
+            stbi_image_free(texels);
+            failed++;
+            continue;
+        }
+
+        struct stat info;
+        stat(path.c_str(), &info);
+        // PSNR of a cube is against its resampled faces, so it is the BC1 loss alone
+        size_t texels2d = (size_t)width * height;
+        size_t texelsCube = (size_t)image.numFaces * image.width * image.height;
+        cout << cachePath << ": " << width << "x" << height;
+        if(!skybox)
+        {
+            cout << " as 6x" << image.width << "x" << image.height << " (" << 100 * texelsCube / texels2d << "% of the texels)";
+        }
+        cout << ", " << image.numLevels << " levels, " << image.data.size() / 1024 << " KB (source " << info.st_size / 1024
+            << " KB, RGBA8 in VRAM " << texelsCube * 4 * (skybox ? 3 : 4) / 3 / 1024 << " KB), PSNR "
+            << psnr(skybox ? texels : faces.data(), skybox ? channels : 3, image) << " dB, decode " << decodeMs
+            << " ms, encode " << encodeMs << " ms" << endl;
+        stbi_image_free(texels);
+        converted++;
+    }
+
+    if(converted + failed == 0)
+    {
+        cout << "usage: ktxconvert.exec [--skybox] image..." << endl;
+        return EXIT_FAILURE;
+    }
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,256 @@
+#include <cmath>
+#include <cstring>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <charconv>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/MinorPlanets.h"
+
+using namespace std;
+
+// Last column of the semi-major axis, the last field read
+static const int minRecordLength = 103;
+
+static double elapsedMs(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// Number in a fixed-width field. Columns are 1-based and inclusive, as in
+// the MPC format description; blank fields read as 0.
+static float field(const char *line, int firstColumn, int lastColumn)
+{
+    const char *first = line + firstColumn - 1;
+    const char *last = line + lastColumn;
+    while(first < last && *first == ' ') first++;
+    float value = 0.0f;
+    from_chars(first, last, value);
+    return value;
+}
+
+// Length without the line break, and the start of the next line
+static const char* lineEnd(const char *line, const char *end, long& length)
+{
+    const char *next = (const char*)memchr(line, '\n', end - line);
+    next = next ? next + 1 : end;
+    length = next - line;
+    while(length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) length--;
+    return next;
+}
+
+// Numbers are right-aligned, so a record has a digit in the last column of
+// its semi-major axis; headers, separators and blank lines do not
+static bool isRecord(const char *line, long length)
+{
+    return length >= minRecordLength && line[minRecordLength - 1] >= '0' && line[minRecordLength - 1] <= '9';
+}
+
+void MinorPlanets::clear()
+{
+    semiMajorAxes.clear();
+    eccentricities.clear();
+    inclinations.clear();
+    ascendingNodes.clear();
+    periapsisArguments.clear();
+    meanAnomalies.clear();
+    absoluteMagnitudes.clear();
+}
+
+int MinorPlanets::size() {return (int)semiMajorAxes.size();}
+
+bool MinorPlanets::load(const char *filePath)
+{
+    struct stat info;
+    if(stat(filePath, &info) != 0)
+    {
+        cout << "Failed to open minor planets: " << filePath << endl;
+        return false;
+    }
+
+    // Nanoseconds, so a file rewritten within the same second still counts as changed
+    int64_t sourceTime = (int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+    string cachePath = string(filePath) + ".cache";
+    auto start = chrono::steady_clock::now();
+    if(loadCache(cachePath.c_str(), info.st_size, sourceTime))
+    {
+        cout << "Loaded " << size() << " minor planets from " << cachePath << " in " << elapsedMs(start) << " ms" << endl;
+        return true;
+    }
+
+    if(!importFile(filePath))
+    {
+        return false;
+    }
+    cout << "Imported " << size() << " minor planets from " << filePath << " in " << elapsedMs(start) << " ms" << endl;
+    saveCache(cachePath.c_str(), info.st_size, sourceTime);
+    return true;
+}
+
+// The file is mapped and split into chunks at line breaks. A first parallel
+// pass counts the records of every chunk, which gives each chunk its offset
+// in the arrays; the second parses straight into them.
+bool MinorPlanets::importFile(const char *filePath)
+{
+    clear();
+
+    int file = open(filePath, O_RDONLY);
+    if(file < 0)
+    {
+        cout << "Failed to open minor planets: " << filePath << endl;
+        return false;
+    }
+    struct stat info;
+    if(fstat(file, &info) != 0 || info.st_size == 0)
+    {
+        cout << filePath << ": empty minor planet file" << endl;
+        close(file);
+        return false;
+    }
+    void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if(mapping == MAP_FAILED)
+    {
+        cout << "Failed to map minor planets: " << filePath << endl;
+        return false;
+    }
+    madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+    const char *data = (const char*)mapping;
+    const char *end = data + info.st_size;
+
+    // MPCORB.DAT starts with a text header closed by a line of dashes
+    const char *begin = data;
+    long length;
+    for(const char *line = data; line < end && line < data + 65536; )
+    {
+        const char *next = lineEnd(line, end, length);
+        if(length >= 10 && strncmp(line, "----------", 10) == 0)
+        {
+            begin = next;
+            break;
+        }
+        line = next;
+    }
+
+    // Chunk c starts at the first line starting at or after its nominal offset
+    long numChunks = (end - begin + chunkBytes - 1) / chunkBytes;
+    vector<const char*> chunkStarts(numChunks + 1);
+    for(long c = 0; c < numChunks; c++)
+    {
+        const char *nominal = begin + c * chunkBytes;
+        const char *lineStart = c == 0 ? nominal : (const char*)memchr(nominal - 1, '\n', end - nominal + 1);
+        chunkStarts[c] = c == 0 ? nominal : (lineStart ? lineStart + 1 : end);
+    }
+    chunkStarts[numChunks] = end;
+
+    vector<int> chunkOffsets(numChunks + 1, 0);
+    #pragma omp parallel for schedule(dynamic)
+    for(long c = 0; c < numChunks; c++)
+    {
+        int count = 0;
+        long lineLength;
+        for(const char *line = chunkStarts[c]; line < chunkStarts[c + 1]; )
+        {
+            const char *next = lineEnd(line, end, lineLength);
+            count += isRecord(line, lineLength);
+            line = next;
+        }
+        chunkOffsets[c + 1] = count;
+    }
+    for(long c = 0; c < numChunks; c++)
+    {
+        chunkOffsets[c + 1] += chunkOffsets[c];
+    }
+
+    int count = chunkOffsets[numChunks];
+    semiMajorAxes.resize(count);
+    eccentricities.resize(count);
+    inclinations.resize(count);
+    ascendingNodes.resize(count);
+    periapsisArguments.resize(count);
+    meanAnomalies.resize(count);
+    absoluteMagnitudes.resize(count);
+
+    const float degrees = 3.14159265f / 180.0f;
+    #pragma omp parallel for schedule(dynamic)
+    for(long c = 0; c < numChunks; c++)
+    {
+        int i = chunkOffsets[c];
+        long lineLength;
+        for(const char *line = chunkStarts[c]; line < chunkStarts[c + 1]; )
+        {
+            const char *next = lineEnd(line, end, lineLength);
+            if(isRecord(line, lineLength))
+            {
+                absoluteMagnitudes[i] = field(line, 9, 13);
+                meanAnomalies[i] = field(line, 27, 35) * degrees;
+                periapsisArguments[i] = field(line, 38, 46) * degrees;
+                ascendingNodes[i] = field(line, 49, 57) * degrees;
+                inclinations[i] = field(line, 60, 68) * degrees;
+                eccentricities[i] = field(line, 71, 79);
+                semiMajorAxes[i] = field(line, 93, 103);
+                i++;
+            }
+            line = next;
+        }
+    }
+
+    munmap(mapping, info.st_size);
+    if(count == 0)
+    {
+        cout << filePath << ": no minor planet records" << endl;
+        return false;
+    }
+    return true;
+}
+
+bool MinorPlanets::loadCache(const char *cachePath, int64_t sourceSize, int64_t sourceTime)
+{
+    ifstream in(cachePath, ios::binary);
+    MinorPlanetsHeader header;
+    if(!in.read((char*)&header, sizeof(header)) || memcmp(header.magic, "MPC1", 4) != 0
+        || header.sourceSize != sourceSize || header.sourceTime != sourceTime || header.count <= 0)
+    {
+        return false;
+    }
+
+    vector<float>* arrays[] = { &semiMajorAxes, &eccentricities, &inclinations, &ascendingNodes, &periapsisArguments,
+        &meanAnomalies, &absoluteMagnitudes };
+    for(vector<float>* array : arrays)
+    {
+        array->resize(header.count);
+        if(!in.read((char*)array->data(), header.count * sizeof(float)))
+        {
+            cout << cachePath << ": truncated cache" << endl;
+            clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+void MinorPlanets::saveCache(const char *cachePath, int64_t sourceSize, int64_t sourceTime)
+{
+    ofstream out(cachePath, ios::binary);
+    MinorPlanetsHeader header;
+    memcpy(header.magic, "MPC1", 4);
+    header.count = size();
+    header.sourceSize = sourceSize;
+    header.sourceTime = sourceTime;
+    out.write((const char*)&header, sizeof(header));
+
+    const vector<float>* arrays[] = { &semiMajorAxes, &eccentricities, &inclinations, &ascendingNodes, &periapsisArguments,
+        &meanAnomalies, &absoluteMagnitudes };
+    for(const vector<float>* array : arrays)
+    {
+        out.write((const char*)array->data(), array->size() * sizeof(float));
+    }
+    if(!out)
+    {
+        cout << "Failed to write " << cachePath << endl;
+    }
+}
@@ -0,0 +1,700 @@
+#include <vector>
+#include <cmath>
+#include <chrono>
+#include <numeric>
+#include <algorithm>
+#include "../include/NBody.h"
+#include "../include/Kepler.h"
+#include "../include/Constants.h"
+
+using namespace std;
+
+static const int maxTreeDepth = 32;
+// Subtrees with fewer bodies than this are built inline rather than as jobs
+static const int taskThreshold = 4096;
+// Bodies per job in the per-body loops, and in the tree walk, whose bodies
+// cost far more
+static const int bodyGrain = 4096;
+static const int walkGrain = 256;
+// Direct-sum tiles: each job takes a block of targets and streams the
+// sources through in blocks small enough to stay in L1
+static const int targetTileSize = 64;
+static const int sourceTileSize = 1024;
+
+static double elapsedMs(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+NBody::NBody(JobSystem& jobs) : jobs(jobs), numNodes(0), initialEnergy(0.0), gravitationalConstant(Constants::gravitational_constant),
+    openingAngle(0.5), softening(0.01), leafSize(8), forceBackend(BARNES_HUT), blockTimesteps(false), maxLevel(12),
+    timestepAccuracy(0.01), stats()
+{
+}
+
+void NBody::clear()
+{
+    positionsX.clear(); positionsY.clear(); positionsZ.clear();
+    velocitiesX.clear(); velocitiesY.clear(); velocitiesZ.clear();
+    accelerationsX.clear(); accelerationsY.clear(); accelerationsZ.clear();
+    potentials.clear();
+    masses.clear();
+    levels.clear();
+}
+
+int NBody::addBody(double x, double y, double z, double vx, double vy, double vz, double mass)
+{
+    positionsX.push_back(x); positionsY.push_back(y); positionsZ.push_back(z);
+    velocitiesX.push_back(vx); velocitiesY.push_back(vy); velocitiesZ.push_back(vz);
+    accelerationsX.push_back(0.0); accelerationsY.push_back(0.0); accelerationsZ.push_back(0.0);
+    potentials.push_back(0.0);
+    masses.push_back(mass);
+    return (int)masses.size() - 1;
+}
+
+int NBody::getNumBodies() {return (int)masses.size();}
+
+// World-space state of every catalog body at the given time, with velocities
+// derived from the parents' masses. The total momentum is removed so the
+// system does not drift off screen.
+void NBody::initFromCatalog(BodyCatalog& catalog, double time)
+{
+    clear();
+
+    double momentum[3] = { 0.0, 0.0, 0.0 };
+    double totalMass = 0.0;
+    for(int i = 0; i < catalog.getNumBodies(); i++)
+    {
+        double position[3] = { 0.0, 0.0, 0.0 }, velocity[3] = { 0.0, 0.0, 0.0 };
+        int parent = catalog.parents[i];
+        if(parent >= 0)
+        {
+            double mu = gravitationalConstant * (catalog.masses[parent] + catalog.masses[i]);
+            Kepler::stateVector(catalog.orbits, i, time, mu, position, velocity);
+            position[0] += positionsX[parent]; position[1] += positionsY[parent]; position[2] += positionsZ[parent];
+            velocity[0] += velocitiesX[parent]; velocity[1] += velocitiesY[parent]; velocity[2] += velocitiesZ[parent];
+        }
+        addBody(position[0], position[1], position[2], velocity[0], velocity[1], velocity[2], catalog.masses[i]);
+
+        for(int k = 0; k < 3; k++) momentum[k] += catalog.masses[i] * velocity[k];
+        totalMass += catalog.masses[i];
+    }
+
+    if(totalMass > 0.0)
+    {
+        for(int i = 0; i < getNumBodies(); i++)
+        {
+            velocitiesX[i] -= momentum[0] / totalMass;
+            velocitiesY[i] -= momentum[1] / totalMass;
+            velocitiesZ[i] -= momentum[2] / totalMass;
+        }
+    }
+
+    start();
+}
+
+// Computes the initial forces and energy; call after the bodies are set up.
+void NBody::start()
+{
+    activeBodies.resize(getNumBodies());
+    iota(activeBodies.begin(), activeBodies.end(), 0);
+    if(forceBackend == BARNES_HUT)
+    {
+        buildTree();
+    }
+    computeForces();
+    initialEnergy = totalEnergy();
+    stats.numBodies = getNumBodies();
+    stats.energy = initialEnergy;
+    stats.energyDrift = 0.0;
+}
+
+void NBody::buildTree()
+{
+    int numBodies = getNumBodies();
+    if(numBodies == 0)
+    {
+        numNodes = 0;
+        return;
+    }
+
+    // Bounds of each job's range, then of all of them
+    int numRanges = (numBodies + bodyGrain - 1) / bodyGrain;
+    vector<double> bounds(6 * numRanges);
+    jobs.parallelFor(numBodies, bodyGrain, [&](int first, int last) {
+        double* range = &bounds[6 * (first / bodyGrain)];
+        range[0] = range[3] = positionsX[first];
+        range[1] = range[4] = positionsY[first];
+        range[2] = range[5] = positionsZ[first];
+        for(int i = first; i < last; i++)
+        {
+            range[0] = min(range[0], positionsX[i]); range[3] = max(range[3], positionsX[i]);
+            range[1] = min(range[1], positionsY[i]); range[4] = max(range[4], positionsY[i]);
+            range[2] = min(range[2], positionsZ[i]); range[5] = max(range[5], positionsZ[i]);
+        }
+    });
+    double minX = bounds[0], minY = bounds[1], minZ = bounds[2];
+    double maxX = bounds[3], maxY = bounds[4], maxZ = bounds[5];
+    for(int r = 1; r < numRanges; r++)
+    {
+        minX = min(minX, bounds[6 * r]); minY = min(minY, bounds[6 * r + 1]); minZ = min(minZ, bounds[6 * r + 2]);
+        maxX = max(maxX, bounds[6 * r + 3]); maxY = max(maxY, bounds[6 * r + 4]); maxZ = max(maxZ, bounds[6 * r + 5]);
+    }
+
+    // Cells claim their children from the node array, which keeps its size
+    // between steps. A build that runs out of it (numNodes counts every
+    // claim) is repeated with twice the room, so no cell stays a leaf for
+    // lack of nodes.
+    if(nodes.empty())
+    {
+        nodes.resize(1 + 8 * max(1, numBodies / leafSize));
+    }
+    bodyOrder.resize(numBodies);
+    orderScratch.resize(numBodies);
+    for(;;)
+    {
+        numNodes = 1;
+        iota(bodyOrder.begin(), bodyOrder.end(), 0);
+
+        OctreeNode& root = nodes[0];
+        root.centerX = 0.5 * (minX + maxX);
+        root.centerY = 0.5 * (minY + maxY);
+        root.centerZ = 0.5 * (minZ + maxZ);
+        root.halfSize = 0.5 * max(maxX - minX, max(maxY - minY, maxZ - minZ)) * 1.0001 + 1e-9;
+        root.firstBody = 0;
+        root.numBodies = numBodies;
+
+        buildNode(0, 0);
+
+        if(numNodes <= (int)nodes.size())
+        {
+            break;
+        }
+        nodes.resize(nodes.size() * 2);
+    }
+}
+
+int NBody::octantOf(const OctreeNode& cell, int body)
+{
+    return (positionsX[body] >= cell.centerX) | ((positionsY[body] >= cell.centerY) << 1) | ((positionsZ[body] >= cell.centerZ) << 2);
+}
+
+void NBody::buildNode(int node, int depth)
+{
+    OctreeNode& cell = nodes[node];
+    cell.firstChild = -1;
+
+    int first = -1;
+    if(cell.numBodies > leafSize && depth < maxTreeDepth)
+    {
+        first = numNodes.fetch_add(8);
+        if(first + 8 > (int)nodes.size())
+        {
+            first = -1;
+        }
+    }
+
+    if(first < 0)
+    {
+        double mass = 0.0, x = 0.0, y = 0.0, z = 0.0;
+        for(int k = cell.firstBody; k < cell.firstBody + cell.numBodies; k++)
+        {
+            int i = bodyOrder[k];
+            mass += masses[i];
+            x += masses[i] * positionsX[i];
+            y += masses[i] * positionsY[i];
+            z += masses[i] * positionsZ[i];
+        }
+        cell.mass = mass;
+        cell.massX = mass > 0.0 ? x / mass : cell.centerX;
+        cell.massY = mass > 0.0 ? y / mass : cell.centerY;
+        cell.massZ = mass > 0.0 ? z / mass : cell.centerZ;
+        return;
+    }
+
+    // Counting sort of this cell's bodies into octants, through the scratch
+    // range that mirrors the cell's own range
+    int counts[8] = { 0 };
+    int begin = cell.firstBody, end = cell.firstBody + cell.numBodies;
+    for(int k = begin; k < end; k++)
+    {
+        int i = bodyOrder[k];
+        counts[octantOf(cell, i)]++;
+        orderScratch[k] = i;
+    }
+
+    int offsets[8], cursor[8];
+    offsets[0] = begin;
+    for(int o = 1; o < 8; o++) offsets[o] = offsets[o - 1] + counts[o - 1];
+    copy(offsets, offsets + 8, cursor);
+
+    for(int k = begin; k < end; k++)
+    {
+        int i = orderScratch[k];
+        bodyOrder[cursor[octantOf(cell, i)]++] = i;
+    }
+
+    cell.firstChild = first;
+    double quarter = 0.5 * cell.halfSize;
+    JobCounter subtrees;
+    for(int o = 0; o < 8; o++)
+    {
+        OctreeNode& child = nodes[first + o];
+        child.centerX = cell.centerX + ((o & 1) ? quarter : -quarter);
+        child.centerY = cell.centerY + ((o & 2) ? quarter : -quarter);
+        child.centerZ = cell.centerZ + ((o & 4) ? quarter : -quarter);
+        child.halfSize = quarter;
+        child.firstBody = offsets[o];
+        child.numBodies = counts[o];
+
+        if(counts[o] > taskThreshold)
+        {
+            int child = first + o;
+            jobs.run([this, child, depth]() {buildNode(child, depth + 1);}, &subtrees);
+        }
+        else
+        {
+            buildNode(first + o, depth + 1);
+        }
+    }
+    jobs.wait(subtrees);
+
+    double mass = 0.0, x = 0.0, y = 0.0, z = 0.0;
+    for(int o = 0; o < 8; o++)
+    {
+        const OctreeNode& child = nodes[first + o];
+        mass += child.mass;
+        x += child.mass * child.massX;
+        y += child.mass * child.massY;
+        z += child.mass * child.massZ;
+    }
+    cell.mass = mass;
+    cell.massX = mass > 0.0 ? x / mass : cell.centerX;
+    cell.massY = mass > 0.0 ? y / mass : cell.centerY;
+    cell.massZ = mass > 0.0 ? z / mass : cell.centerZ;
+}
+
+// New accelerations and potentials for the bodies in activeBodies, against
+// all bodies.
+void NBody::computeForces()
+{
+    if(forceBackend == DIRECT)
+    {
+        computeForcesDirect();
+    }
+    else
+    {
+        computeForcesTree();
+    }
+}
+
+void NBody::computeForcesTree()
+{
+    int numActive = (int)activeBodies.size();
+    if(getNumBodies() == 0)
+    {
+        return;
+    }
+
+    const double theta2 = openingAngle * openingAngle;
+    const double eps2 = softening * softening;
+    const double G = gravitationalConstant;
+    vector<double> rangeInteractions((numActive + walkGrain - 1) / walkGrain, 0.0);
+
+    jobs.parallelFor(numActive, walkGrain, [&](int firstActive, int lastActive) {
+        for(int k = firstActive; k < lastActive; k++)
+        {
+            int i = activeBodies[k];
+            double xi = positionsX[i], yi = positionsY[i], zi = positionsZ[i];
+            double ax = 0.0, ay = 0.0, az = 0.0, phi = 0.0;
+            long count = 0;
+
+            int stack[8 * maxTreeDepth + 8];
+            int top = 0;
+            stack[top++] = 0;
+            while(top > 0)
+            {
+                const OctreeNode& cell = nodes[stack[--top]];
+                if(cell.mass <= 0.0)
+                {
+                    continue;
+                }
+
+                double dx = cell.massX - xi, dy = cell.massY - yi, dz = cell.massZ - zi;
+                double d2 = dx * dx + dy * dy + dz * dz;
+                double size = 2.0 * cell.halfSize;
+
+                if(cell.firstChild < 0)
+                {
+                    for(int k = cell.firstBody; k < cell.firstBody + cell.numBodies; k++)
+                    {
+                        int j = bodyOrder[k];
+                        if(j == i) continue;
+                        double bx = positionsX[j] - xi, by = positionsY[j] - yi, bz = positionsZ[j] - zi;
+                        double r2 = bx * bx + by * by + bz * bz + eps2;
+                        double invR = 1.0 / sqrt(r2);
+                        double f = G * masses[j] * invR;
+                        phi -= f;
+                        f *= invR * invR;
+                        ax += f * bx; ay += f * by; az += f * bz;
+                        count++;
+                    }
+                }
+                else if(size * size < theta2 * d2)
+                {
+                    double invR = 1.0 / sqrt(d2 + eps2);
+                    double f = G * cell.mass * invR;
+                    phi -= f;
+                    f *= invR * invR;
+                    ax += f * dx; ay += f * dy; az += f * dz;
+                    count++;
+                }
+                else
+                {
+                    for(int o = 0; o < 8; o++)
+                    {
+                        stack[top++] = cell.firstChild + o;
+                    }
+                }
+            }
+
+            accelerationsX[i] = ax;
+            accelerationsY[i] = ay;
+            accelerationsZ[i] = az;
+            potentials[i] = phi;
+            rangeInteractions[firstActive / walkGrain] += count;
+        }
+    });
+
+    double interactions = 0.0;
+    for(double count : rangeInteractions) interactions += count;
+    stats.interactions = interactions;
+}
+
+// Exact O(N^2) forces. Positions stay in double, but each source tile is
+// converted to float relative to the first body of the target tile, so the
+// SIMD inner loop runs entirely in float without losing the precision of
+// large coordinates. Per-tile float sums are added into double accelerations.
+void NBody::computeForcesDirect()
+{
+    int numBodies = getNumBodies();
+    int numActive = (int)activeBodies.size();
+    int numTargetTiles = (numActive + targetTileSize - 1) / targetTileSize;
+    const float eps2 = (float)(softening * softening);
+    const double G = gravitationalConstant;
+
+    jobs.parallelFor(numTargetTiles, 1, [&](int firstTile, int lastTile) {
+        vector<float> sourceX(sourceTileSize), sourceY(sourceTileSize), sourceZ(sourceTileSize), sourceMass(sourceTileSize);
+        float targetX[targetTileSize], targetY[targetTileSize], targetZ[targetTileSize];
+        double sumX[targetTileSize], sumY[targetTileSize], sumZ[targetTileSize], sumPhi[targetTileSize];
+
+        for(int tile = firstTile; tile < lastTile; tile++)
+        {
+            int first = tile * targetTileSize;
+            int count = min(targetTileSize, numActive - first);
+            const int* targets = &activeBodies[first];
+            double refX = positionsX[targets[0]], refY = positionsY[targets[0]], refZ = positionsZ[targets[0]];
+
+            for(int t = 0; t < count; t++)
+            {
+                targetX[t] = (float)(positionsX[targets[t]] - refX);
+                targetY[t] = (float)(positionsY[targets[t]] - refY);
+                targetZ[t] = (float)(positionsZ[targets[t]] - refZ);
+                sumX[t] = sumY[t] = sumZ[t] = sumPhi[t] = 0.0;
+            }
+
+            for(int sourceFirst = 0; sourceFirst < numBodies; sourceFirst += sourceTileSize)
+            {
+                int sourceCount = min(sourceTileSize, numBodies - sourceFirst);
+                for(int s = 0; s < sourceCount; s++)
+                {
+                    sourceX[s] = (float)(positionsX[sourceFirst + s] - refX);
+                    sourceY[s] = (float)(positionsY[sourceFirst + s] - refY);
+                    sourceZ[s] = (float)(positionsZ[sourceFirst + s] - refZ);
+                    sourceMass[s] = (float)masses[sourceFirst + s];
+                }
+
+                const float* sx = &sourceX[0];
+                const float* sy = &sourceY[0];
+                const float* sz = &sourceZ[0];
+                const float* sm = &sourceMass[0];
+                for(int t = 0; t < count; t++)
+                {
+                    float xi = targetX[t], yi = targetY[t], zi = targetZ[t];
+                    float ax = 0.0f, ay = 0.0f, az = 0.0f, phi = 0.0f;
+
+                    #pragma omp simd reduction(+:ax, ay, az, phi)
+                    for(int s = 0; s < sourceCount; s++)
+                    {
+                        float dx = sx[s] - xi, dy = sy[s] - yi, dz = sz[s] - zi;
+                        float r2 = dx * dx + dy * dy + dz * dz;
+                        // Skips the body itself (and exact duplicates)
+                        float invR = r2 > 0.0f ? 1.0f / sqrtf(r2 + eps2) : 0.0f;
+                        float mInvR = sm[s] * invR;
+                        float mInvR3 = mInvR * invR * invR;
+                        ax += mInvR3 * dx;
+                        ay += mInvR3 * dy;
+                        az += mInvR3 * dz;
+                        phi -= mInvR;
+                    }
+
+                    sumX[t] += ax; sumY[t] += ay; sumZ[t] += az; sumPhi[t] += phi;
+                }
+            }
+
+            for(int t = 0; t < count; t++)
+            {
+                accelerationsX[targets[t]] = G * sumX[t];
+                accelerationsY[targets[t]] = G * sumY[t];
+                accelerationsZ[targets[t]] = G * sumZ[t];
+                potentials[targets[t]] = G * sumPhi[t];
+            }
+        }
+    });
+
+    stats.interactions = (double)numActive * (numBodies - 1);
+}
+
+// One kick-drift-kick leapfrog step. Accelerations from the previous step
+// are reused for the first half kick.
+void NBody::step(double dt)
+{
+    if(blockTimesteps)
+    {
+        stepBlock(dt);
+        return;
+    }
+
+    auto stepStart = chrono::steady_clock::now();
+    int numBodies = getNumBodies();
+    double halfDt = 0.5 * dt;
+
+    if((int)activeBodies.size() != numBodies)
+    {
+        activeBodies.resize(numBodies);
+        iota(activeBodies.begin(), activeBodies.end(), 0);
+    }
+
+    jobs.parallelFor(numBodies, bodyGrain, [&](int first, int last) {
+        for(int i = first; i < last; i++)
+        {
+            velocitiesX[i] += halfDt * accelerationsX[i];
+            velocitiesY[i] += halfDt * accelerationsY[i];
+            velocitiesZ[i] += halfDt * accelerationsZ[i];
+            positionsX[i] += dt * velocitiesX[i];
+            positionsY[i] += dt * velocitiesY[i];
+            positionsZ[i] += dt * velocitiesZ[i];
+        }
+    });
+
+    auto start = chrono::steady_clock::now();
+    if(forceBackend == BARNES_HUT)
+    {
+        buildTree();
+    }
+    stats.buildMs = elapsedMs(start);
+
+    start = chrono::steady_clock::now();
+    computeForces();
+    stats.forceMs = elapsedMs(start);
+
+    jobs.parallelFor(numBodies, bodyGrain, [&](int first, int last) {
+        for(int i = first; i < last; i++)
+        {
+            velocitiesX[i] += halfDt * accelerationsX[i];
+            velocitiesY[i] += halfDt * accelerationsY[i];
+            velocitiesZ[i] += halfDt * accelerationsZ[i];
+        }
+    });
+
+    stats.numBodies = numBodies;
+    stats.substeps = 1;
+    stats.forceEvaluations = numBodies;
+    stats.deepestLevel = 0;
+    stats.energy = totalEnergy();
+    stats.energyDrift = initialEnergy != 0.0 ? fabs((stats.energy - initialEnergy) / initialEnergy) : 0.0;
+    stats.stepMs = elapsedMs(stepStart);
+}
+
+// Level of the step dt / 2^level (dt may be negative) that satisfies the criterion
+// eta * sqrt(|a| / |da/dt|), from squared acceleration and jerk.
+int NBody::levelFor(double dt, double a2, double j2)
+{
+    if(a2 <= 0.0 || j2 <= 0.0)
+    {
+        return 0;
+    }
+    double wanted = timestepAccuracy * sqrt(sqrt(a2 / j2));
+    if(wanted >= fabs(dt))
+    {
+        return 0;
+    }
+    return min((int)ceil(log2(fabs(dt) / wanted)), maxLevel);
+}
+
+// Hierarchical kick-drift-kick over one base step dt. Time advances in ticks
+// of dt / 2^maxLevel. Every substep drifts all bodies to the end of the
+// shortest step in use, then computes forces and kicks only the bodies whose
+// own step ends there. Inner orbits thus take many small steps while the
+// outer ones take few. All bodies are synchronized at the start and the end
+// of the call, so the energy is exact there.
+void NBody::stepBlock(double dt)
+{
+    // Nothing to do while paused, and the jerk estimate divides by the step
+    if(dt == 0.0)
+    {
+        return;
+    }
+
+    auto stepStart = chrono::steady_clock::now();
+    int numBodies = getNumBodies();
+    const int numTicks = 1 << maxLevel;
+    const double tickDt = dt / numTicks;
+
+    if((int)levels.size() != numBodies)
+    {
+        // No force history yet; a circular orbit has |da/dt| = |a|^2 / |v|
+        levels.resize(numBodies);
+        for(int i = 0; i < numBodies; i++)
+        {
+            double a2 = accelerationsX[i] * accelerationsX[i] + accelerationsY[i] * accelerationsY[i] + accelerationsZ[i] * accelerationsZ[i];
+            double v2 = velocitiesX[i] * velocitiesX[i] + velocitiesY[i] * velocitiesY[i] + velocitiesZ[i] * velocitiesZ[i];
+            levels[i] = levelFor(dt, a2, v2 > 0.0 ? a2 * a2 / v2 : 0.0);
+        }
+    }
+    for(int i = 0; i < numBodies; i++)
+    {
+        levels[i] = min(levels[i], maxLevel);
+    }
+
+    vector<int> levelCounts(maxLevel + 1, 0);
+    for(int i = 0; i < numBodies; i++) levelCounts[levels[i]]++;
+
+    jobs.parallelFor(numBodies, bodyGrain, [&](int first, int last) {
+        for(int i = first; i < last; i++)
+        {
+            double halfStep = 0.5 * tickDt * (numTicks >> levels[i]);
+            velocitiesX[i] += halfStep * accelerationsX[i];
+            velocitiesY[i] += halfStep * accelerationsY[i];
+            velocitiesZ[i] += halfStep * accelerationsZ[i];
+        }
+    });
+
+    double buildMs = 0.0, forceMs = 0.0, interactions = 0.0, forceEvaluations = 0.0;
+    int substeps = 0, deepestLevel = 0;
+    int tick = 0;
+    while(tick < numTicks)
+    {
+        int deepest = maxLevel;
+        while(deepest > 0 && levelCounts[deepest] == 0) deepest--;
+        deepestLevel = max(deepestLevel, deepest);
+        int ticks = numTicks >> deepest;
+        double drift = ticks * tickDt;
+
+        jobs.parallelFor(numBodies, bodyGrain, [&](int first, int last) {
+            for(int i = first; i < last; i++)
+            {
+                positionsX[i] += drift * velocitiesX[i];
+                positionsY[i] += drift * velocitiesY[i];
+                positionsZ[i] += drift * velocitiesZ[i];
+            }
+        });
+        tick += ticks;
+
+        activeBodies.clear();
+        for(int i = 0; i < numBodies; i++)
+        {
+            if(tick % (numTicks >> levels[i]) == 0)
+            {
+                activeBodies.push_back(i);
+            }
+        }
+        int numActive = (int)activeBodies.size();
+
+        previousX.resize(numActive); previousY.resize(numActive); previousZ.resize(numActive);
+        for(int k = 0; k < numActive; k++)
+        {
+            int i = activeBodies[k];
+            previousX[k] = accelerationsX[i]; previousY[k] = accelerationsY[i]; previousZ[k] = accelerationsZ[i];
+        }
+
+        auto start = chrono::steady_clock::now();
+        if(forceBackend == BARNES_HUT)
+        {
+            buildTree();
+        }
+        buildMs += elapsedMs(start);
+
+        start = chrono::steady_clock::now();
+        computeForces();
+        forceMs += elapsedMs(start);
+        interactions += stats.interactions;
+        forceEvaluations += numActive;
+        substeps++;
+
+        jobs.parallelFor(numActive, bodyGrain, [&](int firstActive, int lastActive) {
+            for(int k = firstActive; k < lastActive; k++)
+            {
+                int i = activeBodies[k];
+                double stepDt = tickDt * (numTicks >> levels[i]);
+                velocitiesX[i] += 0.5 * stepDt * accelerationsX[i];
+                velocitiesY[i] += 0.5 * stepDt * accelerationsY[i];
+                velocitiesZ[i] += 0.5 * stepDt * accelerationsZ[i];
+
+                double jx = (accelerationsX[i] - previousX[k]) / stepDt;
+                double jy = (accelerationsY[i] - previousY[k]) / stepDt;
+                double jz = (accelerationsZ[i] - previousZ[k]) / stepDt;
+                double a2 = accelerationsX[i] * accelerationsX[i] + accelerationsY[i] * accelerationsY[i] + accelerationsZ[i] * accelerationsZ[i];
+                int level = levelFor(dt, a2, jx * jx + jy * jy + jz * jz);
+                // A longer step has to start on one of its own boundaries
+                while(level < levels[i] && tick % (numTicks >> level) != 0) level++;
+                levels[i] = level;
+
+                // The last half kick of the call is left to the next one
+                if(tick < numTicks)
+                {
+                    double halfStep = 0.5 * tickDt * (numTicks >> level);
+                    velocitiesX[i] += halfStep * accelerationsX[i];
+                    velocitiesY[i] += halfStep * accelerationsY[i];
+                    velocitiesZ[i] += halfStep * accelerationsZ[i];
+                }
+            }
+        });
+
+        fill(levelCounts.begin(), levelCounts.end(), 0);
+        for(int i = 0; i < numBodies; i++) levelCounts[levels[i]]++;
+    }
+
+    stats.numBodies = numBodies;
+    stats.buildMs = buildMs;
+    stats.forceMs = forceMs;
+    stats.interactions = interactions;
+    stats.substeps = substeps;
+    stats.forceEvaluations = forceEvaluations;
+    stats.deepestLevel = deepestLevel;
+    stats.energy = totalEnergy();
+    stats.energyDrift = initialEnergy != 0.0 ? fabs((stats.energy - initialEnergy) / initialEnergy) : 0.0;
+    stats.stepMs = elapsedMs(stepStart);
+}
+
+// Kinetic plus potential energy, using the potentials from the last force
+// evaluation.
+double NBody::totalEnergy()
+{
+    int numBodies = getNumBodies();
+    vector<double> rangeEnergies((numBodies + bodyGrain - 1) / bodyGrain, 0.0);
+
+    jobs.parallelFor(numBodies, bodyGrain, [&](int first, int last) {
+        double energy = 0.0;
+        for(int i = first; i < last; i++)
+        {
+            double v2 = velocitiesX[i] * velocitiesX[i] + velocitiesY[i] * velocitiesY[i] + velocitiesZ[i] * velocitiesZ[i];
+            energy += 0.5 * masses[i] * v2 + 0.5 * masses[i] * potentials[i];
+        }
+        rangeEnergies[first / bodyGrain] = energy;
+    });
+
+    double energy = 0.0;
+    for(double rangeEnergy : rangeEnergies) energy += rangeEnergy;
+    return energy;
+}
@@ -0,0 +1,47 @@
+#include <string>
+#include <vector>
+#include <iostream>
+#include "../include/AssetPack.h"
+#include "../include/Ktx.h"
+
+using namespace std;
+
+// Asset packer: writes the given files into one pack that main maps at
+// startup in place of the loose files.
+//
+//   packassets.exec pack file...
+//
+// An image with a current KTX2 cache (see ktxconvert) takes the cache along,
+// so the packed textures load compressed too.
+
+int main(int argc, char** argv)
+{
+    if(argc < 3)
+    {
+        cout << "usage: packassets.exec pack file..." << endl;
+        return EXIT_FAILURE;
+    }
+
+    vector<string> paths;
+    for(int i = 2; i < argc; i++)
+    {
+        string path = argv[i];
+        paths.push_back(path);
+        if(path.size() > 4 && path.compare(path.size() - 4, 4, ".jpg") == 0 && Ktx::isCurrent(path))
+        {
+            paths.push_back(Ktx::cachePath(path));
+        }
+    }
+    if(!AssetPack::write(argv[1], paths))
+    {
+        return EXIT_FAILURE;
+    }
+
+    AssetPack pack;
+    if(!pack.open(argv[1]))
+    {
+        return EXIT_FAILURE;
+    }
+    cout << argv[1] << ": " << pack.size() << " files" << endl;
+    return EXIT_SUCCESS;
+}
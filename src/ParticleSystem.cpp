@@ -0,0 +1,392 @@
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "../include/ParticleSystem.h"
+#include "../include/Utils.h"
+#include "../include/FastMath.h"
+
+using namespace std;
+
+// Belt constants in the layout of the shaders' Belt struct
+struct GpuBelt
+{
+    glm::vec4 radii;  // inner radius, outer radius, max eccentricity, max inclination
+    glm::vec4 sizes;  // min size, max size, gravitational parameter, logarithmic radii
+    glm::vec4 color;
+    glm::mat4 plane;
+};
+
+static float random01()
+{
+    return rand() / (float)RAND_MAX;
+}
+
+// As GLSL's packUnorm2x16: the first value in the low half
+static GLuint packUnorm2x16(float low, float high)
+{
+    GLuint x = (GLuint)(fmin(fmax(low, 0.0f), 1.0f) * 65535.0f + 0.5f);
+    GLuint y = (GLuint)(fmin(fmax(high, 0.0f), 1.0f) * 65535.0f + 0.5f);
+    return x | (y << 16);
+}
+
+static GLuint packUnorm8(float value)
+{
+    return (GLuint)(fmin(fmax(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+ParticleSystem::ParticleSystem() : computeProgram(0), pointProgram(0), rockProgram(0), particleBuffer(0), beltBuffer(0),
+    commandBuffer(0), rockBuffer(0), pointBuffer(0), readbackBuffer(0), readbackFence(0), rockVAO(0), rockVBO(0),
+    pointVAO(0), numParticles(0), numRockVertices(0), rocks(0), points(0), frame(0), computeMs(0.0), rockThreshold(6.0f)
+{
+    queries[0] = queries[1] = 0;
+}
+
+int ParticleSystem::getNumParticles() {return numParticles;}
+
+// Each particle is four words:
+//   semi-major axis (between the radii) and eccentricity, unorm16 each
+//   ascending node and argument of periapsis, unorm16 fractions of a turn
+//   mean anomaly at time 0 (fraction of a turn) and inclination, unorm16
+//   size, shade, belt index and rock variant, one byte each
+int ParticleSystem::addBelt(const ParticleBelt& belt, int count)
+{
+    if((int)belts.size() == maxBelts)
+    {
+        cout << "ParticleSystem: at most " << maxBelts << " belts" << endl;
+        return -1;
+    }
+
+    GLuint index = (GLuint)belts.size();
+    belts.push_back(belt);
+    belts.back().first = numParticles;
+    belts.back().count = count;
+
+    packed.reserve(packed.size() + 4 * (size_t)count);
+    for(int i = 0; i < count; i++)
+    {
+        float radius = random01();
+        float eccentricity = random01();
+        float node = random01(), periapsis = random01(), anomaly = random01();
+        // Triangular around the belt plane, so most particles stay near it
+        float inclination = 0.5f * (random01() + random01());
+        // Many small particles and few large ones
+        float size = pow(random01(), 4.0f);
+        float shade = 0.6f + 0.4f * random01();
+        GLuint variant = rand() & 255;
+
+        packed.push_back(packUnorm2x16(radius, eccentricity));
+        packed.push_back(packUnorm2x16(node, periapsis));
+        packed.push_back(packUnorm2x16(anomaly, inclination));
+        packed.push_back(packUnorm8(size) | packUnorm8(shade) << 8 | index << 16 | variant << 24);
+    }
+    numParticles += count;
+    return (int)index;
+}
+
+// Real orbits in the same four words. Semi-major axes span hundreds of AU,
+// so they are spaced logarithmically, which keeps the main belt to a few
+// thousandths of an AU; inclinations cover the full half turn. Sizes follow
+// the diameter implied by H relative to the largest body, so a few large
+// asteroids stand out of the swarm. Mean anomalies are at the file's epoch,
+// taken as time 0.
+int ParticleSystem::addPopulation(const ParticleBelt& belt, MinorPlanets& planets, float auScale)
+{
+    const float maxEccentricity = 0.99f;
+    const float pi = 3.14159265f;
+    const float twoPi = 2.0f * pi;
+
+    float minA = INFINITY, maxA = 0.0f, minH = INFINITY;
+    int count = 0;
+    for(int i = 0; i < planets.size(); i++)
+    {
+        float a = planets.semiMajorAxes[i];
+        if(a > 0.0f && planets.eccentricities[i] < maxEccentricity)
+        {
+            minA = fmin(minA, a);
+            maxA = fmax(maxA, a);
+            minH = fmin(minH, planets.absoluteMagnitudes[i]);
+            count++;
+        }
+    }
+    if(count == 0)
+    {
+        cout << "ParticleSystem: no bound orbits among " << planets.size() << " minor planets" << endl;
+        return -1;
+    }
+
+    ParticleBelt population = belt;
+    population.innerRadius = minA * auScale;
+    population.outerRadius = fmax(maxA, minA * 1.001f) * auScale;
+    population.maxEccentricity = maxEccentricity;
+    population.maxInclination = pi;
+    population.logRadius = true;
+    int index = addBelt(population, 0);
+    if(index < 0)
+    {
+        return -1;
+    }
+
+    float logRange = log(population.outerRadius / population.innerRadius);
+    packed.reserve(packed.size() + 4 * (size_t)count);
+    for(int i = 0; i < planets.size(); i++)
+    {
+        float a = planets.semiMajorAxes[i];
+        if(!(a > 0.0f && planets.eccentricities[i] < maxEccentricity))
+        {
+            continue;
+        }
+        float radius = log(a * auScale / population.innerRadius) / logRange;
+        float eccentricity = planets.eccentricities[i] / maxEccentricity;
+        float node = planets.ascendingNodes[i] / twoPi;
+        float periapsis = planets.periapsisArguments[i] / twoPi;
+        float anomaly = planets.meanAnomalies[i] / twoPi;
+        node -= floor(node);
+        periapsis -= floor(periapsis);
+        anomaly -= floor(anomaly);
+        float inclination = 0.5f + 0.5f * planets.inclinations[i] / pi;
+        // Diameter goes with 10^(-H/5) at a fixed albedo
+        float size = pow(10.0f, -0.2f * (planets.absoluteMagnitudes[i] - minH));
+        float shade = 0.6f + 0.4f * random01();
+        GLuint variant = rand() & 255;
+
+        packed.push_back(packUnorm2x16(radius, eccentricity));
+        packed.push_back(packUnorm2x16(node, periapsis));
+        packed.push_back(packUnorm2x16(anomaly, inclination));
+        packed.push_back(packUnorm8(size) | packUnorm8(shade) << 8 | (GLuint)index << 16 | variant << 24);
+    }
+    belts[index].count = count;
+    numParticles += count;
+    return index;
+}
+
+// Icosahedron with one normal per face, so rocks look faceted
+void ParticleSystem::createRockMesh()
+{
+    const float t = 1.618034f;
+    const float corners[12][3] = {
+        { -1, t, 0 }, { 1, t, 0 }, { -1, -t, 0 }, { 1, -t, 0 },
+        { 0, -1, t }, { 0, 1, t }, { 0, -1, -t }, { 0, 1, -t },
+        { t, 0, -1 }, { t, 0, 1 }, { -t, 0, -1 }, { -t, 0, 1 }
+    };
+    const int faces[20][3] = {
+        { 0, 11, 5 }, { 0, 5, 1 }, { 0, 1, 7 }, { 0, 7, 10 }, { 0, 10, 11 },
+        { 1, 5, 9 }, { 5, 11, 4 }, { 11, 10, 2 }, { 10, 7, 6 }, { 7, 1, 8 },
+        { 3, 9, 4 }, { 3, 4, 2 }, { 3, 2, 6 }, { 3, 6, 8 }, { 3, 8, 9 },
+        { 4, 9, 5 }, { 2, 4, 11 }, { 6, 2, 10 }, { 8, 6, 7 }, { 9, 8, 1 }
+    };
+
+    // Position (3), normal (3)
+    vector<float> values;
+    for(int f = 0; f < 20; f++)
+    {
+        glm::vec3 v[3];
+        for(int k = 0; k < 3; k++)
+        {
+            const float* corner = corners[faces[f][k]];
+            v[k] = glm::normalize(glm::vec3(corner[0], corner[1], corner[2]));
+        }
+        glm::vec3 normal = glm::normalize(glm::cross(v[1] - v[0], v[2] - v[0]));
+        for(int k = 0; k < 3; k++)
+        {
+            values.push_back(v[k].x); values.push_back(v[k].y); values.push_back(v[k].z);
+            values.push_back(normal.x); values.push_back(normal.y); values.push_back(normal.z);
+        }
+    }
+    numRockVertices = (int)values.size() / 6;
+
+    glGenVertexArrays(1, &rockVAO);
+    glGenBuffers(1, &rockVBO);
+    glBindVertexArray(rockVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, rockVBO);
+    glBufferData(GL_ARRAY_BUFFER, values.size() * sizeof(float), &values[0], GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+    glBindVertexArray(0);
+}
+
+void ParticleSystem::upload()
+{
+    computeProgram = Utils::createComputeProgram("./shaders/compShader_Particles.glsl");
+    pointProgram = Utils::createShaderProgram("./shaders/vertShader_Particle.glsl", "./shaders/fragShader_Sprite.glsl");
+    rockProgram = Utils::createShaderProgram("./shaders/vertShader_Rock.glsl", "./shaders/fragShader_Rock.glsl");
+
+    vector<GpuBelt> values(belts.size());
+    for(size_t b = 0; b < belts.size(); b++)
+    {
+        const ParticleBelt& belt = belts[b];
+        values[b].radii = glm::vec4(belt.innerRadius, belt.outerRadius, belt.maxEccentricity, belt.maxInclination);
+        values[b].sizes = glm::vec4(belt.minSize, belt.maxSize, (float)belt.mu, belt.logRadius ? 1.0f : 0.0f);
+        values[b].color = glm::vec4(belt.color, 1.0f);
+        values[b].plane = glm::rotate(glm::mat4(1.0f), belt.tilt, glm::vec3(1.0f, 0.0f, 0.0f));
+    }
+
+    // Rocks and points each get room for every particle, the worst case of
+    // the compute pass's appends
+    GLsizeiptr visibleBytes = (GLsizeiptr)numParticles * 4 * sizeof(GLuint);
+    glGenBuffers(1, &particleBuffer);
+    glGenBuffers(1, &beltBuffer);
+    glGenBuffers(1, &commandBuffer);
+    glGenBuffers(1, &rockBuffer);
+    glGenBuffers(1, &pointBuffer);
+    glGenBuffers(1, &readbackBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, packed.size() * sizeof(GLuint), packed.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, beltBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, values.size() * sizeof(GpuBelt), values.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, rockBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, visibleBytes, NULL, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, pointBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, visibleBytes, NULL, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, 2 * sizeof(DrawCommand), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, readbackBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, 2 * sizeof(DrawCommand), NULL, GL_STREAM_READ);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glGenQueries(2, queries);
+
+    createRockMesh();
+    // Points are fetched from the storage buffer by gl_VertexID, but a
+    // vertex array still has to be bound
+    glGenVertexArrays(1, &pointVAO);
+
+    cout << "Particles: " << numParticles << " in " << belts.size() << " belts, "
+        << packed.size() * sizeof(GLuint) / (1024.0 * 1024.0) << " MB" << endl;
+    packed.clear();
+    packed.shrink_to_fit();
+}
+
+void ParticleSystem::update(double time, const glm::mat4& vMat, const glm::mat4& pMat, float pixelScale,
+    const vector<glm::vec3>& centers)
+{
+    if(numParticles == 0)
+    {
+        return;
+    }
+
+    // The counts of an earlier frame, once the GPU has copied them
+    if(readbackFence)
+    {
+        GLenum status = glClientWaitSync(readbackFence, 0, 0);
+        if(status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+        {
+            glDeleteSync(readbackFence);
+            readbackFence = 0;
+            glBindBuffer(GL_COPY_READ_BUFFER, readbackBuffer);
+            const DrawCommand *counts = (const DrawCommand*)glMapBufferRange(GL_COPY_READ_BUFFER, 0,
+                2 * sizeof(DrawCommand), GL_MAP_READ_BIT);
+            if(counts)
+            {
+                points = counts[0].count;
+                rocks = counts[1].instanceCount;
+                glUnmapBuffer(GL_COPY_READ_BUFFER);
+            }
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        }
+    }
+
+    // Empty lists: points are one instance of count vertices, rocks
+    // instanceCount instances of the mesh
+    DrawCommand commands[2] = { { 0, 1, 0, 0 }, { (GLuint)numRockVertices, 0, 0, 0 } };
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(commands), commands);
+
+    // The pass is timed with two alternating queries; the one issued two
+    // frames ago has normally finished, so reading it does not stall
+    GLuint query = queries[frame % 2];
+    if(frame >= 2)
+    {
+        GLint available = 0;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if(available)
+        {
+            GLuint64 elapsedNs = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsedNs);
+            computeMs = elapsedNs * 1e-6;
+        }
+    }
+    frame++;
+
+    vector<glm::vec3> viewCenters(belts.size());
+    for(size_t b = 0; b < belts.size(); b++)
+    {
+        viewCenters[b] = glm::vec3(vMat * glm::vec4(centers[b], 1.0f));
+    }
+
+    glBeginQuery(GL_TIME_ELAPSED, query);
+    glUseProgram(computeProgram);
+    glUniform1d(glGetUniformLocation(computeProgram, "time"), time);
+    glUniformMatrix4fv(glGetUniformLocation(computeProgram, "v_matrix"), 1, GL_FALSE, glm::value_ptr(vMat));
+    glUniformMatrix4fv(glGetUniformLocation(computeProgram, "proj_matrix"), 1, GL_FALSE, glm::value_ptr(pMat));
+    glUniform3fv(glGetUniformLocation(computeProgram, "belt_centers"), (GLsizei)viewCenters.size(), &viewCenters[0].x);
+    glUniform1i(glGetUniformLocation(computeProgram, "num_particles"), numParticles);
+    glUniform1f(glGetUniformLocation(computeProgram, "pixel_scale"), pixelScale);
+    glUniform1f(glGetUniformLocation(computeProgram, "rock_threshold"), rockThreshold);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, particleBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, beltBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, commandBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, rockBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, pointBuffer);
+    glDispatchCompute((numParticles + groupSize - 1) / groupSize, 1, 1);
+    glEndQuery(GL_TIME_ELAPSED);
+
+    // The lists are read as storage, their counts as draw commands and by
+    // the copy
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    // Copied on the GPU for the stats once the previous copy is read
+    if(!readbackFence)
+    {
+        glBindBuffer(GL_COPY_READ_BUFFER, commandBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, readbackBuffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, 2 * sizeof(DrawCommand));
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        readbackFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+}
+
+void ParticleSystem::draw(double time, const glm::mat4& vMat, const glm::mat4& pMat, float pixelScale)
+{
+    if(numParticles == 0)
+    {
+        return;
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+
+    // Rock tumbling rates are whole multiples of the spin, so the wrapped
+    // angle does not jump
+    glUseProgram(rockProgram);
+    glUniformMatrix4fv(glGetUniformLocation(rockProgram, "v_matrix"), 1, GL_FALSE, glm::value_ptr(vMat));
+    glUniformMatrix4fv(glGetUniformLocation(rockProgram, "proj_matrix"), 1, GL_FALSE, glm::value_ptr(pMat));
+    glUniform1f(glGetUniformLocation(rockProgram, "spin"), (float)FastMath::wrapAngle(time));
+    glUniform3fv(glGetUniformLocation(rockProgram, "light_position"), 1, glm::value_ptr(glm::vec3(vMat[3])));
+    glBindVertexArray(rockVAO);
+    glDrawArraysIndirect(GL_TRIANGLES, (void*)sizeof(DrawCommand));
+
+    // Points blend over everything and must not hide each other
+    glUseProgram(pointProgram);
+    glUniformMatrix4fv(glGetUniformLocation(pointProgram, "proj_matrix"), 1, GL_FALSE, glm::value_ptr(pMat));
+    glUniform1f(glGetUniformLocation(pointProgram, "pixel_scale"), pixelScale);
+    glBindVertexArray(pointVAO);
+    glDepthMask(GL_FALSE);
+    glDrawArraysIndirect(GL_POINTS, (void*)0);
+    glDepthMask(GL_TRUE);
+    glBindVertexArray(0);
+}
+
+ParticleStats ParticleSystem::collectStats()
+{
+    ParticleStats stats = ParticleStats();
+    stats.numParticles = numParticles;
+    stats.computeMs = computeMs;
+    stats.particlesPerMs = computeMs > 0.0 ? numParticles / computeMs : 0.0;
+    stats.points = points;
+    stats.rocks = rocks;
+    return stats;
+}
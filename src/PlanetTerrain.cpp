@@ -0,0 +1,514 @@
+#include <cmath>
+#include <cfloat>
+#include <climits>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+#include <glm/gtc/constants.hpp>
+#include "../include/PlanetTerrain.h"
+#include "../include/stb_image.h"
+
+using namespace std;
+
+// Cube faces as center, then the directions of a chunk's x and y; the two
+// cross to the center, so the grid is counter-clockwise seen from outside
+static const glm::vec3 faceAxes[6][3] =
+{
+    { glm::vec3(1, 0, 0), glm::vec3(0, 0, -1), glm::vec3(0, 1, 0) },
+    { glm::vec3(-1, 0, 0), glm::vec3(0, 0, 1), glm::vec3(0, 1, 0) },
+    { glm::vec3(0, 1, 0), glm::vec3(1, 0, 0), glm::vec3(0, 0, -1) },
+    { glm::vec3(0, -1, 0), glm::vec3(1, 0, 0), glm::vec3(0, 0, 1) },
+    { glm::vec3(0, 0, 1), glm::vec3(1, 0, 0), glm::vec3(0, 1, 0) },
+    { glm::vec3(0, 0, -1), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0) }
+};
+
+// Relief: fractal value noise over the sphere, evaluated per point so that
+// every level samples the same surface
+static const int noiseOctaves = 10;
+static const float noiseFrequency = 4.0f;
+static const float heightmapWeight = 0.7f;     // share of a loaded heightmap
+
+static float lattice(int x, int y, int z)
+{
+    uint32_t h = (uint32_t)x * 374761393u + (uint32_t)y * 668265263u + (uint32_t)z * 2246822519u;
+    h = (h ^ (h >> 13)) * 1274126177u;
+    return (float)((h ^ (h >> 16)) & 0xffffff) / (float)0xffffff;
+}
+
+static float valueNoise(const glm::vec3& p)
+{
+    glm::vec3 cell = glm::floor(p);
+    glm::vec3 f = p - cell;
+    f = f * f * (3.0f - 2.0f * f);
+    int x = (int)cell.x, y = (int)cell.y, z = (int)cell.z;
+    float x00 = glm::mix(lattice(x, y, z), lattice(x + 1, y, z), f.x);
+    float x10 = glm::mix(lattice(x, y + 1, z), lattice(x + 1, y + 1, z), f.x);
+    float x01 = glm::mix(lattice(x, y, z + 1), lattice(x + 1, y, z + 1), f.x);
+    float x11 = glm::mix(lattice(x, y + 1, z + 1), lattice(x + 1, y + 1, z + 1), f.x);
+    return glm::mix(glm::mix(x00, x10, f.y), glm::mix(x01, x11, f.y), f.z);
+}
+
+PlanetTerrain::PlanetTerrain(JobSystem& jobs) : jobs(jobs), heightmapWidth(0), heightmapHeight(0), frame(0),
+    heightTexture(0), gridVao(0), gridVbo(0), gridIbo(0), chunkBuffer(0), numGridIndices(0), numGenerated(0),
+    numEvicted(0), deepestLevel(0), selectMs(0.0), heightScale(0.01f), lodFactor(3.0f) {}
+
+// GL objects need the context, which is gone by now; only the jobs are left
+PlanetTerrain::~PlanetTerrain()
+{
+    jobs.wait(generation);
+}
+
+bool PlanetTerrain::loadHeightmap(const char *filePath)
+{
+    int width, height, channels;
+    stbi_set_flip_vertically_on_load_thread(false);
+    unsigned short *texels = stbi_load_16(filePath, &width, &height, &channels, 1);
+    if(!texels)
+    {
+        cout << "Failed to load heightmap: " << filePath << endl;
+        return false;
+    }
+    heightmap.assign(texels, texels + (size_t)width * height);
+    heightmapWidth = width;
+    heightmapHeight = height;
+    heightmapPath = filePath;
+    stbi_image_free(texels);
+    return true;
+}
+
+float PlanetTerrain::height(const glm::vec3& direction)
+{
+    glm::vec3 d = glm::normalize(direction);
+    float noise = 0.0f, amplitude = 0.5f, total = 0.0f;
+    glm::vec3 p = d * noiseFrequency;
+    for(int octave = 0; octave < noiseOctaves; octave++)
+    {
+        noise += amplitude * valueNoise(p);
+        total += amplitude;
+        amplitude *= 0.5f;
+        p *= 2.0f;
+    }
+    // Sums of noise bunch up around a half; spread them out
+    noise = glm::clamp((noise / total - 0.5f) * 2.5f + 0.5f, 0.0f, 1.0f);
+    if(heightmap.empty())
+    {
+        return noise;
+    }
+
+    // The sphere mesh's mapping: u from -x towards +z, v from the south pole
+    float u = atan2f(d.z, -d.x) / (2.0f * glm::pi<float>());
+    float v = acosf(glm::clamp(-d.y, -1.0f, 1.0f)) / glm::pi<float>();
+    float x = (u - floorf(u)) * heightmapWidth - 0.5f;
+    float y = (1.0f - v) * heightmapHeight - 0.5f;
+    y = glm::clamp(y, 0.0f, heightmapHeight - 1.0f);
+    int x0 = (int)floorf(x), y0 = (int)y;
+    float fx = x - x0, fy = y - y0;
+    int x1 = (x0 + 1) % heightmapWidth, y1 = min(y0 + 1, heightmapHeight - 1);
+    x0 = (x0 + heightmapWidth) % heightmapWidth;
+    float top = glm::mix((float)heightmap[(size_t)y0 * heightmapWidth + x0], (float)heightmap[(size_t)y0 * heightmapWidth + x1], fx);
+    float bottom = glm::mix((float)heightmap[(size_t)y1 * heightmapWidth + x0], (float)heightmap[(size_t)y1 * heightmapWidth + x1], fx);
+    float mapped = glm::mix(top, bottom, fy) / 65535.0f;
+    return heightmapWeight * mapped + (1.0f - heightmapWeight) * noise;
+}
+
+// Never 0, which marks free layers
+uint64_t PlanetTerrain::chunkKey(int face, int level, int x, int y)
+{
+    return 1ull << 63 | (uint64_t)face << 56 | (uint64_t)level << 48 | (uint64_t)x << 24 | (uint64_t)y;
+}
+
+// Point of a chunk's grid on the unit sphere; s and t count grid quads and
+// may step outside the chunk, and the face, for the ring of heights
+glm::vec3 PlanetTerrain::facePoint(int face, int level, int x, int y, float s, float t)
+{
+    float size = 2.0f / (float)(1 << level);
+    float cubeX = -1.0f + (x + s / gridSize) * size;
+    float cubeY = -1.0f + (y + t / gridSize) * size;
+    return glm::normalize(faceAxes[face][0] + cubeX * faceAxes[face][1] + cubeY * faceAxes[face][2]);
+}
+
+// Runs on a worker
+void PlanetTerrain::generate(uint64_t key, GeneratedChunk& result)
+{
+    int face = (int)(key >> 56 & 7), level = (int)(key >> 48 & 255);
+    int x = (int)(key >> 24 & 0xffffff), y = (int)(key & 0xffffff);
+    result.key = key;
+    result.heights.resize(gridTexels * gridTexels);
+    result.minHeight = FLT_MAX;
+    result.maxHeight = -FLT_MAX;
+    for(int j = 0; j < gridTexels; j++)
+    {
+        for(int i = 0; i < gridTexels; i++)
+        {
+            float h = height(facePoint(face, level, x, y, (float)(i - 1), (float)(j - 1)));
+            result.heights[j * gridTexels + i] = h;
+            result.minHeight = min(result.minHeight, h);
+            result.maxHeight = max(result.maxHeight, h);
+        }
+    }
+}
+
+void PlanetTerrain::create()
+{
+    // Grid points, then a skirt point under each edge point, flagged by the
+    // third coordinate
+    vector<float> grid;
+    for(int j = 0; j <= gridSize; j++)
+    {
+        for(int i = 0; i <= gridSize; i++)
+        {
+            grid.insert(grid.end(), { (float)i, (float)j, 0.0f });
+        }
+    }
+    const int edgeStep[4][4] = { { 0, 0, 1, 0 }, { gridSize, 0, 0, 1 }, { gridSize, gridSize, -1, 0 }, { 0, gridSize, 0, -1 } };
+    unsigned short firstSkirt = (unsigned short)(grid.size() / 3);
+    for(int edge = 0; edge < 4; edge++)
+    {
+        for(int k = 0; k <= gridSize; k++)
+        {
+            grid.insert(grid.end(), { (float)(edgeStep[edge][0] + k * edgeStep[edge][2]),
+                (float)(edgeStep[edge][1] + k * edgeStep[edge][3]), 1.0f });
+        }
+    }
+
+    vector<unsigned short> indices;
+    for(int j = 0; j < gridSize; j++)
+    {
+        for(int i = 0; i < gridSize; i++)
+        {
+            unsigned short corner = (unsigned short)(j * (gridSize + 1) + i);
+            unsigned short quad[6] = { corner, (unsigned short)(corner + 1), (unsigned short)(corner + gridSize + 2),
+                corner, (unsigned short)(corner + gridSize + 2), (unsigned short)(corner + gridSize + 1) };
+            indices.insert(indices.end(), quad, quad + 6);
+        }
+    }
+    // The edges run counter-clockwise around the chunk, so each wall faces
+    // out of it like the grid faces out of the sphere
+    for(int edge = 0; edge < 4; edge++)
+    {
+        for(int k = 0; k < gridSize; k++)
+        {
+            int x = edgeStep[edge][0] + k * edgeStep[edge][2], y = edgeStep[edge][1] + k * edgeStep[edge][3];
+            unsigned short top = (unsigned short)(y * (gridSize + 1) + x);
+            unsigned short nextTop = (unsigned short)((y + edgeStep[edge][3]) * (gridSize + 1) + x + edgeStep[edge][2]);
+            unsigned short bottom = (unsigned short)(firstSkirt + edge * (gridSize + 1) + k);
+            unsigned short wall[6] = { bottom, (unsigned short)(bottom + 1), nextTop, bottom, nextTop, top };
+            indices.insert(indices.end(), wall, wall + 6);
+        }
+    }
+    numGridIndices = (int)indices.size();
+
+    glGenVertexArrays(1, &gridVao);
+    glGenBuffers(1, &gridVbo);
+    glGenBuffers(1, &gridIbo);
+    glGenBuffers(1, &chunkBuffer);
+    glBindVertexArray(gridVao);
+    glBindBuffer(GL_ARRAY_BUFFER, gridVbo);
+    glBufferData(GL_ARRAY_BUFFER, grid.size() * sizeof(float), grid.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gridIbo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), indices.data(), GL_STATIC_DRAW);
+    glBindVertexArray(0);
+
+    // Filtered, so morphing vertices slide between the heights of their grid
+    // and their parent's
+    glGenTextures(1, &heightTexture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, heightTexture);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_R32F, gridTexels, gridTexels, cacheLayers);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    layerChunks.assign(cacheLayers, 0);
+
+    vector<GeneratedChunk> roots(6);
+    jobs.parallelFor(6, 1, [&](int first, int last) {
+        for(int face = first; face < last; face++)
+        {
+            generate(chunkKey(face, 0, 0, 0), roots[face]);
+        }
+    });
+    for(int face = 0; face < 6; face++)
+    {
+        uploadChunk(roots[face], face);
+        chunks[roots[face].key].used = LLONG_MAX;
+    }
+}
+
+// Distance from the camera to a sphere around the chunk, or -1 when the
+// sphere is outside the frustum
+float PlanetTerrain::boundsDistance(const Node& node, const glm::vec3& camera, const glm::vec4 planes[6])
+{
+    const Chunk& chunk = chunks.at(chunkKey(node.face, node.level, node.x, node.y));
+    glm::vec3 center = facePoint(node.face, node.level, node.x, node.y, gridSize / 2.0f, gridSize / 2.0f);
+    float chord = 0.0f;
+    for(int corner = 0; corner < 4; corner++)
+    {
+        glm::vec3 point = facePoint(node.face, node.level, node.x, node.y, (float)(corner % 2 * gridSize),
+            (float)(corner / 2 * gridSize));
+        chord = max(chord, glm::length(point - center));
+    }
+    center *= 1.0f + heightScale * 0.5f * (chunk.minHeight + chunk.maxHeight);
+    float radius = chord * (1.0f + heightScale * chunk.maxHeight) + heightScale * 0.5f * (chunk.maxHeight - chunk.minHeight);
+    for(int p = 0; p < 6; p++)
+    {
+        if(glm::dot(glm::vec3(planes[p]), center) + planes[p].w < -radius)
+        {
+            return -1.0f;
+        }
+    }
+    return max(glm::length(camera - center) - radius, 0.0f);
+}
+
+// Breadth first, nearest chunks first, so the cap on drawn chunks takes
+// detail away from the distance. A chunk within its split distance is
+// replaced by its children once all four are cached; until then it is
+// drawn and they are requested. Both can leave neighbors more than a level
+// apart, whose gaps the skirts cover.
+void PlanetTerrain::select(const glm::vec3& camera, const glm::vec4 planes[6])
+{
+    selected.clear();
+    missing.clear();
+    deepestLevel = 0;
+    vector<Node> nodes, next;
+    for(int face = 0; face < 6; face++)
+    {
+        nodes.push_back({ face, 0, 0, 0, FLT_MAX, 0.0f });
+    }
+    int planned = (int)nodes.size();
+    while(!nodes.empty())
+    {
+        for(Node& node : nodes)
+        {
+            node.distance = boundsDistance(node, camera, planes);
+        }
+        sort(nodes.begin(), nodes.end(), [](const Node& a, const Node& b) { return a.distance < b.distance; });
+
+        next.clear();
+        for(const Node& node : nodes)
+        {
+            if(node.distance < 0.0f)
+            {
+                planned--;
+                continue;
+            }
+            Chunk& chunk = chunks.at(chunkKey(node.face, node.level, node.x, node.y));
+            chunk.used = max(chunk.used, frame);
+
+            float split = lodFactor * glm::half_pi<float>() / (float)(1 << node.level);
+            if(node.level < maxLevel && node.distance < split && planned + 3 <= maxDrawnChunks)
+            {
+                bool cached = true;
+                for(int child = 0; child < 4; child++)
+                {
+                    uint64_t key = chunkKey(node.face, node.level + 1, 2 * node.x + child % 2, 2 * node.y + child / 2);
+                    auto found = chunks.find(key);
+                    if(found == chunks.end())
+                    {
+                        cached = false;
+                        missing.push_back(make_pair(node.distance, key));
+                    }
+                    else
+                    {
+                        found->second.used = max(found->second.used, frame);
+                    }
+                }
+                if(cached)
+                {
+                    for(int child = 0; child < 4; child++)
+                    {
+                        next.push_back({ node.face, node.level + 1, 2 * node.x + child % 2, 2 * node.y + child / 2, split, 0.0f });
+                    }
+                    planned += 3;
+                    continue;
+                }
+            }
+
+            // Roots never morph: their morph range starts beyond any distance
+            GpuChunk instance = { node.face, node.level, node.x, node.y, 0.8f * node.morphEnd, node.morphEnd,
+                (float)chunk.layer, 0.0f };
+            selected.push_back(instance);
+            deepestLevel = max(deepestLevel, node.level);
+        }
+        nodes.swap(next);
+    }
+}
+
+// Coarse levels first, as they unlock the finer ones, then the nearest
+void PlanetTerrain::requestChunks()
+{
+    sort(missing.begin(), missing.end(), [](const pair<float, uint64_t>& a, const pair<float, uint64_t>& b) {
+        int levelA = (int)(a.second >> 48 & 255), levelB = (int)(b.second >> 48 & 255);
+        return levelA != levelB ? levelA < levelB : a.first < b.first;
+    });
+    for(const pair<float, uint64_t>& chunk : missing)
+    {
+        if((int)requested.size() >= maxJobsInFlight)
+        {
+            break;
+        }
+        uint64_t key = chunk.second;
+        if(!requested.insert(key).second)
+        {
+            continue;
+        }
+        jobs.run([this, key]() {
+            GeneratedChunk result;
+            generate(key, result);
+            lock_guard<mutex> lock(generatedMutex);
+            generated.push_back(move(result));
+        }, &generation);
+    }
+}
+
+void PlanetTerrain::uploadChunks()
+{
+    vector<GeneratedChunk> batch;
+    {
+        lock_guard<mutex> lock(generatedMutex);
+        size_t count = min(generated.size(), (size_t)maxUploadsPerFrame);
+        move(generated.begin(), generated.begin() + count, back_inserter(batch));
+        generated.erase(generated.begin(), generated.begin() + count);
+    }
+    for(GeneratedChunk& chunk : batch)
+    {
+        requested.erase(chunk.key);
+        numGenerated++;
+        // With every layer in use this frame the chunk is dropped; it is
+        // requested again while it is still needed
+        int layer = findLayer();
+        if(layer >= 0)
+        {
+            uploadChunk(chunk, layer);
+        }
+    }
+}
+
+void PlanetTerrain::uploadChunk(GeneratedChunk& chunk, int layer)
+{
+    glBindTexture(GL_TEXTURE_2D_ARRAY, heightTexture);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, gridTexels, gridTexels, 1, GL_RED, GL_FLOAT, chunk.heights.data());
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    Chunk& cached = chunks[chunk.key];
+    cached.layer = layer;
+    cached.used = frame;
+    cached.minHeight = chunk.minHeight;
+    cached.maxHeight = chunk.maxHeight;
+    layerChunks[layer] = chunk.key;
+}
+
+// A free layer, else the least recently used one not needed this frame.
+// An evicted chunk's children may stay cached; they are only reached
+// through it, so they age out in turn.
+int PlanetTerrain::findLayer()
+{
+    int victim = -1;
+    long long victimUsed = LLONG_MAX;
+    for(int layer = 0; layer < cacheLayers; layer++)
+    {
+        if(layerChunks[layer] == 0)
+        {
+            return layer;
+        }
+        long long used = chunks.at(layerChunks[layer]).used;
+        if(used < frame && used < victimUsed)
+        {
+            victim = layer;
+            victimUsed = used;
+        }
+    }
+    if(victim >= 0)
+    {
+        chunks.erase(layerChunks[victim]);
+        layerChunks[victim] = 0;
+        numEvicted++;
+    }
+    return victim;
+}
+
+void PlanetTerrain::update(const glm::vec3& camera, const glm::mat4& clip)
+{
+    frame++;
+    auto start = chrono::steady_clock::now();
+
+    // Frustum planes in the body's frame, from the rows of clip
+    glm::vec4 rows[4];
+    for(int r = 0; r < 4; r++)
+    {
+        rows[r] = glm::vec4(clip[0][r], clip[1][r], clip[2][r], clip[3][r]);
+    }
+    glm::vec4 planes[6] = { rows[3] + rows[0], rows[3] - rows[0], rows[3] + rows[1], rows[3] - rows[1], rows[3] + rows[2], rows[3] - rows[2] };
+    for(int p = 0; p < 6; p++)
+    {
+        planes[p] /= glm::length(glm::vec3(planes[p]));
+    }
+
+    select(camera, planes);
+    requestChunks();
+    selectMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    uploadChunks();
+}
+
+void PlanetTerrain::draw(GLuint program)
+{
+    if(selected.empty())
+    {
+        return;
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, chunkBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, selected.size() * sizeof(GpuChunk), selected.data(), GL_STREAM_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, chunkBuffer);
+    glUniform1f(glGetUniformLocation(program, "height_scale"), heightScale);
+    glUniform1i(glGetUniformLocation(program, "grid_size"), gridSize);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, heightTexture);
+    glActiveTexture(GL_TEXTURE0);
+
+    glBindVertexArray(gridVao);
+    glDrawElementsInstanced(GL_TRIANGLES, numGridIndices, GL_UNSIGNED_SHORT, 0, (GLsizei)selected.size());
+    glBindVertexArray(0);
+}
+
+void PlanetTerrain::close()
+{
+    jobs.wait(generation);
+    if(heightTexture)
+    {
+        glDeleteTextures(1, &heightTexture);
+        glDeleteBuffers(1, &gridVbo);
+        glDeleteBuffers(1, &gridIbo);
+        glDeleteBuffers(1, &chunkBuffer);
+        glDeleteVertexArrays(1, &gridVao);
+    }
+    heightTexture = gridVao = gridVbo = gridIbo = chunkBuffer = 0;
+    chunks.clear();
+    layerChunks.clear();
+    requested.clear();
+    generated.clear();
+    selected.clear();
+}
+
+TerrainStats PlanetTerrain::collectStats()
+{
+    TerrainStats stats = TerrainStats();
+    stats.chunks = (int)selected.size();
+    stats.deepestLevel = deepestLevel;
+    stats.cached = (int)chunks.size();
+    stats.generating = (int)requested.size();
+    stats.generated = numGenerated;
+    stats.evicted = numEvicted;
+    stats.selectMs = selectMs;
+    numGenerated = 0;
+    numEvicted = 0;
+    return stats;
+}
+
+void PlanetTerrain::printStats(const string& name)
+{
+    cout << name << " terrain: " << chunks.size() << " of " << cacheLayers << " chunks cached, "
+        << (size_t)cacheLayers * gridTexels * gridTexels * sizeof(float) / (1024 * 1024) << " MB of heights"
+        << (heightmapPath.empty() ? string() : ", heightmap " + heightmapPath) << endl;
+}
@@ -0,0 +1,246 @@
+#include <cmath>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+#include "../include/Simulation.h"
+#include "../include/Kepler.h"
+
+using namespace std;
+
+// A tick this late is dropped rather than caught up, so a stall slows the
+// simulation down instead of making it spiral
+static const double maxLag = 4 * Simulation::fixedStep;
+
+Simulation::Simulation(BodyCatalog& catalog, Ephemeris& ephemeris, JobSystem& jobs) : catalog(catalog), ephemeris(ephemeris),
+    jobs(jobs), nbody(jobs), nbodyMode(false), propagation(true), nbodyTime(0.0), discontinuity(0), running(false), previous(), current(), hasState(false)
+{
+}
+
+Simulation::~Simulation()
+{
+    stop();
+}
+
+void Simulation::start()
+{
+    if(running)
+    {
+        return;
+    }
+    running = true;
+    thread = std::thread(&Simulation::run, this);
+}
+
+void Simulation::stop()
+{
+    running = false;
+    if(thread.joinable())
+    {
+        thread.join();
+    }
+}
+
+double Simulation::now()
+{
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Simulation::post(const function<void()>& command)
+{
+    lock_guard<mutex> lock(commandMutex);
+    commands.push_back(command);
+}
+
+SimulationClock& Simulation::getClock() {return clock;}
+NBody& Simulation::getNBody() {return nbody;}
+bool Simulation::getNBodyMode() {return nbodyMode;}
+
+void Simulation::setNBodyMode(bool enabled)
+{
+    nbodyMode = enabled;
+    if(nbodyMode)
+    {
+        // Start from the analytic state at this instant
+        nbodyTime = clock.getTime();
+        nbody.initFromCatalog(catalog, nbodyTime);
+    }
+    discontinuity++;
+}
+
+void Simulation::setPropagation(bool enabled)
+{
+    propagation = enabled;
+    discontinuity++;
+}
+
+// Positions are analytic, so any epoch is one evaluation away; the N-body
+// state restarts from the analytic one there
+void Simulation::seek(double time)
+{
+    clock.seek(time);
+    if(nbodyMode)
+    {
+        nbodyTime = time;
+        nbody.initFromCatalog(catalog, nbodyTime);
+    }
+    discontinuity++;
+}
+
+void Simulation::run()
+{
+    double nextTick = now();
+    double rateStart = nextTick, workMs = 0.0, tickRate = 0.0, tickMs = 0.0;
+    int rateTicks = 0;
+    long tickIndex = 0;
+    vector<function<void()>> pending;
+
+    while(running)
+    {
+        {
+            lock_guard<mutex> lock(commandMutex);
+            pending.swap(commands);
+        }
+        for(size_t c = 0; c < pending.size(); c++)
+        {
+            pending[c]();
+        }
+        pending.clear();
+
+        double workStart = now();
+        SimulationState& state = states.getBack();
+        tick(tickIndex++, nextTick, state);
+        state.tickRate = tickRate;
+        state.tickMs = tickMs;
+        states.publish();
+
+        double time = now();
+        workMs += 1000.0 * (time - workStart);
+        rateTicks++;
+        if(time - rateStart >= 1.0)
+        {
+            tickRate = rateTicks / (time - rateStart);
+            tickMs = workMs / rateTicks;
+            rateStart = time;
+            rateTicks = 0;
+            workMs = 0.0;
+        }
+
+        nextTick += fixedStep;
+        if(time > nextTick + maxLag)
+        {
+            nextTick = time;
+        }
+        else if(time < nextTick)
+        {
+            this_thread::sleep_for(chrono::duration<double>(nextTick - time));
+        }
+    }
+}
+
+// The clock advances by exactly one fixed step per tick, whatever the wall
+// clock did in between
+void Simulation::tick(long tickIndex, double realTime, SimulationState& state)
+{
+    double time = clock.update(tickIndex * fixedStep);
+    int numBodies = propagation || nbodyMode ? catalog.getNumBodies() : 0;
+    state.x.resize(numBodies);
+    state.y.resize(numBodies);
+    state.z.resize(numBodies);
+
+    if(numBodies == 0)
+    {
+        // Nothing to propagate; the time alone is published
+    }
+    else if(!nbodyMode)
+    {
+        if(ephemeris.covers(time))
+        {
+            jobs.parallelFor(numBodies, propagateGrain, [&](int first, int last) {
+                ephemeris.evaluate(time, &state.x[0], &state.y[0], &state.z[0], first, last - first);
+            });
+        }
+        else
+        {
+            jobs.parallelFor(numBodies, propagateGrain, [&](int first, int last) {
+                Kepler::propagate(catalog.orbits, time, &state.x[0], &state.y[0], &state.z[0], first, last - first);
+            });
+        }
+    }
+    else
+    {
+        // Catch up in substeps no longer than nbodyMaxStep, in either
+        // direction since leapfrog is time-reversible. The work per tick is
+        // capped, so under a large warp the clock waits for the simulation.
+        double budget = nbodyMaxStep * nbodyMaxSubsteps;
+        double elapsed = max(-budget, min(time - nbodyTime, budget));
+        if(nbody.blockTimesteps)
+        {
+            // One base step per tick; each body subdivides it as it needs
+            nbody.step(elapsed);
+        }
+        else
+        {
+            int steps = min((int)ceil(fabs(elapsed) / nbodyMaxStep), nbodyMaxSubsteps);
+            for(int s = 0; s < steps; s++)
+            {
+                nbody.step(elapsed / steps);
+            }
+        }
+        nbodyTime += elapsed;
+        if(nbodyTime != time)
+        {
+            clock.seek(nbodyTime);
+            time = nbodyTime;
+        }
+
+        for(int i = 0; i < numBodies; i++)
+        {
+            int parent = catalog.parents[i];
+            double x = nbody.positionsX[i], y = nbody.positionsY[i], z = nbody.positionsZ[i];
+            if(parent >= 0)
+            {
+                x -= nbody.positionsX[parent]; y -= nbody.positionsY[parent]; z -= nbody.positionsZ[parent];
+            }
+            state.x[i] = (float)x; state.y[i] = (float)y; state.z[i] = (float)z;
+        }
+    }
+
+    state.time = time;
+    state.realTime = realTime;
+    state.discontinuity = discontinuity;
+    state.nbodyMode = nbodyMode;
+    state.nbodyStats = nbody.stats;
+}
+
+const SimulationState* Simulation::interpolate(double realTime, float* x, float* y, float* z, double& time)
+{
+    if(states.update())
+    {
+        swap(previous, current);
+        current = states.getFront();
+        if(!hasState)
+        {
+            previous = current;
+            hasState = true;
+        }
+    }
+    if(!hasState)
+    {
+        return nullptr;
+    }
+
+    // One tick behind, so the wanted time normally lies between the two
+    const SimulationState& from = previous.discontinuity == current.discontinuity
+        && previous.x.size() == current.x.size() ? previous : current;
+    double span = current.realTime - from.realTime;
+    float alpha = span > 0.0 ? (float)max(0.0, min((realTime - fixedStep - from.realTime) / span, 1.0)) : 1.0f;
+
+    for(size_t i = 0; i < current.x.size(); i++)
+    {
+        x[i] = from.x[i] + alpha * (current.x[i] - from.x[i]);
+        y[i] = from.y[i] + alpha * (current.y[i] - from.y[i]);
+        z[i] = from.z[i] + alpha * (current.z[i] - from.z[i]);
+    }
+    time = from.time + alpha * (current.time - from.time);
+    return &current;
+}
@@ -0,0 +1,54 @@
+#include <cmath>
+#include <algorithm>
+#include "../include/SimulationClock.h"
+#include "../include/Constants.h"
+
+using namespace std;
+
+SimulationClock::SimulationClock() : time(0.0), warp(1.0), paused(false), lastRealTime(0.0), started(false) {}
+
+// Returns the simulation time for the frame at realTime (seconds)
+double SimulationClock::update(double realTime)
+{
+    if(started && !paused)
+    {
+        time += (realTime - lastRealTime) * warp;
+    }
+    lastRealTime = realTime;
+    started = true;
+    return time;
+}
+
+double SimulationClock::getTime() {return time;}
+double SimulationClock::getWarp() {return warp;}
+bool SimulationClock::isPaused() {return paused;}
+
+void SimulationClock::setWarp(double factor)
+{
+    warp = max(-maxWarp, min(factor, maxWarp));
+}
+
+void SimulationClock::togglePause()
+{
+    paused = !paused;
+}
+
+void SimulationClock::reverse()
+{
+    warp = -warp;
+}
+
+void SimulationClock::seek(double newTime)
+{
+    time = newTime;
+}
+
+double SimulationClock::yearsToTime(double years)
+{
+    return years * 2.0 * M_PI / Constants::earth_revolution_speed;
+}
+
+double SimulationClock::timeToYears(double seconds)
+{
+    return seconds * Constants::earth_revolution_speed / (2.0 * M_PI);
+}
@@ -0,0 +1,844 @@
+#include <cmath>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include "../include/TextureLoader.h"
+#include "../include/Utils.h"
+#include "../include/Ktx.h"
+#include "../include/CubeMap.h"
+#include "../include/stb_image.h"
+
+using namespace std;
+
+const glm::vec3 TextureLoader::placeholderColor = glm::vec3(0.5f, 0.5f, 0.5f);
+
+static long long nowNs()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static GLenum formatFor(int channels)
+{
+    return channels == 4 ? GL_RGBA : channels == 1 ? GL_RED : GL_RGB;
+}
+
+TextureLoader::TextureLoader(JobSystem& jobs) : jobs(jobs), placeholder(0), placeholderCubemap(0), startNs(0),
+    totalMs(0.0), numResident(0), gpuBytes(0), numCompressed(0), loadFinished(false), frame(0), reservedBytes(0),
+    numRestoring(0), numReductions(0), numEvictions(0), numRestores(0), stopping(false), uploadWindow(nullptr),
+    preferCompressed(true), assets(nullptr), budgetBytes(512LL * 1024 * 1024) {}
+
+int TextureLoader::addTexture(const string& path)
+{
+    Texture texture = Texture();
+    texture.cubemap = false;
+    texture.averageColor = glm::vec3(1.0f);
+    texture.pendingImages = 1;
+    texture.mipmaps = true;
+    texture.image = (int)images.size();
+    textures.push_back(texture);
+
+    Image image = Image();
+    image.path = path;
+    image.texture = (int)textures.size() - 1;
+    image.face = -1;
+    images.push_back(image);
+    return image.texture;
+}
+
+int TextureLoader::addPlanetMap(const string& path)
+{
+    Texture texture = Texture();
+    texture.cubemap = true;
+    texture.averageColor = glm::vec3(1.0f);
+    texture.pendingImages = 1;
+    texture.mipmaps = true;
+    texture.image = (int)images.size();
+    textures.push_back(texture);
+
+    Image image = Image();
+    image.path = path;
+    image.texture = (int)textures.size() - 1;
+    image.face = -1;
+    image.toCubemap = true;
+    images.push_back(image);
+    return image.texture;
+}
+
+int TextureLoader::addCubemap(const vector<string>& faces)
+{
+    Texture texture = Texture();
+    texture.cubemap = true;
+    texture.averageColor = glm::vec3(1.0f);
+    texture.pendingImages = (int)faces.size();
+    texture.mipmaps = false;
+    texture.image = (int)images.size();
+    textures.push_back(texture);
+
+    for(size_t i = 0; i < faces.size(); i++)
+    {
+        Image image = Image();
+        image.path = faces[i];
+        image.texture = (int)textures.size() - 1;
+        image.face = (int)i;
+        images.push_back(image);
+    }
+    return (int)textures.size() - 1;
+}
+
+// Texture objects and their sampling state, so uploads only fill them, and
+// one-texel placeholders of placeholderColor
+void TextureLoader::createTextures()
+{
+    if(preferCompressed && !Utils::compressionSupported())
+    {
+        cout << "TextureLoader: no BC1 support, decoding the source images" << endl;
+        preferCompressed = false;
+    }
+
+    const GLubyte gray[3] = { 128, 128, 128 };
+    glGenTextures(1, &placeholder);
+    glBindTexture(GL_TEXTURE_2D, placeholder);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, gray);
+    glGenTextures(1, &placeholderCubemap);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, placeholderCubemap);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    for(int face = 0; face < 6; face++)
+    {
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, gray);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    for(size_t t = 0; t < textures.size(); t++)
+    {
+        textures[t].id = createTexture(textures[t]);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+}
+
+// A texture object of texture's kind with its sampling state, left bound
+GLuint TextureLoader::createTexture(const Texture& texture)
+{
+    GLuint id;
+    glGenTextures(1, &id);
+    if(texture.cubemap)
+    {
+        glBindTexture(GL_TEXTURE_CUBE_MAP, id);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, texture.mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    }
+    else
+    {
+        glBindTexture(GL_TEXTURE_2D, id);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    }
+    return id;
+}
+
+// The image vector is not resized while jobs hold references into it
+void TextureLoader::decodeAll()
+{
+    startNs = nowNs();
+    for(size_t i = 0; i < images.size(); i++)
+    {
+        int index = (int)i;
+        jobs.run([this, index]() { decode(index); }, &decoding);
+    }
+}
+
+// Runs on a worker. A current KTX2 cache is only read, already flipped and
+// with its mip chain; otherwise the image is decoded, a planet map
+// resampled into its cube, and that halved for a restore that drops levels.
+// stb_image's flip flag is per thread here, so concurrent decodes of
+// flipped and unflipped images do not race on it. Packed files are used in
+// place in the mapping, and prefetched so the page faults happen here
+// rather than in the upload.
+void TextureLoader::decode(int index)
+{
+    Image& image = images[index];
+    image.timing.decodeStart = (nowNs() - startNs) * 1e-6;
+
+    AssetEntry source, cache;
+    bool packed = assets && assets->find(image.path, source);
+    bool compressed = false;
+    if(packed && preferCompressed && assets->find(Ktx::cachePath(image.path), cache))
+    {
+        AssetPack::prefetch(cache);
+        compressed = Ktx::read(cache.data, cache.size, image.path.c_str(), image.compressed);
+    }
+    else if(!packed && preferCompressed && Ktx::isCurrent(image.path))
+    {
+        compressed = Ktx::load(Ktx::cachePath(image.path).c_str(), image.compressed);
+    }
+    if(compressed && image.compressed.numFaces != (image.toCubemap ? 6 : 1))
+    {
+        compressed = false;
+        image.compressed = KtxImage();
+    }
+
+    if(compressed)
+    {
+        image.isCompressed = true;
+        image.width = image.compressed.width;
+        image.height = image.compressed.height;
+        if(image.compressed.hasAverageColor)
+        {
+            image.averageColor = glm::vec3(image.compressed.averageColor[0], image.compressed.averageColor[1],
+                image.compressed.averageColor[2]);
+        }
+    }
+    else
+    {
+        stbi_set_flip_vertically_on_load_thread(image.face < 0);
+        if(packed)
+        {
+            image.data = stbi_load_from_memory(source.data, (int)source.size, &image.width, &image.height,
+                &image.channels, 0);
+        }
+        else
+        {
+            image.data = stbi_load(image.path.c_str(), &image.width, &image.height, &image.channels, 0);
+        }
+        if(image.data && image.toCubemap)
+        {
+            int size = CubeMap::faceSize(image.width);
+            CubeMap::fromEquirectangular(image.data, image.width, image.height, image.channels, size, image.faces);
+            stbi_image_free(image.data);
+            image.data = nullptr;
+            image.width = image.height = size;
+            image.channels = 3;
+            // Of the faces, as Ktx::encodeCubemap takes it for the cache
+            image.averageColor = Utils::averageColor(image.faces.data(), size, 6 * size, 3);
+
+            vector<unsigned char> face, half, faces;
+            for(int level = 0; level < image.dropLevels; level++)
+            {
+                size_t faceBytes = (size_t)size * size * 3;
+                faces.clear();
+                for(int f = 0; f < 6; f++)
+                {
+                    face.assign(image.faces.begin() + f * faceBytes, image.faces.begin() + (f + 1) * faceBytes);
+                    Ktx::downsample(face, size, size, half);
+                    faces.insert(faces.end(), half.begin(), half.end());
+                }
+                image.faces.swap(faces);
+                size /= 2;
+            }
+            image.width = image.height = size;
+        }
+        else if(image.data && image.face < 0)
+        {
+            image.averageColor = Utils::averageColor(image.data, image.width, image.height, image.channels);
+        }
+    }
+    image.timing.decodeEnd = (nowNs() - startNs) * 1e-6;
+
+    // Notified under the lock: once the last index is in, loadAll may return
+    // and the loader go away
+    lock_guard<mutex> lock(readyMutex);
+    ready.push_back(index);
+    readyChanged.notify_one();
+}
+
+// Through a pixel buffer, so the copy into driver memory is a memcpy into
+// a mapping and the transfer itself runs asynchronously. A KTX2 file goes in
+// whole and its levels are specified at their offsets; from a pack, that
+// memcpy out of the pack's mapping is the only copy made. Levels a restore
+// drops are left out. Returns whether there was anything to upload.
+bool TextureLoader::upload(Image& image)
+{
+    Texture& texture = textures[image.texture];
+    texture.pendingImages--;
+    if(!image.data && image.faces.empty() && !image.isCompressed)
+    {
+        cout << "Failed to load texture: " << image.path << endl;
+        return false;
+    }
+
+    const unsigned char *source = image.isCompressed ? image.compressed.bytes : image.toCubemap ? image.faces.data() : image.data;
+    GLsizeiptr size = image.isCompressed ? (GLsizeiptr)image.compressed.numBytes : image.toCubemap ? (GLsizeiptr)image.faces.size()
+        : (GLsizeiptr)image.width * image.height * image.channels;
+    GLuint pixelBuffer;
+    glGenBuffers(1, &pixelBuffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffer);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+    const unsigned char *pixels = (const unsigned char*)0;
+    void *mapping = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if(mapping)
+    {
+        memcpy(mapping, source, size);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+    else
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        pixels = source;
+    }
+
+    GLenum target = texture.cubemap && image.face >= 0 ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + image.face : GL_TEXTURE_2D;
+    GLenum binding = texture.cubemap ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+    int dropped = 0;
+    glBindTexture(binding, texture.id);
+    if(image.isCompressed)
+    {
+        dropped = min(image.dropLevels, image.compressed.numLevels - 1);
+        for(int face = 0; face < image.compressed.numFaces; face++)
+        {
+            Utils::uploadCompressed(image.toCubemap ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : target, image.compressed, pixels,
+                face, dropped);
+        }
+        if(texture.mipmaps)
+        {
+            glTexParameteri(binding, GL_TEXTURE_MAX_LEVEL, image.compressed.numLevels - 1 - dropped);
+            texture.width = image.compressed.width;
+            texture.height = image.compressed.height;
+            texture.numLevels = image.compressed.numLevels;
+        }
+        else
+        {
+            for(size_t entry = 0; entry < image.compressed.levelSizes.size(); entry++)
+            {
+                gpuBytes += image.compressed.levelSizes[entry];
+            }
+        }
+        numCompressed++;
+        image.compressed.data.clear();
+        image.compressed.data.shrink_to_fit();
+    }
+    else
+    {
+        GLenum format = formatFor(image.channels);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        if(image.toCubemap)
+        {
+            size_t faceBytes = (size_t)image.width * image.height * 3;
+            for(int face = 0; face < 6; face++)
+            {
+                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGB8, image.width, image.height, 0, GL_RGB,
+                    GL_UNSIGNED_BYTE, pixels + face * faceBytes);
+            }
+            glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+            dropped = image.dropLevels;
+        }
+        else if(texture.cubemap)
+        {
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + image.face, 0, GL_RGB, image.width, image.height, 0, format,
+                GL_UNSIGNED_BYTE, pixels);
+            // Drivers keep RGB8 as four bytes a texel
+            gpuBytes += (long long)image.width * image.height * 4;
+        }
+        else
+        {
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, pixels);
+            glGenerateMipmap(GL_TEXTURE_2D);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        if(texture.mipmaps)
+        {
+            texture.width = image.width << dropped;
+            texture.height = image.height << dropped;
+            texture.numLevels = 1 + (int)log2((double)max(texture.width, texture.height));
+        }
+        stbi_image_free(image.data);
+        image.data = nullptr;
+        image.faces.clear();
+        image.faces.shrink_to_fit();
+    }
+
+    // Deleting only drops the name; the buffer lives until the upload is done
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(1, &pixelBuffer);
+
+    if(texture.mipmaps)
+    {
+        texture.averageColor = image.averageColor;
+        texture.compressed = image.isCompressed;
+        long long bytes = residentBytes(texture, dropped);
+        gpuBytes += bytes - texture.bytes;
+        texture.bytes = bytes;
+        texture.dropped = dropped;
+    }
+    return true;
+}
+
+// Uploads decoded images as they arrive. A texture is complete with its last
+// image; on the loader thread it then gets a fence, which the render thread
+// polls before using it.
+void TextureLoader::uploadAll(bool useFences)
+{
+    for(size_t uploaded = 0; uploaded < images.size(); )
+    {
+        vector<int> batch;
+        {
+            unique_lock<mutex> lock(readyMutex);
+            readyChanged.wait(lock, [this]() { return !ready.empty() || stopping; });
+            if(stopping)
+            {
+                return;
+            }
+            batch.swap(ready);
+        }
+        for(int index : batch)
+        {
+            Image& image = images[index];
+            image.timing.uploadStart = (nowNs() - startNs) * 1e-6;
+            upload(image);
+            image.timing.uploadEnd = (nowNs() - startNs) * 1e-6;
+
+            Texture& texture = textures[image.texture];
+            if(texture.pendingImages > 0)
+            {
+                continue;
+            }
+            if(useFences)
+            {
+                Fence fence = { image.texture, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) };
+                glFlush();
+                lock_guard<mutex> lock(fenceMutex);
+                fenced.push_back(fence);
+            }
+            else
+            {
+                texture.resident = true;
+                texture.loaded = true;
+                numResident++;
+            }
+        }
+        uploaded += batch.size();
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+}
+
+void TextureLoader::loadAll()
+{
+    createTextures();
+    decodeAll();
+    uploadAll(false);
+    finish();
+}
+
+void TextureLoader::start(GLFWwindow *window)
+{
+    createTextures();
+
+    // A hidden window, only for a context that shares objects with the main one
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    uploadWindow = glfwCreateWindow(1, 1, "Texture loader", NULL, window);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+    glfwMakeContextCurrent(window);
+    if(!uploadWindow)
+    {
+        cout << "TextureLoader: no shared context, loading on the render thread" << endl;
+        decodeAll();
+        uploadAll(false);
+        finish();
+        return;
+    }
+
+    decodeAll();
+    uploadThread = thread(&TextureLoader::uploadLoop, this);
+}
+
+void TextureLoader::uploadLoop()
+{
+    glfwMakeContextCurrent(uploadWindow);
+    uploadAll(true);
+    glfwMakeContextCurrent(NULL);
+}
+
+bool TextureLoader::update()
+{
+    {
+        lock_guard<mutex> lock(fenceMutex);
+        pending.insert(pending.end(), fenced.begin(), fenced.end());
+        fenced.clear();
+    }
+
+    // Polled without waiting; the loader thread has flushed its commands
+    bool changed = false;
+    for(size_t i = 0; i < pending.size(); )
+    {
+        GLenum status = glClientWaitSync(pending[i].sync, 0, 0);
+        if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+        {
+            i++;
+            continue;
+        }
+        glDeleteSync(pending[i].sync);
+        textures[pending[i].texture].resident = true;
+        textures[pending[i].texture].loaded = true;
+        numResident++;
+        changed = true;
+        pending.erase(pending.begin() + i);
+    }
+    if(changed && !loadFinished && allResident())
+    {
+        finish();
+    }
+    if(loadFinished && updateResidency())
+    {
+        changed = true;
+    }
+    return changed;
+}
+
+void TextureLoader::request(int texture, float pixels)
+{
+    textures[texture].requested = max(textures[texture].requested, pixels);
+}
+
+void TextureLoader::finish()
+{
+    totalMs = (nowNs() - startNs) * 1e-6;
+    loadFinished = true;
+    printTimeline();
+}
+
+bool TextureLoader::isManaged(const Texture& texture)
+{
+    return texture.mipmaps && texture.numLevels > 0;
+}
+
+// Of the levels from dropped on
+long long TextureLoader::residentBytes(const Texture& texture, int dropped)
+{
+    long long bytes = 0;
+    for(int level = dropped; level < texture.numLevels; level++)
+    {
+        int levelWidth = max(1, texture.width >> level), levelHeight = max(1, texture.height >> level);
+        // Drivers keep RGB8 as four bytes a texel
+        bytes += texture.compressed ? (long long)Ktx::levelSize(levelWidth, levelHeight) : (long long)levelWidth * levelHeight * 4;
+    }
+    return bytes * (texture.cubemap ? 6 : 1);
+}
+
+// The first level no larger than tailSize
+int TextureLoader::tailLevel(const Texture& texture)
+{
+    int level = 0;
+    while(level < texture.numLevels - 1 && max(texture.width, texture.height) >> level > tailSize)
+    {
+        level++;
+    }
+    return level;
+}
+
+// The smallest level with a texel a pixel across the body's middle, where
+// the visible half of the map spans its diameter: half of a 2D map's width,
+// or two faces of a planet's cube
+int TextureLoader::levelFor(const Texture& texture, float pixels)
+{
+    float needed = texture.cubemap ? pixels / 2.0f : pixels * 2.0f;
+    int level = 0;
+    while(level < texture.numLevels - 1 && (texture.width >> (level + 1)) >= needed)
+    {
+        level++;
+    }
+    return level;
+}
+
+// Once a frame after loading: takes in finished restores, starts those the
+// view asks for and the budget has room for, and keeps the budget
+bool TextureLoader::updateResidency()
+{
+    frame++;
+    int changes = numReductions + numEvictions;
+    glActiveTexture(GL_TEXTURE0);
+    bool changed = uploadRestored();
+
+    vector<int> wanting;
+    for(size_t t = 0; t < textures.size(); t++)
+    {
+        Texture& texture = textures[t];
+        if(!isManaged(texture))
+        {
+            continue;
+        }
+        texture.demand = texture.requested;
+        texture.requested = 0.0f;
+        if(texture.demand > 0.0f)
+        {
+            texture.used = frame;
+            texture.wanted = min(levelFor(texture, texture.demand), tailLevel(texture));
+            if(texture.dropped > texture.wanted && !texture.restoring)
+            {
+                wanting.push_back((int)t);
+            }
+        }
+    }
+
+    // The largest on screen first
+    sort(wanting.begin(), wanting.end(), [this](int a, int b) { return textures[a].demand > textures[b].demand; });
+    for(int t : wanting)
+    {
+        if(numRestoring >= maxRestoresInFlight)
+        {
+            break;
+        }
+        Texture& texture = textures[t];
+        if(makeRoom(reservedBytes + residentBytes(texture, restoreLevel(texture)) - texture.bytes))
+        {
+            restore(t);
+        }
+    }
+    // Over without restores too when the budget was lowered, or the load
+    // went past it
+    makeRoom(reservedBytes);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    return changed || numReductions + numEvictions != changes;
+}
+
+// Whether bytes more fit in the budget, after dropping what is least
+// needed: least recently used first, textures out of view down to their
+// tails and those in view down to what they need, then out of view evicted
+bool TextureLoader::makeRoom(long long bytes)
+{
+    if(budgetBytes <= 0 || gpuBytes + bytes <= budgetBytes)
+    {
+        return true;
+    }
+    vector<int> order;
+    for(size_t t = 0; t < textures.size(); t++)
+    {
+        const Texture& texture = textures[t];
+        if(isManaged(texture) && !texture.restoring && texture.dropped < texture.numLevels)
+        {
+            order.push_back((int)t);
+        }
+    }
+    sort(order.begin(), order.end(), [this](int a, int b) {
+        const Texture& first = textures[a];
+        const Texture& second = textures[b];
+        return first.used != second.used ? first.used < second.used : first.demand < second.demand;
+    });
+    for(int pass = 0; pass < 2; pass++)
+    {
+        for(int t : order)
+        {
+            Texture& texture = textures[t];
+            bool inView = texture.used == frame;
+            int dropped = pass == 0 ? (inView ? texture.wanted : tailLevel(texture)) : (inView ? 0 : texture.numLevels);
+            if(dropped <= texture.dropped)
+            {
+                continue;
+            }
+            reduce(texture, dropped);
+            if(gpuBytes + bytes <= budgetBytes)
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Copies the levels kept into a smaller texture on the GPU, or evicts the
+// texture when none are
+void TextureLoader::reduce(Texture& texture, int dropped)
+{
+    GLuint id = 0;
+    if(dropped < texture.numLevels)
+    {
+        GLenum binding = texture.cubemap ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+        int width = max(1, texture.width >> dropped), height = max(1, texture.height >> dropped);
+        int numLevels = texture.numLevels - dropped;
+        id = createTexture(texture);
+        glTexStorage2D(binding, numLevels, texture.compressed ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_RGB8, width, height);
+        for(int level = 0; level < numLevels; level++)
+        {
+            glCopyImageSubData(texture.id, binding, level + dropped - texture.dropped, 0, 0, 0, id, binding, level, 0, 0, 0,
+                max(1, width >> level), max(1, height >> level), texture.cubemap ? 6 : 1);
+        }
+        numReductions++;
+    }
+    else
+    {
+        texture.resident = false;
+        numResident--;
+        numEvictions++;
+    }
+    glDeleteTextures(1, &texture.id);
+    texture.id = id;
+    long long bytes = residentBytes(texture, dropped);
+    gpuBytes += bytes - texture.bytes;
+    texture.bytes = bytes;
+    texture.dropped = dropped;
+}
+
+// The first level a restore uploads: what the texture wants for cubes and
+// BC1 caches, while a 2D image is read and mipmapped whole
+int TextureLoader::restoreLevel(const Texture& texture)
+{
+    return texture.compressed || texture.cubemap ? texture.wanted : 0;
+}
+
+// Decodes the texture's image again on the job system, from its restore
+// level on. Its growth is reserved in the budget until the upload.
+void TextureLoader::restore(int index)
+{
+    Texture& texture = textures[index];
+    Image& image = images[texture.image];
+    image.dropLevels = restoreLevel(texture);
+    image.isCompressed = false;
+    image.compressed = KtxImage();
+    texture.reservedBytes = max(0LL, residentBytes(texture, image.dropLevels) - texture.bytes);
+    reservedBytes += texture.reservedBytes;
+    texture.restoring = true;
+    numRestoring++;
+    int imageIndex = texture.image;
+    jobs.run([this, imageIndex]() { decode(imageIndex); }, &decoding);
+}
+
+// A few decoded restores a frame, each into a new texture that replaces the
+// old one once it is specified
+bool TextureLoader::uploadRestored()
+{
+    vector<int> batch;
+    {
+        lock_guard<mutex> lock(readyMutex);
+        int count = min((int)ready.size(), maxRestoresPerFrame);
+        batch.assign(ready.begin(), ready.begin() + count);
+        ready.erase(ready.begin(), ready.begin() + count);
+    }
+    for(int index : batch)
+    {
+        Image& image = images[index];
+        Texture& texture = textures[image.texture];
+        GLuint previous = texture.id;
+        texture.id = createTexture(texture);
+        texture.pendingImages = 1;
+        if(upload(image))
+        {
+            glDeleteTextures(1, &previous);
+            if(!texture.resident)
+            {
+                texture.resident = true;
+                numResident++;
+            }
+            numRestores++;
+        }
+        else
+        {
+            glDeleteTextures(1, &texture.id);
+            texture.id = previous;
+        }
+        reservedBytes -= texture.reservedBytes;
+        texture.reservedBytes = 0;
+        texture.restoring = false;
+        numRestoring--;
+    }
+    return !batch.empty();
+}
+
+// Closing early leaves decodes running and images never uploaded; the jobs
+// must finish before the loader goes away
+void TextureLoader::stop()
+{
+    if(uploadThread.joinable())
+    {
+        {
+            lock_guard<mutex> lock(readyMutex);
+            stopping = true;
+        }
+        readyChanged.notify_all();
+        uploadThread.join();
+    }
+    jobs.wait(decoding);
+    for(Image& image : images)
+    {
+        stbi_image_free(image.data);
+        image.data = nullptr;
+    }
+    if(uploadWindow)
+    {
+        glfwDestroyWindow(uploadWindow);
+        uploadWindow = nullptr;
+    }
+}
+
+GLuint TextureLoader::getTexture(int texture)
+{
+    const Texture& value = textures[texture];
+    return value.resident ? value.id : value.cubemap ? placeholderCubemap : placeholder;
+}
+
+glm::vec3 TextureLoader::getAverageColor(int texture)
+{
+    return textures[texture].loaded ? textures[texture].averageColor : placeholderColor;
+}
+
+bool TextureLoader::isResident(int texture) {return textures[texture].resident;}
+bool TextureLoader::allResident() {return numResident == (int)textures.size();}
+
+// One line per image in upload order, then the totals: decode time summed
+// over the workers against the wall time shows what running them together saved
+void TextureLoader::printTimeline()
+{
+    double decodeMs = 0.0, uploadMs = 0.0;
+    cout << "Texture timeline (ms since start):" << endl;
+    vector<const Image*> order;
+    for(const Image& image : images)
+    {
+        order.push_back(&image);
+    }
+    sort(order.begin(), order.end(), [](const Image* a, const Image* b) {
+        return a->timing.uploadStart < b->timing.uploadStart;
+    });
+    for(const Image* image : order)
+    {
+        const TextureTiming& timing = image->timing;
+        char line[128];
+        snprintf(line, sizeof(line), "  decode %7.1f - %7.1f  upload %7.1f - %7.1f  %5dx%-5d %s ", timing.decodeStart,
+            timing.decodeEnd, timing.uploadStart, timing.uploadEnd, image->width, image->height,
+            image->isCompressed ? "BC1" : "RGB");
+        cout << line << image->path << endl;
+        decodeMs += timing.decodeEnd - timing.decodeStart;
+        uploadMs += timing.uploadEnd - timing.uploadStart;
+    }
+    cout << "Textures: " << images.size() << " images resident after " << totalMs << " ms, decode " << decodeMs
+        << " ms on " << jobs.getNumWorkers() << " workers, upload " << uploadMs << " ms, " << gpuBytes / (1024.0 * 1024.0)
+        << " MB of VRAM, " << numCompressed << " from KTX2" << endl;
+}
+
+// Residency is only counted once loaded, as until then the loader thread
+// is still specifying the textures
+TextureStats TextureLoader::collectStats()
+{
+    TextureStats stats = TextureStats();
+    for(const Texture& texture : textures)
+    {
+        if(!loadFinished || !isManaged(texture))
+        {
+            continue;
+        }
+        if(texture.dropped == texture.numLevels)
+        {
+            stats.evicted++;
+        }
+        else if(texture.dropped > 0)
+        {
+            stats.reduced++;
+        }
+        else
+        {
+            stats.full++;
+        }
+    }
+    stats.restoring = numRestoring;
+    stats.gpuBytes = gpuBytes;
+    stats.budgetBytes = budgetBytes;
+    stats.reductions = numReductions;
+    stats.evictions = numEvictions;
+    stats.restores = numRestores;
+    numReductions = numEvictions = numRestores = 0;
+    return stats;
+}
@@ -0,0 +1,69 @@
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include "../include/Transforms.h"
+#include "../include/FastMath.h"
+
+void Transforms::modelView(const glm::mat4& view, const float* x, const float* y, const float* z, const float* angles,
+    const float* scales, float* matrices, float* centerX, float* centerY, float* centerZ, int first, int count)
+{
+    // The view matrix as scalars, so the loop body is plain float arithmetic
+    const float a00 = view[0][0], a01 = view[0][1], a02 = view[0][2];
+    const float a10 = view[1][0], a11 = view[1][1], a12 = view[1][2];
+    const float a20 = view[2][0], a21 = view[2][1], a22 = view[2][2];
+    const float a30 = view[3][0], a31 = view[3][1], a32 = view[3][2];
+
+    // The rotation about y has columns (c, 0, -s), (0, 1, 0) and (s, 0, c),
+    // so the upper 3x3 of the product mixes the view's first and third
+    // columns and scales the second
+    #pragma omp simd
+    for(int i = first; i < first + count; i++)
+    {
+        float s, c;
+        FastMath::sincos(angles[i], s, c);
+        float scale = scales[i];
+        float cs = c * scale, ss = s * scale;
+
+        float tx = a00 * x[i] + a10 * y[i] + a20 * z[i] + a30;
+        float ty = a01 * x[i] + a11 * y[i] + a21 * z[i] + a31;
+        float tz = a02 * x[i] + a12 * y[i] + a22 * z[i] + a32;
+
+        float* m = matrices + 16 * (long)i;
+        m[0] = cs * a00 - ss * a20;
+        m[1] = cs * a01 - ss * a21;
+        m[2] = cs * a02 - ss * a22;
+        m[3] = 0.0f;
+        m[4] = scale * a10;
+        m[5] = scale * a11;
+        m[6] = scale * a12;
+        m[7] = 0.0f;
+        m[8] = ss * a00 + cs * a20;
+        m[9] = ss * a01 + cs * a21;
+        m[10] = ss * a02 + cs * a22;
+        m[11] = 0.0f;
+        m[12] = tx;
+        m[13] = ty;
+        m[14] = tz;
+        m[15] = 1.0f;
+
+        centerX[i] = tx;
+        centerY[i] = ty;
+        centerZ[i] = tz;
+    }
+}
+
+void Transforms::modelViewReference(const glm::mat4& view, const float* x, const float* y, const float* z,
+    const float* angles, const float* scales, float* matrices, int first, int count)
+{
+    for(int i = first; i < first + count; i++)
+    {
+        glm::mat4 mvMat = view * glm::translate(glm::mat4(1.0f), glm::vec3(x[i], y[i], z[i]));
+        mvMat *= glm::rotate(glm::mat4(1.0f), angles[i], glm::vec3(0.0, 1.0, 0.0));
+        mvMat *= glm::scale(glm::mat4(1.0f), scales[i] * glm::vec3(1.0f, 1.0f, 1.0f));
+        const float* values = glm::value_ptr(mvMat);
+        for(int k = 0; k < 16; k++)
+        {
+            matrices[16 * (long)i + k] = values[k];
+        }
+    }
+}
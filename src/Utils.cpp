@@ -5,6 +5,12 @@
 #include <iostream>
 #include <fstream>
 #include <cmath>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <sys/stat.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp> // glm::value_ptr
 #include <glm/gtc/matrix_transform.hpp> // glm::translate, glm::rotate, glm::scale, glm::perspective
@@ -15,9 +21,34 @@
 
 using namespace std;
 
+const AssetPack *Utils::assetPack = nullptr;
+string Utils::programCacheDirectory;
+int Utils::programsLoaded = 0, Utils::programsBuilt = 0;
+double Utils::programMs = 0.0;
+bool Utils::batchingPrograms = false, Utils::parallelCompile = false;
+vector<Utils::PendingProgram> Utils::pendingPrograms;
+
+// From GL_KHR_parallel_shader_compile or GL_ARB_parallel_shader_compile,
+// which the core profile glad was generated for leaves out
+typedef void (APIENTRY *MaxShaderCompilerThreadsProc)(GLuint count);
+
+// Start of a cached program binary, which follows it
+struct ProgramBinaryHeader
+{
+	char magic[4];		// "SSPB"
+	uint32_t format;	// as glGetProgramBinary gave it
+	uint32_t length;
+};
+
 Utils::Utils() {}
 
+void Utils::setAssetPack(const AssetPack *pack) {assetPack = pack;}
+
 string Utils::readShaderFile(const char *filePath) {
+	AssetEntry entry;
+	if (assetPack && assetPack->find(filePath, entry)) {
+		return string((const char*)entry.data, entry.size);
+	}
 	string content;
 	ifstream fileStream(filePath, ios::in);
 	string line = "";
@@ -53,16 +84,20 @@ void Utils::printShaderLog(GLuint shader) {
 	}
 }
 
-GLuint Utils::prepareShader(int shaderTYPE, const char *shaderPath)
+// Only submits the compile; checkShader reads its status
+GLuint Utils::prepareShader(int shaderTYPE, const string& source)
 {
-	GLint shaderCompiled;
-	string shaderStr = readShaderFile(shaderPath);
-	const char *shaderSrc = shaderStr.c_str();
+	const char *shaderSrc = source.c_str();
 	GLuint shaderRef = glCreateShader(shaderTYPE);
 	glShaderSource(shaderRef, 1, &shaderSrc, NULL);
 	glCompileShader(shaderRef);
-	checkOpenGLError();
-	glGetShaderiv(shaderRef, GL_COMPILE_STATUS, &shaderCompiled);
+	return shaderRef;
+}
+
+bool Utils::checkShader(GLenum shaderTYPE, GLuint shader)
+{
+	GLint shaderCompiled;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &shaderCompiled);
 	if (shaderCompiled != 1)
 	{
 		if (shaderTYPE == 35633) cout << "Vertex ";
@@ -70,10 +105,12 @@ GLuint Utils::prepareShader(int shaderTYPE, const char *shaderPath)
 		if (shaderTYPE == 36487) cout << "Tess Eval ";
 		if (shaderTYPE == 36313) cout << "Geometry ";
 		if (shaderTYPE == 35632) cout << "Fragment ";
+		if (shaderTYPE == 37305) cout << "Compute ";
 		cout << "shader compilation error." << endl;
-		printShaderLog(shaderRef);
+		printShaderLog(shader);
+		return false;
 	}
-	return shaderRef;
+	return true;
 }
 
 void Utils::printProgramLog(int prog) {
@@ -89,81 +126,309 @@ void Utils::printProgramLog(int prog) {
 	}
 }
 
-int Utils::finalizeShaderProgram(GLuint sprogram)
+GLuint Utils::createShaderProgram(const char *vp, const char *fp) {
+	return buildProgram({ GL_VERTEX_SHADER, GL_FRAGMENT_SHADER }, { vp, fp });
+}
+
+GLuint Utils::createShaderProgram(const char *vp, const char *gp, const char *fp) {
+	return buildProgram({ GL_VERTEX_SHADER, GL_GEOMETRY_SHADER, GL_FRAGMENT_SHADER }, { vp, gp, fp });
+}
+
+GLuint Utils::createShaderProgram(const char *vp, const char *tCS, const char* tES, const char *fp) {
+	return buildProgram({ GL_VERTEX_SHADER, GL_TESS_CONTROL_SHADER, GL_TESS_EVALUATION_SHADER, GL_FRAGMENT_SHADER },
+		{ vp, tCS, tES, fp });
+}
+
+GLuint Utils::createShaderProgram(const char *vp, const char *tCS, const char* tES, char *gp, const char *fp) {
+	return buildProgram({ GL_VERTEX_SHADER, GL_TESS_CONTROL_SHADER, GL_TESS_EVALUATION_SHADER, GL_GEOMETRY_SHADER,
+		GL_FRAGMENT_SHADER }, { vp, tCS, tES, gp, fp });
+}
+
+GLuint Utils::createComputeProgram(const char *cp) {
+	return buildProgram({ GL_COMPUTE_SHADER }, { cp });
+}
+
+// From the program cache when it holds a binary the driver takes, else
+// compiled and linked, and the binary stored for the next run once
+// finishPrograms finds it linked
+GLuint Utils::buildProgram(const vector<GLenum>& types, const vector<const char*>& paths)
 {
-	GLint linked;
-	glLinkProgram(sprogram);
+	auto start = chrono::steady_clock::now();
+	vector<string> sources;
+	for (const char *path : paths)
+	{
+		sources.push_back(readShaderFile(path));
+	}
+
+	GLint numFormats = 0;
+	string cachePath;
+	if (!programCacheDirectory.empty())
+	{
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+	}
+	if (numFormats > 0)
+	{
+		cachePath = programCachePath(types, sources);
+		GLuint program = glCreateProgram();
+		if (loadProgramBinary(program, cachePath))
+		{
+			programsLoaded++;
+			programMs += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+			return program;
+		}
+		glDeleteProgram(program);
+	}
+
+	PendingProgram pending;
+	pending.program = glCreateProgram();
+	pending.types = types;
+	pending.cachePath = cachePath;
+	for (size_t i = 0; i < types.size(); i++)
+	{
+		pending.shaders.push_back(prepareShader(types[i], sources[i]));
+		glAttachShader(pending.program, pending.shaders.back());
+	}
+	if (!cachePath.empty())
+	{
+		glProgramParameteri(pending.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+	glLinkProgram(pending.program);
+	pendingPrograms.push_back(pending);
+	programsBuilt++;
+	programMs += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	if (!batchingPrograms)
+	{
+		finishPrograms();
+	}
+	return pending.program;
+}
+
+void Utils::beginPrograms()
+{
+	batchingPrograms = true;
+	MaxShaderCompilerThreadsProc maxThreads = nullptr;
+	if (glfwExtensionSupported("GL_KHR_parallel_shader_compile") == GLFW_TRUE)
+	{
+		maxThreads = (MaxShaderCompilerThreadsProc)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+	}
+	else if (glfwExtensionSupported("GL_ARB_parallel_shader_compile") == GLFW_TRUE)
+	{
+		maxThreads = (MaxShaderCompilerThreadsProc)glfwGetProcAddress("glMaxShaderCompilerThreadsARB");
+	}
+	parallelCompile = maxThreads != nullptr;
+	if (parallelCompile)
+	{
+		// As many as the implementation likes
+		maxThreads(0xFFFFFFFF);
+	}
+}
+
+void Utils::endPrograms()
+{
+	batchingPrograms = false;
+	finishPrograms();
+}
+
+// With parallel compilation the driver's threads are polled until every
+// program is done, so the wait is that of the slowest one; status is read
+// only then. Without it, the status queries wait for each program in turn.
+void Utils::finishPrograms()
+{
+	auto start = chrono::steady_clock::now();
+	if (parallelCompile)
+	{
+		size_t next = 0;
+		while (next < pendingPrograms.size())
+		{
+			GLint complete = GL_FALSE;
+			glGetProgramiv(pendingPrograms[next].program, GL_COMPLETION_STATUS_KHR, &complete);
+			if (complete == GL_TRUE)
+			{
+				next++;
+			}
+			else
+			{
+				this_thread::sleep_for(chrono::microseconds(100));
+			}
+		}
+	}
+
+	for (PendingProgram& pending : pendingPrograms)
+	{
+		for (size_t i = 0; i < pending.shaders.size(); i++)
+		{
+			checkShader(pending.types[i], pending.shaders[i]);
+			// Freed with the program; it is not needed once linked
+			glDeleteShader(pending.shaders[i]);
+		}
+		GLint linked;
+		glGetProgramiv(pending.program, GL_LINK_STATUS, &linked);
+		if (linked != GL_TRUE)
+		{
+			cout << "linking failed" << endl;
+			printProgramLog(pending.program);
+		}
+		else if (!pending.cachePath.empty())
+		{
+			saveProgramBinary(pending.program, pending.cachePath);
+		}
+	}
 	checkOpenGLError();
-	glGetProgramiv(sprogram, GL_LINK_STATUS, &linked);
-	if (linked != 1)
+	pendingPrograms.clear();
+	programMs += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+void Utils::setProgramCache(const char *directory)
+{
+	programCacheDirectory = directory ? directory : "";
+	if (directory)
 	{
-		cout << "linking failed" << endl;
-		printProgramLog(sprogram);
+		mkdir(directory, 0755);
 	}
-	return sprogram;
 }
 
-GLuint Utils::createShaderProgram(const char *vp, const char *fp) {
-	GLuint vShader = prepareShader(GL_VERTEX_SHADER, vp);
-	GLuint fShader = prepareShader(GL_FRAGMENT_SHADER, fp);
-	GLuint vfprogram = glCreateProgram();
-	glAttachShader(vfprogram, vShader);
-	glAttachShader(vfprogram, fShader);
-	finalizeShaderProgram(vfprogram);
-	return vfprogram;
+// FNV-1a
+static uint64_t hashBytes(uint64_t hash, const void *data, size_t size)
+{
+	const unsigned char *bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	}
+	return hash;
 }
 
-GLuint Utils::createShaderProgram(const char *vp, const char *gp, const char *fp) {
-	GLuint vShader = prepareShader(GL_VERTEX_SHADER, vp);
-	GLuint gShader = prepareShader(GL_GEOMETRY_SHADER, gp);
-	GLuint fShader = prepareShader(GL_FRAGMENT_SHADER, fp);
-	GLuint vgfprogram = glCreateProgram();
-	glAttachShader(vgfprogram, vShader);
-	glAttachShader(vgfprogram, gShader);
-	glAttachShader(vgfprogram, fShader);
-	finalizeShaderProgram(vgfprogram);
-	return vgfprogram;
+// Named by the hash, so an edited shader or another driver finds no binary
+// rather than a stale one
+string Utils::programCachePath(const vector<GLenum>& types, const vector<string>& sources)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	const GLenum driverStrings[3] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+	for (GLenum name : driverStrings)
+	{
+		const char *value = (const char*)glGetString(name);
+		string text = value ? value : "";
+		hash = hashBytes(hash, text.c_str(), text.size() + 1);
+	}
+	for (size_t i = 0; i < types.size(); i++)
+	{
+		hash = hashBytes(hash, &types[i], sizeof(types[i]));
+		hash = hashBytes(hash, sources[i].c_str(), sources[i].size() + 1);
+	}
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long)hash);
+	return programCacheDirectory + name;
 }
 
-GLuint Utils::createShaderProgram(const char *vp, const char *tCS, const char* tES, const char *fp) {
-	GLuint vShader = prepareShader(GL_VERTEX_SHADER, vp);
-	GLuint tcShader = prepareShader(GL_TESS_CONTROL_SHADER, tCS);
-	GLuint teShader = prepareShader(GL_TESS_EVALUATION_SHADER, tES);
-	GLuint fShader = prepareShader(GL_FRAGMENT_SHADER, fp);
-	GLuint vtfprogram = glCreateProgram();
-	glAttachShader(vtfprogram, vShader);
-	glAttachShader(vtfprogram, tcShader);
-	glAttachShader(vtfprogram, teShader);
-	glAttachShader(vtfprogram, fShader);
-	finalizeShaderProgram(vtfprogram);
-	return vtfprogram;
+// A driver may still reject a binary of its own, as after an update that
+// kept the version string
+bool Utils::loadProgramBinary(GLuint program, const string& path)
+{
+	ifstream file(path, ios::binary);
+	ProgramBinaryHeader header;
+	if (!file || !file.read((char*)&header, sizeof(header)) || memcmp(header.magic, "SSPB", 4) != 0)
+	{
+		return false;
+	}
+
+	// The length is only trusted as far as the file goes, so a corrupt
+	// header cannot ask for more than the file holds
+	streampos start = file.tellg();
+	file.seekg(0, ios::end);
+	streamoff remaining = file.tellg() - start;
+	file.seekg(start);
+	if (header.length == 0 || (streamoff)header.length > remaining)
+	{
+		return false;
+	}
+	vector<char> binary(header.length);
+	if (!file.read(binary.data(), header.length))
+	{
+		return false;
+	}
+
+	// Errors from before are reported, so that only the binary's own are
+	// dropped below
+	checkOpenGLError();
+	glProgramBinary(program, header.format, binary.data(), (GLsizei)header.length);
+	GLint linked;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if (linked != GL_TRUE)
+	{
+		// An unknown format is also a GL error; it is expected here
+		while (glGetError() != GL_NO_ERROR) {}
+		cout << "Program binary " << path << " rejected, rebuilding" << endl;
+		return false;
+	}
+	return true;
 }
 
-GLuint Utils::createShaderProgram(const char *vp, const char *tCS, const char* tES, char *gp, const char *fp) {
-	GLuint vShader = prepareShader(GL_VERTEX_SHADER, vp);
-	GLuint tcShader = prepareShader(GL_TESS_CONTROL_SHADER, tCS);
-	GLuint teShader = prepareShader(GL_TESS_EVALUATION_SHADER, tES);
-	GLuint gShader = prepareShader(GL_GEOMETRY_SHADER, gp);
-	GLuint fShader = prepareShader(GL_FRAGMENT_SHADER, fp);
-	GLuint vtgfprogram = glCreateProgram();
-	glAttachShader(vtgfprogram, vShader);
-	glAttachShader(vtgfprogram, tcShader);
-	glAttachShader(vtgfprogram, teShader);
-	glAttachShader(vtgfprogram, gShader);
-	glAttachShader(vtgfprogram, fShader);
-	finalizeShaderProgram(vtgfprogram);
-	return vtgfprogram;
+void Utils::saveProgramBinary(GLuint program, const string& path)
+{
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+	{
+		return;
+	}
+	vector<char> binary(length);
+	GLsizei written = 0;
+	GLenum format = 0;
+	glGetProgramBinary(program, length, &written, &format, binary.data());
+
+	ProgramBinaryHeader header;
+	memcpy(header.magic, "SSPB", 4);
+	header.format = format;
+	header.length = (uint32_t)written;
+	ofstream file(path, ios::binary);
+	file.write((const char*)&header, sizeof(header));
+	file.write(binary.data(), written);
+	if (!file)
+	{
+		cout << "Failed to write " << path << endl;
+	}
 }
 
+void Utils::printProgramStats()
+{
+	cout << "Shaders: " << programsLoaded + programsBuilt << " programs, " << programsLoaded << " from binaries, "
+		<< programsBuilt << " built" << (parallelCompile ? " in parallel, " : ", ") << programMs << " ms" << endl;
+}
+
+bool Utils::compressionSupported()
+{
+	return glfwExtensionSupported("GL_EXT_texture_compression_s3tc") == GLFW_TRUE;
+}
+
+void Utils::uploadCompressed(GLenum target, const KtxImage& image, const unsigned char *source, int face, int firstLevel)
+{
+	for(int level = firstLevel; level < image.numLevels; level++)
+	{
+		int levelWidth = std::max(1, image.width >> level), levelHeight = std::max(1, image.height >> level);
+		int entry = level * image.numFaces + face;
+		glCompressedTexImage2D(target, level - firstLevel, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, levelWidth, levelHeight, 0,
+			(GLsizei)image.levelSizes[entry], source + image.levelOffsets[entry]);
+	}
+}
+
+// Faces and textures with a current KTX2 cache (see ktxconvert) are read from
+// it, already compressed, instead of being decoded
 GLuint Utils::loadCubemap(vector<std::string> faces)
 {
     unsigned int textureID;
     glGenTextures(1, &textureID);
     glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 	stbi_set_flip_vertically_on_load(false);
+	bool compressed = compressionSupported();
     int width, height, nrChannels;
     for (unsigned int i = 0; i < faces.size(); i++)
     {
+		KtxImage image;
+		if(compressed && Ktx::isCurrent(faces[i]) && Ktx::load(Ktx::cachePath(faces[i]).c_str(), image) && image.numFaces == 1)
+		{
+			uploadCompressed(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, image, image.bytes);
+			continue;
+		}
         unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
         if (data)
         {
@@ -188,12 +453,28 @@ GLuint Utils::loadCubemap(vector<std::string> faces)
 }
 
 GLuint Utils::loadTexture(const char *texImagePath)
+{
+	glm::vec3 averageColor;
+	return loadTexture(texImagePath, averageColor);
+}
+
+GLuint Utils::loadTexture(const char *texImagePath, glm::vec3& averageColor)
 {
 	GLuint textureRef;
 	glGenTextures(1, &textureRef);
 	glBindTexture(GL_TEXTURE_2D, textureRef);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 
+	KtxImage image;
+	if(compressionSupported() && Ktx::isCurrent(texImagePath) && Ktx::load(Ktx::cachePath(texImagePath).c_str(), image)
+		&& image.numFaces == 1)
+	{
+		uploadCompressed(GL_TEXTURE_2D, image, image.bytes);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image.numLevels - 1);
+		averageColor = image.hasAverageColor ? glm::vec3(image.averageColor[0], image.averageColor[1], image.averageColor[2]) : glm::vec3(1.0f, 1.0f, 1.0f);
+		return textureRef;
+	}
+
 	stbi_set_flip_vertically_on_load(true);
 
 	int width, height, nrChannels;
@@ -202,10 +483,12 @@ GLuint Utils::loadTexture(const char *texImagePath)
 	{
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
 		glGenerateMipmap(GL_TEXTURE_2D);
+		averageColor = Utils::averageColor(data, width, height, nrChannels);
 	}
 	else
 	{
 		std::cout << "Failed to Load Texture" << std::endl;
+		averageColor = glm::vec3(1.0f, 1.0f, 1.0f);
 	}
 
 	stbi_image_free(data); 
@@ -228,6 +511,20 @@ GLuint Utils::loadTexture(const char *texImagePath)
 	return textureRef;
 }
 
+glm::vec3 Utils::averageColor(const unsigned char *data, int width, int height, int channels)
+{
+	double sum[3] = { 0.0, 0.0, 0.0 };
+	long numTexels = (long)width * height;
+	for(long i = 0; i < numTexels; i++)
+	{
+		for(int c = 0; c < 3; c++)
+		{
+			sum[c] += data[i * channels + (channels < 3 ? 0 : c)];
+		}
+	}
+	return glm::vec3((float)sum[0], (float)sum[1], (float)sum[2]) / (255.0f * numTexels);
+}
+
 // GOLD material - ambient, diffuse, specular, and shininess
 float* Utils::goldAmbient() { static float a[4] = { 0.2473f, 0.1995f, 0.0745f, 1 }; return (float*)a; }
 float* Utils::goldDiffuse() { static float a[4] = { 0.7516f, 0.6065f, 0.2265f, 1 }; return (float*)a; }
@@ -0,0 +1,450 @@
+#include <cstring>
+#include <climits>
+#include <iostream>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/VirtualTexture.h"
+#include "../include/Utils.h"
+#include "../include/Ktx.h"
+
+using namespace std;
+
+static const char pyramidMagic[4] = { 'S', 'S', 'V', '1' };
+
+// Page table texels: cache slot column and row, level of the tile, and a
+// marker that the entry is set
+static uint32_t pageEntry(int slotX, int slotY, int level)
+{
+    return (uint32_t)slotX | (uint32_t)slotY << 8 | (uint32_t)level << 16 | 255u << 24;
+}
+
+VirtualTexture::VirtualTexture(JobSystem& jobs) : jobs(jobs), mapping(nullptr), mappingSize(0), header(), numTiles(0),
+    cacheTiles(0), compressed(false), cacheTexture(0), pageTable(0), feedbackBuffer(0), readbackBuffer(0),
+    readbackFence(0), feedbackRound(0), frame(0), pageTableDirty(false), numReading(0), numUploaded(0), numEvicted(0) {}
+
+// GL objects need the context, which is gone by now; only the reads and the
+// mapping are left to clean up
+VirtualTexture::~VirtualTexture()
+{
+    jobs.wait(reading);
+    if(mapping)
+    {
+        munmap((void*)mapping, mappingSize);
+    }
+}
+
+bool VirtualTexture::isVirtual(const string& path)
+{
+    return path.size() > 3 && path.compare(path.size() - 3, 3, ".vt") == 0;
+}
+
+bool VirtualTexture::open(const char *filePath, int cacheTiles)
+{
+    path = filePath;
+    int file = ::open(filePath, O_RDONLY);
+    if(file < 0)
+    {
+        cout << "Failed to open virtual texture: " << filePath << endl;
+        return false;
+    }
+    struct stat info;
+    if(fstat(file, &info) != 0 || (size_t)info.st_size < sizeof(header))
+    {
+        cout << filePath << ": not a virtual texture" << endl;
+        ::close(file);
+        return false;
+    }
+    void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    ::close(file);
+    if(data == MAP_FAILED)
+    {
+        cout << "Failed to map virtual texture: " << filePath << endl;
+        return false;
+    }
+    mapping = (const unsigned char*)data;
+    mappingSize = info.st_size;
+    // Tiles are read where the views go, not front to back
+    madvise(data, mappingSize, MADV_RANDOM);
+
+    memcpy(&header, mapping, sizeof(header));
+    bool valid = memcmp(header.magic, pyramidMagic, sizeof(pyramidMagic)) == 0 && header.width >= tileSize
+        && header.height >= tileSize && (header.width & (header.width - 1)) == 0
+        && (header.height & (header.height - 1)) == 0 && header.numLevels > 0 && header.numLevels <= numLevelsMax;
+    int tilesX = valid ? header.width / tileSize : 1, tilesY = valid ? header.height / tileSize : 1;
+    numTiles = 0;
+    for(int level = 0; valid && level < header.numLevels; level++)
+    {
+        levelFirstTile.push_back(numTiles);
+        levelTilesX.push_back(tilesX);
+        levelTilesY.push_back(tilesY);
+        numTiles += tilesX * tilesY;
+        tilesX = max(1, tilesX / 2);
+        tilesY = max(1, tilesY / 2);
+    }
+    valid = valid && levelTilesX.back() == 1 && levelTilesY.back() == 1
+        && header.dataOffset + (uint64_t)numTiles * tileBytes <= mappingSize;
+    if(!valid)
+    {
+        cout << filePath << ": corrupt virtual texture" << endl;
+        close();
+        return false;
+    }
+
+    // The page table stores slot coordinates in a byte each
+    GLint maxSize;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    this->cacheTiles = min(min(cacheTiles, maxSize / tileTexels), 256);
+    int cacheSize = this->cacheTiles * tileTexels;
+    compressed = Utils::compressionSupported();
+
+    glGenTextures(1, &cacheTexture);
+    glBindTexture(GL_TEXTURE_2D, cacheTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, compressed ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_RGB8, cacheSize, cacheSize);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // Integer textures are only complete with nearest filtering
+    glGenTextures(1, &pageTable);
+    glBindTexture(GL_TEXTURE_2D, pageTable);
+    glTexStorage2D(GL_TEXTURE_2D, header.numLevels, GL_RGBA8UI, levelTilesX[0], levelTilesY[0]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // One bit per tile
+    vector<uint32_t> zeros((numTiles + 31) / 32, 0);
+    glGenBuffers(1, &feedbackBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, feedbackBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, zeros.size() * sizeof(uint32_t), zeros.data(), GL_DYNAMIC_COPY);
+    glGenBuffers(1, &readbackBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, readbackBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, zeros.size() * sizeof(uint32_t), NULL, GL_STREAM_READ);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    tileSlots.assign(numTiles, -1);
+    tileLoading.assign(numTiles, 0);
+    slotTiles.assign(this->cacheTiles * this->cacheTiles, -1);
+    slotUsed.assign(slotTiles.size(), 0);
+
+    // The top tile is pinned
+    vector<unsigned char> top;
+    readTile(numTiles - 1, top);
+    uploadTile(numTiles - 1, top, 0);
+    slotUsed[0] = LLONG_MAX;
+    writePageTable();
+    return true;
+}
+
+void VirtualTexture::close()
+{
+    jobs.wait(reading);
+    loaded.clear();
+    if(readbackFence)
+    {
+        glDeleteSync(readbackFence);
+        readbackFence = 0;
+    }
+    if(cacheTexture)
+    {
+        glDeleteTextures(1, &cacheTexture);
+        glDeleteTextures(1, &pageTable);
+        glDeleteBuffers(1, &feedbackBuffer);
+        glDeleteBuffers(1, &readbackBuffer);
+        cacheTexture = pageTable = feedbackBuffer = readbackBuffer = 0;
+    }
+    if(mapping)
+    {
+        munmap((void*)mapping, mappingSize);
+        mapping = nullptr;
+        mappingSize = 0;
+    }
+}
+
+int VirtualTexture::tileIndex(int level, int x, int y)
+{
+    return levelFirstTile[level] + y * levelTilesX[level] + x;
+}
+
+const unsigned char *VirtualTexture::tileData(int tile)
+{
+    return mapping + header.dataOffset + (size_t)tile * tileBytes;
+}
+
+// On a worker: the copy out of the mapping is where the file is read. A
+// cache without BC1 support gets the tile decoded.
+void VirtualTexture::readTile(int tile, vector<unsigned char>& data)
+{
+    const unsigned char *blocks = tileData(tile);
+    if(compressed)
+    {
+        data.assign(blocks, blocks + tileBytes);
+        return;
+    }
+    const int blocksAcross = tileTexels / 4;
+    data.resize(tileTexels * tileTexels * 3);
+    for(int b = 0; b < blocksAcross * blocksAcross; b++)
+    {
+        unsigned char texels[16][3];
+        Ktx::decodeBlock(blocks + b * Ktx::blockBytes, texels);
+        for(int i = 0; i < 16; i++)
+        {
+            int x = b % blocksAcross * 4 + i % 4, y = b / blocksAcross * 4 + i / 4;
+            memcpy(&data[(y * tileTexels + x) * 3], texels[i], 3);
+        }
+    }
+}
+
+void VirtualTexture::update()
+{
+    if(!cacheTexture)
+    {
+        return;
+    }
+    frame++;
+
+    // The copy of earlier feedback, once the GPU has made it
+    if(readbackFence)
+    {
+        GLenum status = glClientWaitSync(readbackFence, 0, 0);
+        if(status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+        {
+            glDeleteSync(readbackFence);
+            readbackFence = 0;
+            glBindBuffer(GL_COPY_READ_BUFFER, readbackBuffer);
+            GLsizeiptr size = (numTiles + 31) / 32 * sizeof(uint32_t);
+            const uint32_t *requested = (const uint32_t*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, size, GL_MAP_READ_BIT);
+            if(requested)
+            {
+                processFeedback(requested);
+                glUnmapBuffer(GL_COPY_READ_BUFFER);
+            }
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        }
+    }
+
+    // Feedback gathers over the frames until the previous copy is read, then
+    // is copied and starts over
+    if(!readbackFence)
+    {
+        GLsizeiptr size = (numTiles + 31) / 32 * sizeof(uint32_t);
+        glBindBuffer(GL_COPY_READ_BUFFER, feedbackBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, readbackBuffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, size);
+        glClearBufferData(GL_COPY_READ_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        readbackFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    uploadTiles();
+    if(pageTableDirty)
+    {
+        writePageTable();
+    }
+}
+
+// A requested tile that is resident, or else the ancestor drawn in its
+// place, counts as used this round; missing tiles are read in
+void VirtualTexture::processFeedback(const uint32_t *requested)
+{
+    feedbackRound++;
+    vector<int> missing;
+    for(int word = 0; word < (numTiles + 31) / 32; word++)
+    {
+        for(uint32_t bits = requested[word]; bits != 0; bits &= bits - 1)
+        {
+            int tile = word * 32 + __builtin_ctz(bits);
+            if(tile >= numTiles)
+            {
+                break;
+            }
+            int level = (int)(upper_bound(levelFirstTile.begin(), levelFirstTile.end(), tile) - levelFirstTile.begin()) - 1;
+            int x = (tile - levelFirstTile[level]) % levelTilesX[level];
+            int y = (tile - levelFirstTile[level]) / levelTilesX[level];
+            if(tileSlots[tile] < 0 && !tileLoading[tile])
+            {
+                missing.push_back(tile);
+            }
+            int used = tile;
+            while(tileSlots[used] < 0)
+            {
+                level++;
+                x = min(x / 2, levelTilesX[level] - 1);
+                y = min(y / 2, levelTilesY[level] - 1);
+                used = tileIndex(level, x, y);
+            }
+            slotUsed[tileSlots[used]] = max(slotUsed[tileSlots[used]], feedbackRound);
+        }
+    }
+    requestTiles(missing);
+}
+
+// Coarse levels first: they stand in for more of the missing tiles
+void VirtualTexture::requestTiles(vector<int>& missing)
+{
+    sort(missing.begin(), missing.end(), [](int a, int b) { return a > b; });
+    for(int tile : missing)
+    {
+        if(numReading >= maxReadsInFlight)
+        {
+            break;
+        }
+        tileLoading[tile] = 1;
+        numReading++;
+        jobs.run([this, tile]() {
+            LoadedTile result;
+            result.tile = tile;
+            readTile(tile, result.data);
+            lock_guard<mutex> lock(loadedMutex);
+            loaded.push_back(move(result));
+        }, &reading);
+    }
+}
+
+void VirtualTexture::uploadTiles()
+{
+    vector<LoadedTile> batch;
+    {
+        lock_guard<mutex> lock(loadedMutex);
+        size_t count = min(loaded.size(), (size_t)maxUploadsPerFrame);
+        move(loaded.begin(), loaded.begin() + count, back_inserter(batch));
+        loaded.erase(loaded.begin(), loaded.begin() + count);
+    }
+    for(LoadedTile& tile : batch)
+    {
+        numReading--;
+        tileLoading[tile.tile] = 0;
+        // With every slot needed by the latest feedback the tile is dropped;
+        // it is requested again while it is still in view
+        int slot = findSlot();
+        if(slot >= 0)
+        {
+            uploadTile(tile.tile, tile.data, slot);
+        }
+    }
+}
+
+void VirtualTexture::uploadTile(int tile, const vector<unsigned char>& data, int slot)
+{
+    int x = slot % cacheTiles * tileTexels, y = slot / cacheTiles * tileTexels;
+    glBindTexture(GL_TEXTURE_2D, cacheTexture);
+    if(compressed)
+    {
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, x, y, tileTexels, tileTexels, GL_COMPRESSED_RGB_S3TC_DXT1_EXT,
+            tileBytes, data.data());
+    }
+    else
+    {
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, tileTexels, tileTexels, GL_RGB, GL_UNSIGNED_BYTE, data.data());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    tileSlots[tile] = slot;
+    slotTiles[slot] = tile;
+    slotUsed[slot] = feedbackRound;
+    pageTableDirty = true;
+    numUploaded++;
+}
+
+// A free slot, else the least recently used one not needed by the latest
+// feedback
+int VirtualTexture::findSlot()
+{
+    int victim = -1;
+    for(int slot = 0; slot < (int)slotTiles.size(); slot++)
+    {
+        if(slotTiles[slot] < 0)
+        {
+            return slot;
+        }
+        if(slotUsed[slot] < feedbackRound && (victim < 0 || slotUsed[slot] < slotUsed[victim]))
+        {
+            victim = slot;
+        }
+    }
+    if(victim >= 0)
+    {
+        tileSlots[slotTiles[victim]] = -1;
+        slotTiles[victim] = -1;
+        numEvicted++;
+    }
+    return victim;
+}
+
+// From the top down, a tile that is not resident takes its parent's entry
+void VirtualTexture::writePageTable()
+{
+    vector<uint32_t> parents, entries;
+    glBindTexture(GL_TEXTURE_2D, pageTable);
+    for(int level = header.numLevels - 1; level >= 0; level--)
+    {
+        int tilesX = levelTilesX[level], tilesY = levelTilesY[level];
+        entries.resize(tilesX * tilesY);
+        for(int y = 0; y < tilesY; y++)
+        {
+            for(int x = 0; x < tilesX; x++)
+            {
+                int slot = tileSlots[tileIndex(level, x, y)];
+                if(slot >= 0)
+                {
+                    entries[y * tilesX + x] = pageEntry(slot % cacheTiles, slot / cacheTiles, level);
+                }
+                else
+                {
+                    int parentX = min(x / 2, levelTilesX[level + 1] - 1), parentY = min(y / 2, levelTilesY[level + 1] - 1);
+                    entries[y * tilesX + x] = parents[parentY * levelTilesX[level + 1] + parentX];
+                }
+            }
+        }
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, tilesX, tilesY, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, entries.data());
+        parents.swap(entries);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    pageTableDirty = false;
+}
+
+void VirtualTexture::bind(GLuint program)
+{
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, pageTable);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, cacheTexture);
+    glActiveTexture(GL_TEXTURE0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, feedbackBuffer);
+    glUniform2i(glGetUniformLocation(program, "vt_tiles"), levelTilesX[0], levelTilesY[0]);
+    glUniform1i(glGetUniformLocation(program, "vt_levels"), header.numLevels);
+    glUniform1i(glGetUniformLocation(program, "vt_cache_tiles"), cacheTiles);
+    glUniform1i(glGetUniformLocation(program, "vt_frame"), frame);
+}
+
+glm::vec3 VirtualTexture::getAverageColor()
+{
+    return glm::vec3(header.averageColor[0], header.averageColor[1], header.averageColor[2]);
+}
+
+// BC1 is half a byte a texel; uncompressed RGB8 is stored as four bytes
+long long VirtualTexture::getCacheBytes()
+{
+    long long texels = (long long)cacheTiles * tileTexels * cacheTiles * tileTexels;
+    return compressed ? texels / 2 : texels * 4;
+}
+
+void VirtualTexture::printStats()
+{
+    int resident = 0;
+    for(int tile : slotTiles)
+    {
+        resident += tile >= 0;
+    }
+    cout << path << ": " << header.width << "x" << header.height << ", " << resident << " of " << numTiles
+        << " tiles resident, " << numUploaded << " uploaded, " << numEvicted << " evicted, cache "
+        << getCacheBytes() / (1024.0 * 1024.0) << " MB" << (compressed ? " BC1" : " RGB") << endl;
+}
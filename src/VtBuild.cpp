@@ -0,0 +1,242 @@
+#include <cmath>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#define STB_IMAGE_IMPLEMENTATION
+#include "../include/stb_image.h"
+#include "../include/VirtualTexture.h"
+#include "../include/Ktx.h"
+
+using namespace std;
+
+// Virtual texture builder: writes the tile pyramid of each equirectangular
+// map next to it, with a .vt extension, for use as a catalog texture.
+//
+//   vtbuild.exec image...
+//
+// Maps are flipped for OpenGL like the other planet textures and resampled
+// to the nearest power-of-two sides. Tiles are BC1; their borders wrap
+// around in longitude and repeat the edge at the poles.
+
+static const int tileSize = VirtualTexture::tileSize;
+static const int border = VirtualTexture::border;
+static const int tileTexels = VirtualTexture::tileTexels;
+
+static double elapsedMs(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+static string pyramidPath(const string& imagePath)
+{
+    size_t slash = imagePath.find_last_of('/');
+    size_t dot = imagePath.find_last_of('.');
+    if(dot == string::npos || (slash != string::npos && dot < slash))
+    {
+        return imagePath + ".vt";
+    }
+    return imagePath.substr(0, dot) + ".vt";
+}
+
+static int nearestPowerOfTwo(int size)
+{
+    int power = 1 << (int)lround(log2((double)size));
+    return power < tileSize ? tileSize : power;
+}
+
+// Bilinear, to RGB; a copy when the size is unchanged
+static void resample(const unsigned char *texels, int width, int height, int channels, int targetWidth,
+    int targetHeight, vector<unsigned char>& target)
+{
+    target.resize((size_t)targetWidth * targetHeight * 3);
+    #pragma omp parallel for
+    for(int y = 0; y < targetHeight; y++)
+    {
+        double sy = min(max((y + 0.5) * height / targetHeight - 0.5, 0.0), height - 1.0);
+        int y0 = (int)sy, y1 = min(y0 + 1, height - 1);
+        double fy = sy - y0;
+        for(int x = 0; x < targetWidth; x++)
+        {
+            double sx = (x + 0.5) * width / targetWidth - 0.5;
+            int x0 = (int)floor(sx);
+            double fx = sx - x0;
+            int x1 = (x0 + 1) % width;
+            x0 = (x0 + width) % width;
+            for(int c = 0; c < 3; c++)
+            {
+                int channel = channels < 3 ? 0 : c;
+                double top = texels[((size_t)y0 * width + x0) * channels + channel] * (1.0 - fx)
+                    + texels[((size_t)y0 * width + x1) * channels + channel] * fx;
+                double bottom = texels[((size_t)y1 * width + x0) * channels + channel] * (1.0 - fx)
+                    + texels[((size_t)y1 * width + x1) * channels + channel] * fx;
+                target[((size_t)y * targetWidth + x) * 3 + c] = (unsigned char)(top * (1.0 - fy) + bottom * fy + 0.5);
+            }
+        }
+    }
+}
+
+// Halves the sides that are longer than a tile, as the levels' tile counts do
+static void downsample(const vector<unsigned char>& level, int width, int height, int targetWidth, int targetHeight,
+    vector<unsigned char>& target)
+{
+    int stepX = width / targetWidth, stepY = height / targetHeight;
+    target.resize((size_t)targetWidth * targetHeight * 3);
+    #pragma omp parallel for
+    for(int y = 0; y < targetHeight; y++)
+    {
+        for(int x = 0; x < targetWidth; x++)
+        {
+            for(int c = 0; c < 3; c++)
+            {
+                int sum = 0;
+                for(int j = 0; j < stepY; j++)
+                {
+                    for(int i = 0; i < stepX; i++)
+                    {
+                        sum += level[((size_t)(y * stepY + j) * width + x * stepX + i) * 3 + c];
+                    }
+                }
+                target[((size_t)y * targetWidth + x) * 3 + c] = (unsigned char)((sum + stepX * stepY / 2) / (stepX * stepY));
+            }
+        }
+    }
+}
+
+static void encodeTile(const vector<unsigned char>& level, int width, int height, int tileX, int tileY,
+    unsigned char *blocks)
+{
+    const int blocksAcross = tileTexels / 4;
+    for(int b = 0; b < blocksAcross * blocksAcross; b++)
+    {
+        unsigned char block[16][3];
+        for(int i = 0; i < 16; i++)
+        {
+            int x = tileX * tileSize - border + b % blocksAcross * 4 + i % 4;
+            int y = tileY * tileSize - border + b / blocksAcross * 4 + i / 4;
+            x = (x % width + width) % width;
+            y = min(max(y, 0), height - 1);
+            for(int c = 0; c < 3; c++)
+            {
+                block[i][c] = level[((size_t)y * width + x) * 3 + c];
+            }
+        }
+        Ktx::encodeBlock(block, blocks + b * Ktx::blockBytes);
+    }
+}
+
+static bool build(const unsigned char *texels, int width, int height, int channels, const string& filePath,
+    int& numLevels, int& numTiles)
+{
+    VirtualTextureHeader header = VirtualTextureHeader();
+    memcpy(header.magic, "SSV1", 4);
+    header.width = nearestPowerOfTwo(width);
+    header.height = nearestPowerOfTwo(height);
+    header.dataOffset = 4096;
+
+    double sum[3] = { 0.0, 0.0, 0.0 };
+    for(size_t i = 0; i < (size_t)width * height; i++)
+    {
+        for(int c = 0; c < 3; c++)
+        {
+            sum[c] += texels[i * channels + (channels < 3 ? 0 : c)];
+        }
+    }
+    for(int c = 0; c < 3; c++)
+    {
+        header.averageColor[c] = (float)(sum[c] / (255.0 * width * height));
+    }
+    int tilesX = header.width / tileSize, tilesY = header.height / tileSize;
+    header.numLevels = 1;
+    for(int x = tilesX, y = tilesY; x > 1 || y > 1; x = max(1, x / 2), y = max(1, y / 2))
+    {
+        header.numLevels++;
+    }
+    if(header.numLevels > VirtualTexture::numLevelsMax)
+    {
+        cout << filePath << ": too many levels" << endl;
+        return false;
+    }
+
+    ofstream out(filePath, ios::binary);
+    out.write((const char*)&header, sizeof(header));
+    out.seekp(header.dataOffset);
+
+    vector<unsigned char> level, next, blocks;
+    resample(texels, width, height, channels, header.width, header.height, level);
+    int levelWidth = header.width, levelHeight = header.height;
+    numTiles = 0;
+    for(int l = 0; l < header.numLevels; l++)
+    {
+        blocks.resize((size_t)tilesX * tilesY * VirtualTexture::tileBytes);
+        #pragma omp parallel for schedule(dynamic)
+        for(int tile = 0; tile < tilesX * tilesY; tile++)
+        {
+            encodeTile(level, levelWidth, levelHeight, tile % tilesX, tile / tilesX,
+                &blocks[(size_t)tile * VirtualTexture::tileBytes]);
+        }
+        out.write((const char*)blocks.data(), blocks.size());
+        numTiles += tilesX * tilesY;
+
+        tilesX = max(1, tilesX / 2);
+        tilesY = max(1, tilesY / 2);
+        if(l + 1 < header.numLevels)
+        {
+            downsample(level, levelWidth, levelHeight, tilesX * tileSize, tilesY * tileSize, next);
+            level.swap(next);
+            levelWidth = tilesX * tileSize;
+            levelHeight = tilesY * tileSize;
+        }
+    }
+    numLevels = header.numLevels;
+    if(!out)
+    {
+        cout << "Failed to write " << filePath << endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 2)
+    {
+        cout << "usage: vtbuild.exec image..." << endl;
+        return EXIT_FAILURE;
+    }
+
+    bool failed = false;
+    stbi_set_flip_vertically_on_load(true);
+    for(int i = 1; i < argc; i++)
+    {
+        auto start = chrono::steady_clock::now();
+        int width, height, channels;
+        unsigned char *texels = stbi_load(argv[i], &width, &height, &channels, 0);
+        if(!texels)
+        {
+            cout << "Failed to load " << argv[i] << endl;
+            failed = true;
+            continue;
+        }
+        double decodeMs = elapsedMs(start);
+
+        start = chrono::steady_clock::now();
+        string filePath = pyramidPath(argv[i]);
+        int numLevels, numTiles;
+        if(build(texels, width, height, channels, filePath, numLevels, numTiles))
+        {
+            cout << filePath << ": " << width << "x" << height << ", " << numLevels << " levels, " << numTiles
+                << " tiles, " << ((size_t)numTiles * VirtualTexture::tileBytes) / (1024 * 1024) << " MB, decode "
+                << decodeMs << " ms, build " << elapsedMs(start) << " ms" << endl;
+        }
+        else
+        {
+            failed = true;
+        }
+        stbi_image_free(texels);
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -8,17 +8,32 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <omp.h>
-#include <stack>
+#include <chrono>
+#include <memory>
+#include <cfloat>
 
 #include "../include/Utils.h"
 #include "../include/sphere.h"
 #include "../include/camera.h"
 #include "../include/Torus.h"
 #include "../include/Constants.h"
-
-#define numVAOs 3
-#define numVBOs 8
-#define NUMBER_OF_PLANETS 8
+#include "../include/BodyCatalog.h"
+#include "../include/Benchmarks.h"
+#include "../include/NBody.h"
+#include "../include/Ephemeris.h"
+#include "../include/Simulation.h"
+#include "../include/JobSystem.h"
+#include "../include/FastMath.h"
+#include "../include/Transforms.h"
+#include "../include/ParticleSystem.h"
+#include "../include/TextureLoader.h"
+#include "../include/AssetPack.h"
+#include "../include/VirtualTexture.h"
+#include "../include/PlanetTerrain.h"
+#include "../include/Kepler.h"
+
+#define numVAOs 5
+#define numVBOs 18
 
 void setupVertices();
 void init(GLFWwindow* window);
@@ -27,9 +42,27 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void GenerateBuffers(GLuint* VAO, GLuint* VBO, GLuint VAO_INITIAL_INDEX, GLuint VBO_INITIAL_INDEX, bool is_element_array_buffer=false);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
 void processInput(GLFWwindow *window);
 void DrawOrbits(glm::mat4& vMat);
-void DrawPlanets(glm::mat4& vMat, std::stack<glm::mat4>& mMat, double& currentTime);
+void UpdateTransforms(double& currentTime);
+void CullBodies(glm::mat4& vMat, double& currentTime);
+void DrawPlanets();
+void BindPlanetTexture(int texture);
+void DrawSprites();
+void UploadOrbits();
+void AnimateOrbits(glm::mat4& vMat, double& currentTime);
+void SetupParticles();
+void DrawParticles(glm::mat4& vMat, double& currentTime);
+void UpdateTextures();
+void RequestTextures();
+void ReadGpuDiameters();
+void FrustumPlanes(glm::vec4 planes[6]);
+void SetupTerrains();
+void DrawTerrain(glm::mat4& vMat, double& currentTime);
+void DrawTerrainChunks(const glm::mat4& proj);
+void DrawNearTerrain();
+glm::vec3 BodyWorldPosition(int body, double time);
 
 const unsigned int SCR_WIDTH = 1280;
 const unsigned int SCR_HEIGHT = 720;
@@ -43,20 +76,17 @@ bool firstMouse = true;
 float deltaTime = 0.0f;	// time between current frame and last frame
 float lastFrame = 0.0f;
 
-GLuint renderingProgram, renderingOrbitProgram, skyboxShader;
+GLuint renderingProgram, renderingOrbitProgram, skyboxShader, spriteProgram, orbitComputeProgram;
 GLuint vao[numVAOs];
 GLuint vbo[numVBOs];
 GLuint skyboxVAO, skyboxVBO;
 
-GLuint mLoc,vLoc, mvLoc, projLoc, tfLoc;
+GLuint mLoc,vLoc, mvLoc, projLoc, tfLoc, bodyIndexLoc, instanceOffsetLoc, orbitIndexLoc;
 int width, height;
 float aspect;
 glm::mat4 pMat, vMat, mMat, mvMat;
 
 float tf = 0.0f;
-GLuint sunTexture, earthTexture, moonTexture, mercuryTexture;
-GLuint venusTexture, marsTexture, jupiterTexture, saturnTexture;
-GLuint urnausTexture, neptuneTexture;
 GLuint cubemapTexture;
 
 std::vector<int> ind;
@@ -68,18 +98,229 @@ std::vector<float> pvalues; // Vertex Positions
 std::vector<float> tvalues; // Texture Coordinates
 std::vector<float> nvalues; // Normal Vectors
 
-std::stack<glm::mat4> mStack;
-
 Sphere sphere(156);
 
-std::vector<GLuint> Planet_Textures;
-
-std::vector<float> RandomOrbitLocationMultiplier;
+BodyCatalog catalog;
+const char* catalogPath = "./data/bodies.csv";
+
+// Positions from a Chebyshev ephemeris while the clock is inside its span.
+// --ephemeris <file> loads one; --fit-ephemeris first fits it from the
+// catalog and writes it there (./data/ephemeris.bin by default). A fitted
+// file holds the starting phases of the run that fitted it, which change
+// every run. Without either, bodies are propagated from their elements.
+Ephemeris ephemeris;
+const char* ephemerisPath = "./data/ephemeris.bin";
+bool useEphemeris = false;
+bool fitEphemeris = false;
+const double ephemerisSpan = 3600.0;
+
+std::vector<GLuint> Planet_Textures; // Indexed by catalog texture index
+std::vector<glm::vec3> Planet_Colors; // Average texture color, used for sprites
+const glm::vec3 defaultSpriteColor(0.6f, 0.6f, 0.6f); // Bodies without a texture
+
+// Sprite batch: view-space position (3), color (3), diameter in pixels (1)
+std::vector<float> spriteValues;
+float spriteThreshold = Constants::sprite_threshold_pixels;
+const float fovy = 1.0472f;
 
 Torus orbit(Constants::earth_distance, 1.0f, 150);
 
-int main()
+// Per-frame CPU work (propagation, transforms, culling, orbit matrices) is
+// split into jobs; GL calls stay on the render thread.
+JobSystem jobs;
+JobStats frameJobStats;
+const int bodiesPerJob = 256;
+
+// Shaders and textures are read from the pack named by --pack (`make pack`
+// writes assets.pack) and from the loose files otherwise. The pack is a
+// snapshot of the tree, so it is never picked up on its own.
+const char* assetPackPath = nullptr;
+AssetPack assets;
+
+// Linked shader programs are cached here as driver binaries, so later runs
+// skip compiling; --no-shader-cache always builds them.
+const char* programCachePath = "./shadercache";
+
+// Planet maps and the skybox decode on the job system and upload on a
+// loader thread with a shared context; until a texture is resident its
+// bodies show the loader's placeholder. BC1 KTX2 caches made with
+// `make textures` are preferred; --no-ktx decodes the JPEGs regardless.
+// Once loaded, they are kept within a VRAM budget by their size on screen;
+// --texture-budget <MB> sets it, 0 for none.
+TextureLoader textureLoader(jobs);
+int skyboxTexture;
+
+// Catalog textures named *.vt are tile pyramids made by vtbuild, streamed
+// in by a VirtualTexture each instead of loaded whole. Both are indexed by
+// catalog texture; loaderTextures gives the others their loader index.
+std::vector<std::unique_ptr<VirtualTexture>> virtualTextures;
+std::vector<int> loaderTextures;
+GLuint virtualTextureLoc;
+
+// Bodies named with --terrain <name>[=<heightmap>] are drawn as chunked LOD
+// terrain (see PlanetTerrain.h) instead of spheres while larger than a
+// sprite; a heightmap is a 16-bit grey equirectangular map. The scene keeps
+// its depth range; terrain closer than its near plane is drawn again in a
+// pass of its own, whose near plane follows the altitude down to the ground.
+// The camera slows within terrainSlowAltitude of the ground.
+std::vector<std::string> terrainArgs;
+std::vector<std::unique_ptr<PlanetTerrain>> terrains;
+std::vector<int> terrainBodies; // the body of each terrain
+std::vector<int> bodyTerrains;  // per body, -1 without terrain
+GLuint terrainProgram;
+struct TerrainView
+{
+	bool drawn;             // larger than a sprite this frame
+	glm::mat4 mv;
+	glm::vec3 cameraLocal;  // camera in the body's unit-sphere frame
+	glm::vec3 light;        // view space
+};
+std::vector<TerrainView> terrainViews;
+float terrainNearPlane = 0.1f; // this frame's, for the near pass
+bool terrainSlowed = false;
+const float sceneNearPlane = 0.1f;
+const float farPlane = 50000.0f;
+const float minNearPlane = 0.0005f;
+const float terrainSlowAltitude = 0.5f * SPEED; // where the slowed speed is full again
+
+// World positions and spin angles, the inputs of the batched model-view pass
+std::vector<float> worldX, worldY, worldZ, bodyAngles;
+
+// Results of the parallel culling pass, consumed by DrawPlanets. Model-view
+// matrices are written straight into the shader storage buffer vbo[9], which
+// the body shader indexes with body_index; bodyMatrices stands in when the
+// buffer cannot be mapped. View-space centers are kept for culling and sprites.
+std::vector<float> bodyMatrices;
+std::vector<float> centerX, centerY, centerZ;
+std::vector<float> bodyDiameters;
+std::vector<char> bodyVisible;
+std::vector<glm::mat4> orbitMvMats;
+
+// Orbits are updated on the simulation thread at a fixed rate; each frame
+// interpolates its latest two ticks.
+Simulation simulation(catalog, ephemeris, jobs);
+double reportTime = 0.0;
+int reportFrames = 0;
+
+// Simulation time: space pauses, R reverses, comma and period divide and
+// multiply the warp by 10, Home returns to year 0 and J jumps 10000 years
+// ahead. --epoch <years> sets the starting time.
+double startEpoch = 0.0;
+const double warpStep = 10.0;
+const double jumpYears = 10000.0;
+
+// GPU animation (toggled with G): the orbit elements are uploaded once and a
+// compute pass evaluates every body from the time uniform, writing the body
+// matrices (vbo[9]), orbit rings (vbo[11]) and sprite vertices (vbo[12]).
+// The same pass culls the spheres, appending each visible one to its
+// texture's range of vbo[13] and counting it into that texture's indirect
+// draw in vbo[15]. Only the diameters of the visible spheres (vbo[16]) come
+// back, through a fenced copy into vbo[17] read a frame or more later, for
+// the texture requests. The simulation thread then only advances the clock.
+// N-body positions come from the integrator, so that mode stays on the CPU
+// path.
+struct GpuOrbit
+{
+	glm::vec4 elements; // semi-major axis, semi-minor axis, eccentricity, mean motion
+	glm::vec4 p;        // periapsis direction, mean anomaly at time 0
+	glm::vec4 q;        // in-plane direction 90 degrees ahead, sphere size
+	int info[4];        // parent, texture, show orbit, first slot of its texture's range or -1
+	glm::vec4 color;    // sprite color
+};
+// DrawElementsIndirectCommand, one per texture
+struct DrawCommand
+{
+	GLuint count, instanceCount, firstIndex, baseVertex, baseInstance;
+};
+bool gpuAnimation = false;
+bool animateOnGpu = false; // this frame
+std::vector<int> textureFirst, textureCount; // ranges of the body order
+std::vector<DrawCommand> drawCommands; // with no instances yet
+std::vector<float> gpuDiameters;       // of the last copy read back, 0 for culled
+GLsync diameterFence = 0;
+const int orbitGroupSize = 64;
+
+// Asteroid belt and Saturn's rings, animated, culled and drawn on the GPU.
+// --particles <count> sets the total, shared between the two.
+// --minor-planets <MPCORB.DAT> replaces the random belt with the real
+// minor planets, one particle each; the rings keep their share.
+ParticleSystem particles;
+std::vector<int> beltParents;
+int numParticles = 1000000;
+std::string minorPlanetsPath;
+const float saturnRingTilt = 0.4665f; // 26.73 degrees
+
+int main(int argc, char** argv)
 {
+	auto startupStart = std::chrono::steady_clock::now();
+	for(int i = 1; i + 1 < argc; i++)
+	{
+		if(std::string(argv[i]) == "--bench")
+		{
+			exit(Benchmarks::run(argv[i + 1]) ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+		if(std::string(argv[i]) == "--catalog")
+		{
+			catalogPath = argv[i + 1];
+		}
+		if(std::string(argv[i]) == "--epoch")
+		{
+			startEpoch = atof(argv[i + 1]);
+		}
+		if(std::string(argv[i]) == "--particles")
+		{
+			numParticles = atoi(argv[i + 1]);
+			if(numParticles < 0)
+			{
+				std::cout << "--particles: the count cannot be negative" << std::endl;
+				exit(EXIT_FAILURE);
+			}
+		}
+		if(std::string(argv[i]) == "--minor-planets")
+		{
+			minorPlanetsPath = argv[i + 1];
+		}
+		if(std::string(argv[i]) == "--ephemeris")
+		{
+			ephemerisPath = argv[i + 1];
+			useEphemeris = true;
+		}
+		if(std::string(argv[i]) == "--pack")
+		{
+			assetPackPath = argv[i + 1];
+		}
+		if(std::string(argv[i]) == "--terrain")
+		{
+			terrainArgs.push_back(argv[i + 1]);
+		}
+		if(std::string(argv[i]) == "--texture-budget")
+		{
+			textureLoader.budgetBytes = (long long)(atof(argv[i + 1]) * 1024 * 1024);
+		}
+	}
+	for(int i = 1; i < argc; i++)
+	{
+		if(std::string(argv[i]) == "--no-ktx")
+		{
+			textureLoader.preferCompressed = false;
+		}
+		if(std::string(argv[i]) == "--no-shader-cache")
+		{
+			programCachePath = nullptr;
+		}
+		if(std::string(argv[i]) == "--fit-ephemeris")
+		{
+			useEphemeris = true;
+			fitEphemeris = true;
+		}
+	}
+	if(assetPackPath && assets.open(assetPackPath))
+	{
+		std::cout << "Assets: " << assets.size() << " files from " << assetPackPath << std::endl;
+		Utils::setAssetPack(&assets);
+		textureLoader.assets = &assets;
+	}
+
 	if (!glfwInit())
 	{
 		exit(EXIT_FAILURE);
@@ -93,6 +334,7 @@ int main()
 	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 	glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetScrollCallback(window, scroll_callback);
+	glfwSetKeyCallback(window, key_callback);
 
     // tell GLFW to capture our mouse
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
@@ -105,20 +347,114 @@ int main()
 	}
 	glfwSwapInterval(1);
 
+	Utils::setProgramCache(programCachePath);
 	init(window);
+	Utils::printProgramStats();
 
+	bool firstFrame = true;
 	while(!glfwWindowShouldClose(window))
 	{
-		display(window, glfwGetTime());
+		display(window, Simulation::now());
 		glfwSwapBuffers(window);
 		glfwPollEvents();
+		if(firstFrame)
+		{
+			std::cout << "First frame after " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startupStart).count()
+				<< " ms" << std::endl;
+			firstFrame = false;
+		}
+	}
+	simulation.stop();
+	for(std::unique_ptr<VirtualTexture>& texture : virtualTextures)
+	{
+		if(texture)
+		{
+			texture->printStats();
+			texture->close();
+		}
+	}
+	for(size_t t = 0; t < terrains.size(); t++)
+	{
+		terrains[t]->printStats(catalog.names[terrainBodies[t]]);
+		terrains[t]->close();
 	}
+	textureLoader.stop();
 	
 	glfwDestroyWindow(window);
 	glfwTerminate();
 	exit(EXIT_SUCCESS);
 }
 
+// Each textured body in view and larger than a sprite asks the loader for
+// its texture at its size on screen. The CPU path has culled them already;
+// with GPU animation the compute pass has, and its diameters are those of
+// the last copy read back, as the loader needs requests every frame.
+void RequestTextures()
+{
+	if(animateOnGpu)
+	{
+		ReadGpuDiameters();
+	}
+	for(int i = 0; i < catalog.getNumBodies(); i++)
+	{
+		int texture = catalog.textures[i];
+		if(texture < 0 || loaderTextures[texture] < 0)
+		{
+			continue;
+		}
+
+		float diameter;
+		bool visible = true;
+		if(animateOnGpu)
+		{
+			diameter = i < (int)gpuDiameters.size() ? gpuDiameters[i] : 0.0f;
+		}
+		else
+		{
+			diameter = bodyDiameters[i];
+			visible = bodyVisible[i];
+		}
+		if(visible && diameter >= spriteThreshold)
+		{
+			textureLoader.request(loaderTextures[texture], diameter);
+		}
+	}
+}
+
+// Takes in the diameters the compute pass wrote once the GPU has copied
+// them, then copies this frame's if that copy has been read
+void ReadGpuDiameters()
+{
+	int numBodies = catalog.getNumBodies();
+	if(diameterFence)
+	{
+		GLenum status = glClientWaitSync(diameterFence, 0, 0);
+		if(status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+		{
+			glDeleteSync(diameterFence);
+			diameterFence = 0;
+			glBindBuffer(GL_COPY_READ_BUFFER, vbo[17]);
+			const float *diameters = (const float*)glMapBufferRange(GL_COPY_READ_BUFFER, 0,
+				(GLsizeiptr)numBodies * sizeof(float), GL_MAP_READ_BIT);
+			if(diameters)
+			{
+				gpuDiameters.assign(diameters, diameters + numBodies);
+				glUnmapBuffer(GL_COPY_READ_BUFFER);
+			}
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		}
+	}
+	if(!diameterFence && numBodies > 0)
+	{
+		glBindBuffer(GL_COPY_READ_BUFFER, vbo[16]);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, vbo[17]);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, (GLsizeiptr)numBodies * sizeof(float));
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		diameterFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+}
+
 void setupVertices()
 {
 	ind = sphere.getIndices();
@@ -126,26 +462,30 @@ void setupVertices()
 	tex = sphere.getTexCoords();
 	norm = sphere.getNormals();
 
-	int numIndices = sphere.getNumIndices();
-
-	for(int i = 0; i < numIndices; i++)
+	// Indexed, as the sphere's vertices are shared; its indices get their own
+	// buffer, vbo[14], since vbo[3] starts the orbit's
+	for(int i = 0; i < sphere.getNumVertices(); i++)
 	{
-		pvalues.push_back((vert[ind[i]]).x);
-		pvalues.push_back((vert[ind[i]]).y);
-		pvalues.push_back((vert[ind[i]]).z);
+		pvalues.push_back(vert[i].x);
+		pvalues.push_back(vert[i].y);
+		pvalues.push_back(vert[i].z);
 
-		tvalues.push_back((tex[ind[i]]).s);
-		tvalues.push_back((tex[ind[i]]).t);
+		tvalues.push_back(tex[i].s);
+		tvalues.push_back(tex[i].t);
 
-		nvalues.push_back((norm[ind[i]]).x);
-		nvalues.push_back((norm[ind[i]]).y);
-		nvalues.push_back((norm[ind[i]]).z);
+		nvalues.push_back(norm[i].x);
+		nvalues.push_back(norm[i].y);
+		nvalues.push_back(norm[i].z);
 	}
 
 	glGenVertexArrays(numVAOs, vao);
 	glGenBuffers(numVBOs, vbo);
 
-	GenerateBuffers(vao, vbo, 0, 0, true);
+	GenerateBuffers(vao, vbo, 0, 0);
+	glBindVertexArray(vao[0]);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo[14]);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, ind.size() * 4, &ind[0], GL_STATIC_DRAW);
+	glBindVertexArray(0);
 
 	ind.clear();
 	vert.clear();
@@ -225,6 +565,28 @@ void setupVertices()
     glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+
+	// Point sprites, refilled every frame
+	glBindVertexArray(vao[3]);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo[8]);
+	glBufferData(GL_ARRAY_BUFFER, 0, NULL, GL_STREAM_DRAW);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 7 * sizeof(float), (void*)0);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 7 * sizeof(float), (void*)(3 * sizeof(float)));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, 7 * sizeof(float), (void*)(6 * sizeof(float)));
+	glEnableVertexAttribArray(2);
+
+	// Point sprites written by the orbit compute pass, same layout
+	glBindVertexArray(vao[4]);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo[12]);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 7 * sizeof(float), (void*)0);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 7 * sizeof(float), (void*)(3 * sizeof(float)));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, 7 * sizeof(float), (void*)(6 * sizeof(float)));
+	glEnableVertexAttribArray(2);
+	glBindVertexArray(0);
 }
 
 
@@ -260,32 +622,51 @@ void GenerateBuffers(GLuint* VAO, GLuint* VBO, GLuint VAO_INITIAL_INDEX, GLuint
 
 void init(GLFWwindow* window)
 {
-	renderingProgram = Utils::createShaderProgram("./shaders/vertShader.glsl", "./shaders/fragShader.glsl");
+	// Built while the scene below is set up
+	Utils::beginPrograms();
+	renderingProgram = Utils::createShaderProgram("./shaders/vertShader_Body.glsl", "./shaders/fragShader.glsl");
 	renderingOrbitProgram = Utils::createShaderProgram("./shaders/vertShader.glsl", "./shaders/fragShader_Orbit.glsl");
 	skyboxShader = Utils::createShaderProgram("./shaders/vertShader_Skybox.glsl", "./shaders/fragShader_Skybox.glsl");
+	spriteProgram = Utils::createShaderProgram("./shaders/vertShader_Sprite.glsl", "./shaders/fragShader_Sprite.glsl");
+	orbitComputeProgram = Utils::createComputeProgram("./shaders/compShader_Orbits.glsl");
+	terrainProgram = Utils::createShaderProgram("./shaders/vertShader_Terrain.glsl", "./shaders/fragShader_Terrain.glsl");
 
 	glfwGetFramebufferSize(window, &width, &height);
 	aspect = (float)width / (float)height;
-	pMat = glm::perspective(1.0472f, aspect, 0.1f, 50000.0f);
+	pMat = glm::perspective(fovy, aspect, sceneNearPlane, farPlane);
 
 	setupVertices();
 
-	sunTexture = Utils::loadTexture("./textures/sun.jpg");
-	earthTexture = Utils::loadTexture("./textures/earth.jpg");
-	moonTexture = Utils::loadTexture("./textures/moon.jpg");
-	mercuryTexture = Utils::loadTexture("./textures/mercury.jpg");
-	venusTexture = Utils::loadTexture("./textures/venus.jpg");
-	marsTexture = Utils::loadTexture("./textures/mars.jpg");
-	jupiterTexture = Utils::loadTexture("./textures/jupiter.jpg");
-	saturnTexture = Utils::loadTexture("./textures/saturn.jpg");
-	urnausTexture = Utils::loadTexture("./textures/uranus.jpg");
-	neptuneTexture = Utils::loadTexture("./textures/neptune.jpg");
-
-	Planet_Textures.push_back(sunTexture); Planet_Textures.push_back(earthTexture);
-	Planet_Textures.push_back(moonTexture); Planet_Textures.push_back(mercuryTexture);
-	Planet_Textures.push_back(venusTexture); Planet_Textures.push_back(marsTexture);
-	Planet_Textures.push_back(jupiterTexture); Planet_Textures.push_back(saturnTexture);
-	Planet_Textures.push_back(urnausTexture); Planet_Textures.push_back(neptuneTexture);
+	srand (static_cast <unsigned> (time(0)));
+
+	auto loadStart = std::chrono::steady_clock::now();
+	if(!catalog.loadCSV(catalogPath))
+	{
+		glfwTerminate();
+		exit(EXIT_FAILURE);
+	}
+	std::cout << "Loaded " << catalog.getNumBodies() << " bodies in "
+		<< std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart).count() << " ms" << std::endl;
+
+	loadStart = std::chrono::steady_clock::now();
+	if(fitEphemeris)
+	{
+		Ephemeris::fit(ephemerisPath, catalog, 0.0, ephemerisSpan);
+	}
+	if(useEphemeris && ephemeris.load(ephemerisPath) && ephemeris.getNumBodies() != catalog.getNumBodies())
+	{
+		std::cout << ephemerisPath << ": " << ephemeris.getNumBodies() << " bodies, the catalog has " << catalog.getNumBodies() << std::endl;
+		ephemeris.unload();
+	}
+	if(ephemeris.isLoaded())
+	{
+		std::cout << "Ephemeris covers " << ephemeris.getStartTime() << " to " << ephemeris.getEndTime() << " s, ready in "
+			<< std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart).count() << " ms" << std::endl;
+	}
+
+	// The thread is not running yet, so the clock can be set directly
+	simulation.seek(SimulationClock::yearsToTime(startEpoch));
+	simulation.start();
 
 	std::vector<std::string> faces
 	{
@@ -296,9 +677,43 @@ void init(GLFWwindow* window)
 		"./textures/skybox//Nebula/Nebula_front.jpg",
 		"./textures/skybox/Nebula/Nebula_back.jpg"
 	};
-	
 
-	cubemapTexture = Utils::loadCubemap(faces);
+	// Placeholders for now; UpdateTextures swaps in the real ones
+	for(size_t i = 0; i < catalog.texturePaths.size(); i++)
+	{
+		const std::string& path = catalog.texturePaths[i];
+		virtualTextures.emplace_back();
+		loaderTextures.push_back(-1);
+		if(VirtualTexture::isVirtual(path))
+		{
+			virtualTextures.back().reset(new VirtualTexture(jobs));
+			if(virtualTextures.back()->open(path.c_str()))
+			{
+				continue;
+			}
+			virtualTextures.back().reset();
+		}
+		loaderTextures.back() = textureLoader.addPlanetMap(path);
+	}
+	skyboxTexture = textureLoader.addCubemap(faces);
+	textureLoader.start(window);
+	for(size_t i = 0; i < catalog.texturePaths.size(); i++)
+	{
+		if(virtualTextures[i])
+		{
+			Planet_Textures.push_back(0);
+			Planet_Colors.push_back(virtualTextures[i]->getAverageColor());
+			continue;
+		}
+		Planet_Textures.push_back(textureLoader.getTexture(loaderTextures[i]));
+		Planet_Colors.push_back(textureLoader.getAverageColor(loaderTextures[i]));
+	}
+	cubemapTexture = textureLoader.getTexture(skyboxTexture);
+
+	SetupTerrains();
+	UploadOrbits();
+	SetupParticles();
+	Utils::endPrograms();
 
 	glEnable(GL_DEPTH_TEST);
 	glDepthFunc(GL_LEQUAL);
@@ -306,22 +721,13 @@ void init(GLFWwindow* window)
 	glEnable(GL_CULL_FACE);
 	glFrontFace(GL_CCW);
 
+	// Planet maps are cubemaps; filter across their faces' edges
+	glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	glEnable( GL_BLEND );
 
-	srand (static_cast <unsigned> (time(0)));
-	float r;
-
-	for(int i = 0; i < NUMBER_OF_PLANETS + 2; i++)
-	{
-		if(i == 0) // Sun
-		{
-			RandomOrbitLocationMultiplier.push_back(0);
-			continue;
-		}
-		r = static_cast <float> (rand()) / static_cast <float> (RAND_MAX/7.0f);
-		RandomOrbitLocationMultiplier.push_back(r);
-	}
+	glEnable(GL_PROGRAM_POINT_SIZE);
 
 	glUseProgram(skyboxShader);
 	glUniform1i(glGetUniformLocation(skyboxShader, "skybox"), 0); 
@@ -343,6 +749,8 @@ void display(GLFWwindow* window, double currentTime)
 	glClear(GL_DEPTH_BUFFER_BIT);
 	glClear(GL_COLOR_BUFFER_BIT);
 
+	UpdateTextures();
+
 	// camera/view transformation
 	vMat = camera.GetViewMatrix();
 	vMat = glm::mat4(glm::mat3(camera.GetViewMatrix())); // remove translation from the view matrix
@@ -365,80 +773,697 @@ void display(GLFWwindow* window, double currentTime)
 	glDrawArrays(GL_TRIANGLES, 0, 36);
 	glEnable(GL_DEPTH_TEST);
 
+	vMat = camera.GetViewMatrix();
+	UpdateTransforms(currentTime);
+	if(animateOnGpu)
+	{
+		AnimateOrbits(vMat, currentTime);
+	}
+	else
+	{
+		CullBodies(vMat, currentTime);
+	}
+
 	// Render Planets and Moon
 	glUseProgram(renderingProgram);
-	mvLoc = glGetUniformLocation(renderingProgram, "mv_matrix");
+	bodyIndexLoc = glGetUniformLocation(renderingProgram, "body_index");
+	instanceOffsetLoc = glGetUniformLocation(renderingProgram, "instance_offset");
 	projLoc = glGetUniformLocation(renderingProgram, "proj_matrix");
-	vMat = camera.GetViewMatrix();	
-	// Push View Matrix onto the stack
-	mStack.push(vMat);
+	virtualTextureLoc = glGetUniformLocation(renderingProgram, "virtual_texture");
 	glBindVertexArray(vao[0]);
-	DrawPlanets(vMat, mStack, currentTime);
+	DrawPlanets();
+	DrawTerrain(vMat, currentTime);
+	RequestTextures();
+
+	// Render bodies too small for a mesh
+	DrawSprites();
+
+	// Render asteroid belt and rings
+	DrawParticles(vMat, currentTime);
 
 	// Render Orbits
 	glUseProgram(renderingOrbitProgram);
 	mvLoc = glGetUniformLocation(renderingOrbitProgram, "mv_matrix");
 	projLoc = glGetUniformLocation(renderingOrbitProgram, "proj_matrix");
+	orbitIndexLoc = glGetUniformLocation(renderingOrbitProgram, "body_index");
 	glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(pMat));
 	glBindVertexArray(vao[1]);
 	DrawOrbits(vMat);
+
+	// Last, as it clears the depth buffer
+	DrawNearTerrain();
+
+	frameJobStats = jobs.collectStats();
 }
 
 void DrawOrbits(glm::mat4& vMat)
 {
-	glm::mat4 mMat, mvMat;
+	if(animateOnGpu)
+	{
+		// Matrices from the compute pass
+		for(int i = 0; i < catalog.getNumBodies(); i++)
+		{
+			if(catalog.showOrbits[i])
+			{
+				glUniform1i(orbitIndexLoc, i);
+				glDrawElements(GL_TRIANGLES, orbit.getIndices().size(), GL_UNSIGNED_INT, 0);
+			}
+		}
+		return;
+	}
+	glUniform1i(orbitIndexLoc, -1);
 
-	#pragma parallel for private(mMat, mvMat)
-	for(int i = 0; i < NUMBER_OF_PLANETS; i++)
+	// Matrices in parallel; the draw calls have to stay on this thread
+	orbitMvMats.resize(catalog.getNumBodies());
+	jobs.parallelFor(catalog.getNumBodies(), bodiesPerJob, [&](int first, int last) {
+		for(int i = first; i < last; i++)
+		{
+			if(!catalog.showOrbits[i])
+			{
+				continue;
+			}
+
+			// The ring mesh is a circle of Earth's orbit radius in the xz plane.
+			// Stretch it onto the ellipse: z along periapsis, x along the minor
+			// axis, centered a*e behind the focus at the parent.
+			OrbitalElements& orbits = catalog.orbits;
+			glm::vec3 P(orbits.px[i], orbits.py[i], orbits.pz[i]);
+			glm::vec3 Q(orbits.qx[i], orbits.qy[i], orbits.qz[i]);
+			float a = orbits.semiMajorAxes[i] / Constants::earth_distance;
+			float b = orbits.semiMinorAxes[i] / Constants::earth_distance;
+
+			glm::mat4 ellipse(1.0f);
+			ellipse[0] = glm::vec4(b * Q, 0.0f);
+			ellipse[1] = glm::vec4(a * glm::cross(P, Q), 0.0f);
+			ellipse[2] = glm::vec4(a * P, 0.0f);
+			ellipse[3] = glm::vec4(-orbits.semiMajorAxes[i] * orbits.eccentricities[i] * P, 1.0f);
+
+			int parent = catalog.parents[i];
+			glm::mat4 mMat = parent < 0 ? glm::mat4(1.0f) : glm::translate(glm::mat4(1.0f), glm::vec3(worldX[parent], worldY[parent], worldZ[parent]));
+			orbitMvMats[i] = vMat * mMat * ellipse;
+		}
+	});
+
+	for(int i = 0; i < catalog.getNumBodies(); i++)
 	{
-		mMat = glm::translate(glm::mat4(1.0f), glm::vec3(0, 0, 0)) * glm::scale(glm::mat4(1.0f), Constants::Orbit_Ratios[i] * glm::vec3(1.0f, 1.0f, 1.0f));
-		mvMat = vMat * mMat;
-		glUniformMatrix4fv(mvLoc, 1, GL_FALSE, glm::value_ptr(mvMat));
+		if(!catalog.showOrbits[i])
+		{
+			continue;
+		}
+		glUniformMatrix4fv(mvLoc, 1, GL_FALSE, glm::value_ptr(orbitMvMats[i]));
 		glDrawElements(GL_TRIANGLES, orbit.getIndices().size(), GL_UNSIGNED_INT, 0);
 	}
 }
 
-void DrawPlanets(glm::mat4& vMat, std::stack<glm::mat4>& mMat, double& currentTime)
+// Orbital motion of every body relative to its parent, interpolated from the
+// simulation thread. currentTime comes in as the frame's real time and
+// leaves as the matching simulation time.
+void UpdateTransforms(double& currentTime)
+{
+	double frameTime = currentTime;
+	const SimulationState* state = simulation.interpolate(frameTime, &catalog.positionsX[0], &catalog.positionsY[0],
+		&catalog.positionsZ[0], currentTime);
+	// Positions stop arriving once the simulation has seen setPropagation
+	animateOnGpu = gpuAnimation && state && state->x.empty();
+	if(!animateOnGpu)
+	{
+		worldX.resize(catalog.getNumBodies());
+		worldY.resize(catalog.getNumBodies());
+		worldZ.resize(catalog.getNumBodies());
+		catalog.resolveWorldPositions(&worldX[0], &worldY[0], &worldZ[0]);
+	}
+	if(!state)
+	{
+		currentTime = 0.0;
+		return;
+	}
+
+	reportFrames++;
+	if(frameTime - reportTime >= 1.0)
+	{
+		std::cout << "Simulation: " << state->tickRate << " ticks/s, " << state->tickMs << " ms/tick; render: "
+			<< reportFrames / (frameTime - reportTime) << " frames/s, " << 1000.0 * (frameTime - reportTime) / reportFrames
+			<< " ms/frame" << std::endl;
+		const JobStats& jobStats = frameJobStats;
+		std::cout << "Jobs (last frame): " << jobStats.jobs << " on " << jobStats.numWorkers << " workers, " << jobStats.steals
+			<< " steals, busy " << jobStats.busyMs << " ms, helping " << jobStats.helperMs << " ms, scheduling "
+			<< jobStats.schedulingMs << " ms, utilization " << 100.0 * jobStats.utilization << "%" << std::endl;
+		TextureStats textureStats = textureLoader.collectStats();
+		std::cout << "Textures: " << textureStats.gpuBytes / (1024.0 * 1024.0) << " of " << textureStats.budgetBytes / (1024.0 * 1024.0)
+			<< " MB, " << textureStats.full << " full, " << textureStats.reduced << " reduced, " << textureStats.evicted << " evicted, "
+			<< textureStats.restoring << " restoring; " << textureStats.reductions << " reductions, " << textureStats.evictions
+			<< " evictions, " << textureStats.restores << " restores" << std::endl;
+		if(particles.getNumParticles() > 0)
+		{
+			ParticleStats particleStats = particles.collectStats();
+			std::cout << "Particles: " << particleStats.numParticles << ", update " << particleStats.computeMs << " ms ("
+				<< particleStats.particlesPerMs << " particles/ms), " << particleStats.rocks << " rocks, "
+				<< particleStats.points << " points" << std::endl;
+		}
+		for(size_t t = 0; t < terrains.size(); t++)
+		{
+			TerrainStats terrainStats = terrains[t]->collectStats();
+			std::cout << "Terrain " << catalog.names[terrainBodies[t]] << ": " << terrainStats.chunks << " chunks (deepest level "
+				<< terrainStats.deepestLevel << "), " << terrainStats.cached << " cached, " << terrainStats.generating
+				<< " generating, " << terrainStats.generated << " generated, " << terrainStats.evicted << " evicted, select "
+				<< terrainStats.selectMs << " ms" << std::endl;
+		}
+		if(state->nbodyMode)
+		{
+			const NBodyStats& stats = state->nbodyStats;
+			std::cout << "N-body: " << stats.numBodies << " bodies, " << stats.stepMs << " ms/step (tree " << stats.buildMs
+				<< ", forces " << stats.forceMs << "), " << stats.interactions / std::max(stats.forceMs, 1e-6) / 1e3
+				<< " M interactions/s, " << stats.forceEvaluations << " force evaluations in " << stats.substeps
+				<< " substeps (deepest level " << stats.deepestLevel << "), energy drift " << stats.energyDrift << std::endl;
+		}
+		reportTime = frameTime;
+		reportFrames = 0;
+	}
+}
+
+// In view space, from the rows of the projection matrix
+void FrustumPlanes(glm::vec4 planes[6])
+{
+	glm::vec4 rows[4];
+	for(int r = 0; r < 4; r++)
+	{
+		rows[r] = glm::vec4(pMat[0][r], pMat[1][r], pMat[2][r], pMat[3][r]);
+	}
+	for(int p = 0; p < 6; p++)
+	{
+		planes[p] = rows[3] + (p % 2 == 0 ? 1.0f : -1.0f) * rows[p / 2];
+		planes[p] /= glm::length(glm::vec3(planes[p]));
+	}
+}
+
+// Model-view matrix, projected size and frustum visibility of every body,
+// computed in parallel
+void CullBodies(glm::mat4& vMat, double& currentTime)
+{
+	int numBodies = catalog.getNumBodies();
+	bodyAngles.resize(numBodies);
+	centerX.resize(numBodies);
+	centerY.resize(numBodies);
+	centerZ.resize(numBodies);
+	bodyDiameters.resize(numBodies);
+	bodyVisible.resize(numBodies);
+
+	glm::vec4 planes[6];
+	FrustumPlanes(planes);
+
+	// Every body spins at the same rate
+	std::fill(bodyAngles.begin(), bodyAngles.end(), (float)FastMath::wrapAngle(currentTime));
+	float pixelScale = height / tan(fovy / 2.0f);
+
+	// Orphan last frame's matrices, then have the jobs write this frame's
+	// straight into the mapped buffer
+	GLsizeiptr matrixBytes = (GLsizeiptr)numBodies * 16 * sizeof(float);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, vbo[9]);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, matrixBytes, NULL, GL_STREAM_DRAW);
+	float* matrices = numBodies > 0 ? (float*)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, matrixBytes,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT) : NULL;
+	bool mapped = matrices != NULL;
+	if(!mapped)
+	{
+		bodyMatrices.resize(16 * (size_t)numBodies);
+		matrices = bodyMatrices.data();
+	}
+
+	jobs.parallelFor(numBodies, bodiesPerJob, [&](int first, int last) {
+		// Spin and scale apply to the body only, not to its children
+		Transforms::modelView(vMat, &worldX[0], &worldY[0], &worldZ[0], &bodyAngles[0], &catalog.sizes[0], matrices,
+			&centerX[0], &centerY[0], &centerZ[0], first, last - first);
+
+		for(int i = first; i < last; i++)
+		{
+			// Projected diameter in pixels of a unit sphere scaled to the planet's size
+			glm::vec3 center = glm::vec3(centerX[i], centerY[i], centerZ[i]);
+			bodyDiameters[i] = catalog.sizes[i] * pixelScale / glm::length(center);
+
+			bool visible = true;
+			for(int p = 0; p < 6 && visible; p++)
+			{
+				visible = glm::dot(glm::vec3(planes[p]), center) + planes[p].w >= -catalog.sizes[i];
+			}
+			bodyVisible[i] = visible;
+		}
+	});
+
+	if(mapped)
+	{
+		glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+	}
+	else
+	{
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, matrixBytes, matrices);
+	}
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, vbo[9]);
+}
+
+// Spheres for the visible bodies, sprites for those too small or untextured
+void DrawPlanets()
 {
-	for(int i = 0; i < NUMBER_OF_PLANETS + 2; i++)
+	if(animateOnGpu)
+	{
+		// Culling and the sprite choice happened in AnimateOrbits, which
+		// left the instance counts in the indirect commands
+		glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(pMat));
+		glActiveTexture(GL_TEXTURE0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, vbo[15]);
+		for(size_t t = 0; t < textureCount.size(); t++)
+		{
+			if(textureCount[t] == 0)
+			{
+				continue;
+			}
+			glUniform1i(instanceOffsetLoc, textureFirst[t]);
+			BindPlanetTexture((int)t);
+			glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(t * sizeof(DrawCommand)));
+		}
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		return;
+	}
+	glUniform1i(instanceOffsetLoc, -1);
+
+	for(int i = 0; i < catalog.getNumBodies(); i++)
 	{
-		if(i <  3) // Sun, Earth and Moon
+		if(!bodyVisible[i])
 		{
-			mStack.push(mStack.top());
-			mStack.top() *= glm::translate(glm::mat4(1.0f), glm::vec3(sin((float)(RandomOrbitLocationMultiplier[i] + currentTime)*Constants::Planet_Revolution_Speeds[i])*Constants::Planet_Distances[i] , 0.0f, cos((float)((RandomOrbitLocationMultiplier[i] + currentTime))*Constants::Planet_Revolution_Speeds[i])*Constants::Planet_Distances[i]));
-			mStack.push(mStack.top());
-			mStack.top() *= glm::rotate(glm::mat4(1.0f), (float)currentTime, glm::vec3(0.0, 1.0, 0.0)) * glm::scale(glm::mat4(1.0f), Constants::Planet_Sizes[i] * glm::vec3(1.0f, 1.0f, 1.0f)); // Planet Rotation
-		}else if(i == 3) // Mercury
+			continue;
+		}
+
+		float diameter = bodyDiameters[i];
+		int texture = catalog.textures[i];
+		if(diameter < spriteThreshold || texture < 0)
 		{
-			mStack.pop(); // Remove Moon's Position
-			mStack.pop(); // Remove Earth's Position
-			mStack.push(mStack.top());
-			mStack.top() *= glm::translate(glm::mat4(1.0f), glm::vec3(sin((float)(RandomOrbitLocationMultiplier[i] + currentTime)*Constants::Planet_Revolution_Speeds[i])*Constants::Planet_Distances[i] , 0.0f, cos((float)(RandomOrbitLocationMultiplier[i] + currentTime)*Constants::Planet_Revolution_Speeds[i])*Constants::Planet_Distances[i]));
-			mStack.push(mStack.top());
-			mStack.top() *= glm::rotate(glm::mat4(1.0f), (float)currentTime, glm::vec3(0.0, 1.0, 0.0)) * glm::scale(glm::mat4(1.0f), Constants::Planet_Sizes[i] * glm::vec3(1.0f, 1.0f, 1.0f)); // Planet Rotation
-		}else // Remaining Planets
-		{	
-			mStack.pop(); // Remove Previous Planet's Position
-			mStack.push(mStack.top());
-			mStack.top() *= glm::translate(glm::mat4(1.0f), glm::vec3(sin((float)(RandomOrbitLocationMultiplier[i] + currentTime)*Constants::Planet_Revolution_Speeds[i])*Constants::Planet_Distances[i] , 0.0f, cos((float)(RandomOrbitLocationMultiplier[i] + currentTime)*Constants::Planet_Revolution_Speeds[i])*Constants::Planet_Distances[i]));
-			mStack.push(mStack.top());
-			mStack.top() *= glm::rotate(glm::mat4(1.0f), (float)currentTime, glm::vec3(0.0, 1.0, 0.0)) * glm::scale(glm::mat4(1.0f), Constants::Planet_Sizes[i] * glm::vec3(1.0f, 1.0f, 1.0f)); // Planet Rotation
+			const glm::vec3& color = texture < 0 ? defaultSpriteColor : Planet_Colors[texture];
+			spriteValues.push_back(centerX[i]);
+			spriteValues.push_back(centerY[i]);
+			spriteValues.push_back(centerZ[i]);
+			spriteValues.push_back(color.r);
+			spriteValues.push_back(color.g);
+			spriteValues.push_back(color.b);
+			spriteValues.push_back(diameter);
+			continue;
+		}
+		if(bodyTerrains[i] >= 0)
+		{
+			continue; // DrawTerrain
 		}
 
-		glUniformMatrix4fv(mvLoc, 1, GL_FALSE, glm::value_ptr(mStack.top()));
+		glUniform1i(bodyIndexLoc, i);
 		glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(pMat));
 		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, Planet_Textures[i]);
-		glDrawArrays(GL_TRIANGLES, 0, sphere.getNumIndices());
-		mStack.pop();
+		BindPlanetTexture(texture);
+		glDrawElements(GL_TRIANGLES, sphere.getNumIndices(), GL_UNSIGNED_INT, 0);
+	}
+}
+
+// A loaded planet cubemap on unit 0, or a virtual texture's page table,
+// cache and feedback buffer
+void BindPlanetTexture(int texture)
+{
+	if(virtualTextures[texture])
+	{
+		virtualTextures[texture]->bind(renderingProgram);
+		glUniform1i(virtualTextureLoc, 1);
+		return;
+	}
+	glUniform1i(virtualTextureLoc, 0);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, Planet_Textures[texture]);
+}
+
+// Terrain bodies larger than a sprite: chunk selection, then one instanced
+// draw each in the scene's depth range. Their model-view matrices start from
+// the camera, not the origin, as the finest chunks are smaller than a
+// float's step out at the planets. The lowest altitude sets the near pass's
+// near plane and, close to the ground, the camera speed.
+void DrawTerrain(glm::mat4& vMat, double& currentTime)
+{
+	if(terrains.empty())
+	{
+		return;
+	}
+	float pixelScale = height / tan(fovy / 2.0f);
+	glm::mat4 viewRotation = glm::mat4(glm::mat3(vMat));
+	float altitude = FLT_MAX;
+	terrainViews.resize(terrains.size());
+	for(size_t t = 0; t < terrains.size(); t++)
+	{
+		PlanetTerrain& terrain = *terrains[t];
+		TerrainView& view = terrainViews[t];
+		int body = terrainBodies[t];
+		float size = catalog.sizes[body];
+		glm::vec3 offset = BodyWorldPosition(body, currentTime) - camera.Position;
+		glm::mat4 spinScale = glm::rotate(glm::mat4(1.0f), (float)FastMath::wrapAngle(currentTime), glm::vec3(0.0, 1.0, 0.0));
+		spinScale = glm::scale(spinScale, glm::vec3(size));
+		view.cameraLocal = glm::vec3(glm::inverse(spinScale) * glm::vec4(-offset, 1.0f));
+		altitude = std::min(altitude, (glm::length(view.cameraLocal) - 1.0f - terrain.heightScale * terrain.height(view.cameraLocal)) * size);
+		view.drawn = size * pixelScale / glm::length(offset) >= spriteThreshold;
+
+		int root = body;
+		while(catalog.parents[root] >= 0)
+		{
+			root = catalog.parents[root];
+		}
+		glm::vec3 sun = BodyWorldPosition(root, currentTime) - camera.Position;
+		view.mv = viewRotation * glm::translate(glm::mat4(1.0f), offset) * spinScale;
+		view.light = glm::vec3(viewRotation * glm::vec4(sun, 1.0f));
+	}
+	terrainNearPlane = glm::clamp(0.5f * altitude, minNearPlane, sceneNearPlane);
+
+	// Chunks are culled against the frustum of both passes together
+	glm::mat4 cullMat = glm::perspective(fovy, aspect, terrainNearPlane, farPlane);
+	for(size_t t = 0; t < terrains.size(); t++)
+	{
+		if(terrainViews[t].drawn)
+		{
+			terrains[t]->update(terrainViews[t].cameraLocal, cullMat * terrainViews[t].mv);
+		}
+	}
+	DrawTerrainChunks(pMat);
+
+	// Only near the ground, where 2 * altitude is below the full speed, so
+	// the camera is left alone everywhere else
+	if(altitude < terrainSlowAltitude)
+	{
+		camera.MovementSpeed = std::max(2.0f * altitude, 0.01f);
+		terrainSlowed = true;
+	}
+	else if(terrainSlowed)
+	{
+		camera.MovementSpeed = SPEED;
+		terrainSlowed = false;
+	}
+}
+
+// The chunks DrawTerrain selected, with proj
+void DrawTerrainChunks(const glm::mat4& proj)
+{
+	glUseProgram(terrainProgram);
+	glUniformMatrix4fv(glGetUniformLocation(terrainProgram, "proj_matrix"), 1, GL_FALSE, glm::value_ptr(proj));
+	GLuint terrainMvLoc = glGetUniformLocation(terrainProgram, "mv_matrix");
+	GLuint cameraLocalLoc = glGetUniformLocation(terrainProgram, "camera_local");
+	GLuint lightLoc = glGetUniformLocation(terrainProgram, "light_position");
+	for(size_t t = 0; t < terrains.size(); t++)
+	{
+		const TerrainView& view = terrainViews[t];
+		if(!view.drawn)
+		{
+			continue;
+		}
+		glUniformMatrix4fv(terrainMvLoc, 1, GL_FALSE, glm::value_ptr(view.mv));
+		glUniform3fv(cameraLocalLoc, 1, glm::value_ptr(view.cameraLocal));
+		glUniform3fv(lightLoc, 1, glm::value_ptr(view.light));
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, Planet_Textures[catalog.textures[terrainBodies[t]]]);
+		terrains[t]->draw(terrainProgram);
+	}
+}
+
+// Terrain closer than the scene's near plane, which the scene's projection
+// clipped away. Everything the scene drew lies beyond that plane, so the
+// depth buffer starts over with a range of its own instead of stretching
+// the scene's down to the ground.
+void DrawNearTerrain()
+{
+	if(terrains.empty() || terrainNearPlane >= sceneNearPlane)
+	{
+		return;
+	}
+	glClear(GL_DEPTH_BUFFER_BIT);
+	DrawTerrainChunks(glm::perspective(fovy, aspect, terrainNearPlane, sceneNearPlane));
+}
+
+void DrawSprites()
+{
+	int numSprites = animateOnGpu ? catalog.getNumBodies() : spriteValues.size() / 7;
+	if(numSprites == 0)
+	{
+		return;
+	}
+
+	glUseProgram(spriteProgram);
+	glUniformMatrix4fv(glGetUniformLocation(spriteProgram, "proj_matrix"), 1, GL_FALSE, glm::value_ptr(pMat));
+
+	if(animateOnGpu)
+	{
+		// One vertex per body, written by the compute pass
+		glBindVertexArray(vao[4]);
 	}
+	else
+	{
+		glBindVertexArray(vao[3]);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo[8]);
+		glBufferData(GL_ARRAY_BUFFER, spriteValues.size() * sizeof(float), &spriteValues[0], GL_STREAM_DRAW);
+	}
+	glDrawArrays(GL_POINTS, 0, numSprites);
+
+	spriteValues.clear();
+}
+
 
-	// Remove Last Planet's Position, Sun's Position and View Matrix
-	mStack.pop();
-	mStack.pop();
-	mStack.pop();
+// Static inputs of the GPU animation, uploaded at startup while the
+// textures are still loading in the background: the sprite colors start as
+// the placeholder's, and UpdateTextures patches each as its map arrives
+void UploadOrbits()
+{
+	int numBodies = catalog.getNumBodies();
+	OrbitalElements& orbits = catalog.orbits;
+	std::vector<GpuOrbit> values(numBodies);
+	for(int i = 0; i < numBodies; i++)
+	{
+		int texture = catalog.textures[i];
+		GpuOrbit& value = values[i];
+		value.elements = glm::vec4(orbits.semiMajorAxes[i], orbits.semiMinorAxes[i], orbits.eccentricities[i], orbits.meanMotions[i]);
+		value.p = glm::vec4(orbits.px[i], orbits.py[i], orbits.pz[i], orbits.meanAnomalies[i]);
+		value.q = glm::vec4(orbits.qx[i], orbits.qy[i], orbits.qz[i], catalog.sizes[i]);
+		value.info[0] = catalog.parents[i];
+		value.info[1] = texture;
+		value.info[2] = catalog.showOrbits[i] ? 1 : 0;
+		value.info[3] = -1;
+		value.color = glm::vec4(texture < 0 ? defaultSpriteColor : Planet_Colors[texture], 1.0f);
+	}
+
+	// Textured bodies grouped by texture, so each group is one indirect
+	// draw; terrain bodies are left to DrawTerrain
+	textureFirst.assign(Planet_Textures.size(), 0);
+	textureCount.assign(Planet_Textures.size(), 0);
+	for(int i = 0; i < numBodies; i++)
+	{
+		if(catalog.textures[i] >= 0 && bodyTerrains[i] < 0)
+		{
+			textureCount[catalog.textures[i]]++;
+		}
+	}
+	int numTextured = 0;
+	for(size_t t = 0; t < textureCount.size(); t++)
+	{
+		textureFirst[t] = numTextured;
+		numTextured += textureCount[t];
+	}
+	for(int i = 0; i < numBodies; i++)
+	{
+		if(catalog.textures[i] >= 0 && bodyTerrains[i] < 0)
+		{
+			values[i].info[3] = textureFirst[catalog.textures[i]];
+		}
+	}
+	drawCommands.assign(textureCount.size(), DrawCommand{ (GLuint)sphere.getNumIndices(), 0, 0, 0, 0 });
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, vbo[10]);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, values.size() * sizeof(GpuOrbit), values.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, vbo[11]);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)numBodies * 16 * sizeof(float), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, vbo[12]);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)numBodies * 7 * sizeof(float), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, vbo[13]);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)std::max(numTextured, 1) * sizeof(int), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, vbo[15]);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, drawCommands.size() * sizeof(DrawCommand), drawCommands.data(), GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, vbo[16]);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)std::max(numBodies, 1) * sizeof(float), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, vbo[17]);
+	glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)std::max(numBodies, 1) * sizeof(float), NULL, GL_STREAM_READ);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, vbo[10]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, vbo[11]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, vbo[13]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, vbo[12]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 13, vbo[16]);
 }
 
+// The GPU animation's whole per-frame input is the time and the view matrix,
+// whatever the number of bodies
+void AnimateOrbits(glm::mat4& vMat, double& currentTime)
+{
+	int numBodies = catalog.getNumBodies();
+	if(numBodies == 0)
+	{
+		return;
+	}
+
+	// Sized for the CPU path's matrices, which are the same
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, vbo[9]);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)numBodies * 16 * sizeof(float), NULL, GL_DYNAMIC_COPY);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, vbo[9]);
+
+	// No spheres yet; the pass counts the visible ones in
+	if(!drawCommands.empty())
+	{
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, vbo[15]);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, drawCommands.size() * sizeof(DrawCommand), drawCommands.data());
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, vbo[15]);
+	}
+	glm::vec4 planes[6];
+	FrustumPlanes(planes);
+
+	glUseProgram(orbitComputeProgram);
+	glUniform1d(glGetUniformLocation(orbitComputeProgram, "time"), currentTime);
+	glUniformMatrix4fv(glGetUniformLocation(orbitComputeProgram, "v_matrix"), 1, GL_FALSE, glm::value_ptr(vMat));
+	glUniform1i(glGetUniformLocation(orbitComputeProgram, "num_bodies"), numBodies);
+	glUniform1f(glGetUniformLocation(orbitComputeProgram, "pixel_scale"), height / tan(fovy / 2.0f));
+	glUniform1f(glGetUniformLocation(orbitComputeProgram, "sprite_threshold"), spriteThreshold);
+	glUniform1f(glGetUniformLocation(orbitComputeProgram, "ring_radius"), Constants::earth_distance);
+	glUniform4fv(glGetUniformLocation(orbitComputeProgram, "frustum_planes"), 6, glm::value_ptr(planes[0]));
+	glDispatchCompute((numBodies + orbitGroupSize - 1) / orbitGroupSize, 1, 1);
+
+	// Matrices and the visible list are read as storage, sprites as vertex
+	// attributes, the instance counts as draw commands and the diameters by
+	// a copy
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_COMMAND_BARRIER_BIT
+		| GL_BUFFER_UPDATE_BARRIER_BIT);
+}
+
+
+// After the textures are known, as virtual textures keep their spheres
+void SetupTerrains()
+{
+	bodyTerrains.assign(catalog.getNumBodies(), -1);
+	for(const std::string& arg : terrainArgs)
+	{
+		size_t equals = arg.find('=');
+		std::string name = arg.substr(0, equals);
+		int body = catalog.findBody(name);
+		int texture = body < 0 ? -1 : catalog.textures[body];
+		if(texture < 0 || virtualTextures[texture] || bodyTerrains[body] >= 0)
+		{
+			std::cout << "--terrain " << name << ": needs a body with a loaded texture" << std::endl;
+			continue;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		std::unique_ptr<PlanetTerrain> terrain(new PlanetTerrain(jobs));
+		if(equals != std::string::npos && !terrain->loadHeightmap(arg.substr(equals + 1).c_str()))
+		{
+			continue;
+		}
+		terrain->create();
+		bodyTerrains[body] = (int)terrains.size();
+		terrains.push_back(std::move(terrain));
+		terrainBodies.push_back(body);
+		std::cout << "Terrain for " << name << " ready in "
+			<< std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms" << std::endl;
+	}
+}
+
+void SetupParticles()
+{
+	int sun = catalog.findBody("sun");
+	int saturn = catalog.findBody("saturn");
+	int ringCount = saturn < 0 ? 0 : sun < 0 ? numParticles : numParticles - numParticles * 4 / 5;
+
+	// Main belt, 2.1 to 3.3 AU, between mars_distance and jupiter_distance
+	if(sun >= 0)
+	{
+		ParticleBelt belt = ParticleBelt();
+		belt.parent = sun;
+		belt.innerRadius = 2.1f * Constants::earth_distance;
+		belt.outerRadius = 3.3f * Constants::earth_distance;
+		belt.maxEccentricity = 0.25f;
+		belt.maxInclination = 0.3f;
+		belt.minSize = 0.05f;
+		belt.maxSize = 1.5f;
+		belt.color = glm::vec3(0.55f, 0.5f, 0.45f);
+		belt.mu = Constants::gravitational_constant * catalog.masses[sun];
+
+		MinorPlanets minorPlanets;
+		int index = -1;
+		if(!minorPlanetsPath.empty() && minorPlanets.load(minorPlanetsPath.c_str()))
+		{
+			index = particles.addPopulation(belt, minorPlanets, Constants::earth_distance);
+		}
+		else
+		{
+			index = particles.addBelt(belt, numParticles - ringCount);
+		}
+		if(index >= 0)
+		{
+			beltParents.push_back(sun);
+		}
+	}
+
+	// Rings from 1.24 to 2.27 planet radii, nearly circular and flat, in
+	// Saturn's tilted equatorial plane
+	if(saturn >= 0)
+	{
+		ParticleBelt ring = ParticleBelt();
+		ring.parent = saturn;
+		ring.innerRadius = 1.24f * catalog.sizes[saturn];
+		ring.outerRadius = 2.27f * catalog.sizes[saturn];
+		ring.maxEccentricity = 0.001f;
+		ring.maxInclination = 0.001f;
+		ring.tilt = saturnRingTilt;
+		ring.minSize = 0.01f;
+		ring.maxSize = 0.2f;
+		ring.color = glm::vec3(0.8f, 0.75f, 0.65f);
+		ring.mu = Constants::gravitational_constant * catalog.masses[saturn];
+		if(particles.addBelt(ring, ringCount) >= 0)
+		{
+			beltParents.push_back(saturn);
+		}
+	}
+
+	particles.upload();
+}
+
+// The CPU path's world position, or with the GPU animation, where the
+// positions never come back, the parent chain evaluated here
+glm::vec3 BodyWorldPosition(int body, double time)
+{
+	if(!animateOnGpu)
+	{
+		return glm::vec3(worldX[body], worldY[body], worldZ[body]);
+	}
+
+	glm::vec3 position(0.0f);
+	for(int i = body; i >= 0; i = catalog.parents[i])
+	{
+		double local[3], velocity[3];
+		Kepler::stateVector(catalog.orbits, i, time, 1.0, local, velocity);
+		position += glm::vec3(local[0], local[1], local[2]);
+	}
+	return position;
+}
+
+void DrawParticles(glm::mat4& vMat, double& currentTime)
+{
+	if(particles.getNumParticles() == 0)
+	{
+		return;
+	}
+
+	std::vector<glm::vec3> centers;
+	for(size_t b = 0; b < beltParents.size(); b++)
+	{
+		centers.push_back(BodyWorldPosition(beltParents[b], currentTime));
+	}
+	float pixelScale = height / tan(fovy / 2.0f);
+	particles.update(currentTime, vMat, pMat, pixelScale, centers);
+	particles.draw(currentTime, vMat, pMat, pixelScale);
+}
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
@@ -486,9 +1511,124 @@ void mouse_callback(GLFWwindow* window, double xposIn, double yposIn)
     camera.ProcessMouseMovement(xoffset, yoffset);
 }
 
+// glfw: whenever a key is pressed or released, this callback is called
+// -------------------------------------------------------------------
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+    if (action != GLFW_PRESS)
+        return;
+
+    // Everything below changes simulation state, so it runs on the
+    // simulation thread. N toggles the N-body mode, mutual gravity instead of
+    // fixed orbits; B switches its force backend between Barnes-Hut and
+    // direct summation, T between global and per-body block timesteps.
+    if (key == GLFW_KEY_N)
+    {
+        simulation.post([]() {
+            simulation.setNBodyMode(!simulation.getNBodyMode());
+            std::cout << (simulation.getNBodyMode() ? "N-body mode" : "Keplerian mode") << std::endl;
+        });
+    }
+    if (key == GLFW_KEY_B)
+    {
+        simulation.post([]() {
+            NBody& nbody = simulation.getNBody();
+            nbody.forceBackend = nbody.forceBackend == BARNES_HUT ? DIRECT : BARNES_HUT;
+            std::cout << "N-body forces: " << (nbody.forceBackend == DIRECT ? "direct summation" : "Barnes-Hut") << std::endl;
+        });
+    }
+    if (key == GLFW_KEY_T)
+    {
+        simulation.post([]() {
+            NBody& nbody = simulation.getNBody();
+            nbody.blockTimesteps = !nbody.blockTimesteps;
+            std::cout << "N-body timesteps: " << (nbody.blockTimesteps ? "per-body blocks" : "global") << std::endl;
+        });
+    }
+    if (key == GLFW_KEY_G)
+    {
+        gpuAnimation = !gpuAnimation;
+        bool propagation = !gpuAnimation;
+        simulation.post([propagation]() {simulation.setPropagation(propagation);});
+        std::cout << (gpuAnimation ? "Orbits animated on the GPU" : "Orbits animated on the CPU") << std::endl;
+    }
+    if (key == GLFW_KEY_SPACE || key == GLFW_KEY_R || key == GLFW_KEY_PERIOD || key == GLFW_KEY_COMMA
+        || key == GLFW_KEY_HOME || key == GLFW_KEY_J)
+    {
+        simulation.post([key]() {
+            SimulationClock& clock = simulation.getClock();
+            if (key == GLFW_KEY_SPACE)
+                clock.togglePause();
+            if (key == GLFW_KEY_R)
+                clock.reverse();
+            if (key == GLFW_KEY_PERIOD)
+                clock.setWarp(clock.getWarp() * warpStep);
+            if (key == GLFW_KEY_COMMA)
+                clock.setWarp(clock.getWarp() / warpStep);
+            if (key == GLFW_KEY_HOME)
+                simulation.seek(0.0);
+            if (key == GLFW_KEY_J)
+                simulation.seek(clock.getTime() + SimulationClock::yearsToTime(jumpYears));
+            std::cout << "Year " << SimulationClock::timeToYears(clock.getTime()) << ", warp " << clock.getWarp()
+                << (clock.isPaused() ? " (paused)" : "") << std::endl;
+        });
+    }
+}
+
 // glfw: whenever the mouse scroll wheel scrolls, this callback is called
 // ----------------------------------------------------------------------
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 {
     camera.ProcessMouseScroll(static_cast<float>(yoffset));
+}
+
+// Virtual textures stream in the tiles the last frames asked for. Textures
+// the loader finished, restored, reduced or evicted since the last frame
+// replace the ones bound before. Only textured bodies change color, so
+// their entries in the orbit buffer are patched instead of uploading it
+// again.
+void UpdateTextures()
+{
+	for(std::unique_ptr<VirtualTexture>& texture : virtualTextures)
+	{
+		if(texture)
+		{
+			texture->update();
+		}
+	}
+	if(!textureLoader.update())
+	{
+		return;
+	}
+	cubemapTexture = textureLoader.getTexture(skyboxTexture);
+
+	std::vector<bool> changed(Planet_Textures.size(), false);
+	for(size_t t = 0; t < Planet_Textures.size(); t++)
+	{
+		if(loaderTextures[t] < 0)
+		{
+			continue;
+		}
+		// Residency changes replace the texture object but keep its color,
+		// so only a new color goes to the sprites
+		glm::vec3 color = textureLoader.getAverageColor(loaderTextures[t]);
+		changed[t] = Planet_Colors[t] != color;
+		Planet_Textures[t] = textureLoader.getTexture(loaderTextures[t]);
+		Planet_Colors[t] = color;
+	}
+	if(std::find(changed.begin(), changed.end(), true) == changed.end())
+	{
+		return;
+	}
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, vbo[10]);
+	for(int i = 0; i < catalog.getNumBodies(); i++)
+	{
+		int texture = catalog.textures[i];
+		if(texture >= 0 && changed[texture])
+		{
+			glm::vec4 color(Planet_Colors[texture], 1.0f);
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, i * sizeof(GpuOrbit) + offsetof(GpuOrbit, color), sizeof(color), &color);
+		}
+	}
 }
\ No newline at end of file
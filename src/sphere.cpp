@@ -21,46 +21,73 @@ float Sphere::toRadians(float degrees)
     return (degrees * 2.0f * 3.14159f) / 360.0f;
 }
 
+// Shared vertices with no seam: a vertex at each pole and prec - 1 rings of
+// prec vertices, the last column of each ring wrapping around to the first.
+// The planet maps are cubemaps sampled by direction, so the texture
+// coordinates are only kept for other users; u drops back to 0 at the seam.
 void Sphere::init(int prec)
 {
-    numVertices = (prec + 1) * (prec + 1);
-    numIndices = prec * prec * 6;
+    numVertices = 2 + (prec - 1) * prec;
+    numIndices = 6 * prec * (prec - 1);
 
     for(int i = 0; i < numVertices; i++) {vertices.push_back(glm::vec3());}
     for(int i = 0; i < numVertices; i++) {texCoords.push_back(glm::vec2());}
     for(int i = 0; i < numVertices; i++) {normals.push_back(glm::vec3());}
-    for(int i = 0; i < numIndices; i++) {indices.push_back(0);}
 
     // Calculate Vertices
-    for(int i = 0; i <= prec; i++)
+    vertices[0] = glm::vec3(0.0f, -1.0f, 0.0f);
+    texCoords[0] = glm::vec2(0.5f, 0.0f);
+    vertices[numVertices - 1] = glm::vec3(0.0f, 1.0f, 0.0f);
+    texCoords[numVertices - 1] = glm::vec2(0.5f, 1.0f);
+    for(int i = 1; i < prec; i++)
     {
-        for(int j = 0; j <= prec; j++)
+        for(int j = 0; j < prec; j++)
         {
             float y = (float)cos(toRadians(180.0f - i*180.0f/prec));
             float x = -(float)cos(toRadians(j*360.0f/prec)) * (float)abs(cos(asin(y)));
             float z = (float)sin(toRadians(j*360.0f/prec)) * (float)abs(cos(asin(y)));
 
-            vertices[i*(prec + 1) + j] = glm::vec3(x, y, z);
-            texCoords[i*(prec + 1) + j] = glm::vec2((float)j/prec, (float)i/prec);
-            normals[i*(prec + 1) + j] = glm::vec3(x, y, z);
+            vertices[vertexIndex(prec, i, j)] = glm::vec3(x, y, z);
+            texCoords[vertexIndex(prec, i, j)] = glm::vec2((float)j/prec, (float)i/prec);
         }
     }
+    normals = vertices;
 
-    // Calculate Triangle Indices
+    // Calculate Triangle Indices, without the quads' degenerate halves at the poles
     for(int i = 0; i < prec; i++)
     {
         for(int j = 0; j < prec; j++)
         {
-            indices[6*(i*prec + j) + 0] = i*(prec + 1) + j;
-            indices[6*(i*prec + j) + 1] = i*(prec + 1) + j + 1;
-            indices[6*(i*prec + j) + 2] = (i + 1)*(prec + 1) + j;
-            indices[6*(i*prec + j) + 3] = i*(prec + 1) + j + 1;
-            indices[6*(i*prec + j) + 4] = (i+1)*(prec + 1) + j + 1;
-            indices[6*(i*prec + j) + 5] = (i+1)*(prec + 1) + j;
+            if(i > 0)
+            {
+                indices.push_back(vertexIndex(prec, i, j));
+                indices.push_back(vertexIndex(prec, i, j + 1));
+                indices.push_back(vertexIndex(prec, i + 1, j));
+            }
+            if(i < prec - 1)
+            {
+                indices.push_back(vertexIndex(prec, i, j + 1));
+                indices.push_back(vertexIndex(prec, i + 1, j + 1));
+                indices.push_back(vertexIndex(prec, i + 1, j));
+            }
         }
     }
 }
 
+// Ring i from the south pole, column j around
+int Sphere::vertexIndex(int prec, int i, int j)
+{
+    if(i == 0)
+    {
+        return 0;
+    }
+    if(i == prec)
+    {
+        return 1 + (prec - 1) * prec;
+    }
+    return 1 + (i - 1) * prec + j % prec;
+}
+
 int Sphere::getNumVertices() {return numVertices;}
 int Sphere::getNumIndices() {return numIndices;}
 std::vector<int> Sphere::getIndices() {return indices;}